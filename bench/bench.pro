@@ -0,0 +1,15 @@
+QT       += core
+QT       -= gui
+
+TARGET = substringFinderBench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+QMAKE_CXXFLAGS += -std=c++17
+
+include(../utils/engine.pri)
+
+SOURCES += \
+        main.cpp
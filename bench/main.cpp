@@ -0,0 +1,403 @@
+#include "../utils/searchengine.h"
+#include "../utils/regexquery.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTemporaryDir>
+#include <QDirIterator>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QThread>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*
+ * Benchmarks the engine on synthetic corpora. Every corpus is generated from
+ * a fixed seed with a generator whose output doesn't depend on the platform,
+ * so runs on different commits measure the same bytes. For each corpus it
+ * reports index build time and size, how many files the index lets through
+ * for every query, query latency with the corpus evicted from the page cache
+ * and with it cached, and the throughput of a full scan without the index.
+ * The report is one JSON document on stdout, progress goes to stderr.
+ */
+namespace {
+    // splitmix64, std:: distributions differ between standard libraries
+    struct Random {
+        uint64_t state;
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        uint64_t below(uint64_t bound) {
+            return next() % bound;
+        }
+    };
+
+    struct Query {
+        QString name;
+        QString pattern;
+        bool regex = false;
+        bool ignore_case = false;
+        bool multi = false;
+    };
+
+    struct Corpus {
+        QString name;
+        QString directory;
+        size_t files = 0;
+        int64_t bytes = 0;
+        std::vector<Query> queries;
+    };
+
+    const char* const WORDS[] = {
+        "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with", "was", "on", "be", "at", "by",
+        "this", "had", "not", "are", "but", "from", "or", "have", "an", "they", "which", "one", "you", "were",
+        "return", "const", "static", "void", "int", "struct", "class", "public", "private", "template",
+        "include", "namespace", "std", "vector", "string", "size_t", "nullptr", "auto", "while", "break",
+        "index", "search", "trigram", "posting", "directory", "scanner", "worker", "thread", "queue", "match"};
+    const char* const WIDE_WORDS[] = {
+        "строка", "поиск", "файл", "индекс", "данные", "текст", "слово", "каталог", "очередь", "поток",
+        "数据", "搜索", "文件", "索引", "字符串", "目录", "λέξη", "κείμενο", "αρχείο", "Straße", "größe"};
+    const char* const RARE = "xylophonequartz";
+    const char* const WIDE_RARE = "щелкунчик";
+    // a file gets the rare word with probability 1 / RARE_ONE_IN
+    const uint64_t RARE_ONE_IN = 500;
+
+    template <typename T, size_t N>
+    char const* pick(Random& random, T const (&words)[N]) {
+        return words[random.below(N)];
+    }
+
+    QByteArray text(Random& random, int64_t size, bool wide, bool rare) {
+        QByteArray result;
+        result.reserve(size + 64);
+        int64_t planted = rare ? int64_t(random.below(size)) : -1;
+        for (int word = 1; result.size() < size; ++word) {
+            if (planted >= 0 && result.size() >= planted) {
+                result += wide ? WIDE_RARE : RARE;
+                planted = -1;
+            } else {
+                result += wide && random.below(3) == 0 ? pick(random, WIDE_WORDS) : pick(random, WORDS);
+            }
+            result += word % 12 == 0 ? '\n' : ' ';
+        }
+        return result;
+    }
+
+    QByteArray binary(Random& random, int64_t size) {
+        QByteArray result(size, '\0');
+        for (int64_t i = 0; i < size; i += 8) {
+            uint64_t bits = random.next();
+            for (int64_t j = i; j < std::min(size, i + 8); ++j, bits >>= 8) {
+                // zero bytes make the file look binary, as in object files
+                result[int(j)] = (bits & 0x300) == 0 ? '\0' : char(bits);
+            }
+        }
+        return result;
+    }
+
+    void write_file(Corpus& corpus, size_t id, QByteArray const& content) {
+        QString subdirectory = corpus.directory + QString("/d%1").arg(id % 64, 2, 10, QChar('0'));
+        QDir().mkpath(subdirectory);
+        QFile file(subdirectory + QString("/f%1.txt").arg(id, 6, 10, QChar('0')));
+        file.open(QFile::WriteOnly);
+        file.write(content);
+        ++corpus.files;
+        corpus.bytes += content.size();
+    }
+
+    std::vector<Query> ascii_queries() {
+        return {{"rare literal", RARE},
+                {"common literal", "template"},
+                {"absent literal", "qqzzqqzzq"},
+                {"short literal", "st"},
+                {"ignore case", "XYLOPHONEQUARTZ", false, true},
+                {"multi pattern", QString("%1|namespace|qqzzqqzzq").arg(RARE), false, false, true},
+                {"regex", "xylo[a-z]+quartz", true},
+                {"regex alternation", "(struct|class) scanner", true}};
+    }
+
+    Corpus make_corpus(QString const& root, QString const& name, uint64_t seed, size_t files,
+                       int64_t file_size, bool wide, int binary_one_in) {
+        Corpus corpus{name, root + "/" + QString(name).replace(' ', '-'), 0, 0, {}};
+        Random random{seed};
+        bool planted = false;
+        for (size_t i = 0; i < files; ++i) {
+            // sizes vary around file_size so files don't all end on the same buffer boundary
+            int64_t size = file_size / 2 + int64_t(random.below(uint64_t(file_size)));
+            if (binary_one_in > 0 && random.below(binary_one_in) == 0) {
+                write_file(corpus, i, binary(random, size));
+                continue;
+            }
+            bool rare = random.below(RARE_ONE_IN) == 0 || (!planted && i + 1 == files);
+            planted |= rare;
+            write_file(corpus, i, text(random, size, wide, rare));
+        }
+        corpus.queries = ascii_queries();
+        if (wide) {
+            corpus.queries.push_back({"non-ascii rare literal", QString::fromUtf8(WIDE_RARE)});
+            corpus.queries.push_back({"non-ascii ignore case", QString::fromUtf8("ПОИСК"), false, true});
+            corpus.queries.push_back({"non-ascii regex", QString::fromUtf8("(搜索|поиск) [a-z]+"), true});
+        }
+        return corpus;
+    }
+
+    // best effort: clean pages of the files are dropped, nothing else is touched
+    void evict(QString const& path) {
+        std::vector<QString> files;
+        if (QFileInfo(path).isDir()) {
+            for (QDirIterator it(path, QDir::Files, QDirIterator::Subdirectories); it.hasNext(); ) {
+                files.push_back(it.next());
+            }
+        } else {
+            files.push_back(path);
+        }
+        for (auto const& i: files) {
+            int fd = open(QFile::encodeName(i).constData(), O_RDONLY);
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+    }
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        return values.empty() ? 0 : values[values.size() / 2];
+    }
+
+    // resident set of the process
+    double rss_kib() {
+        QFile status("/proc/self/status");
+        if (!status.open(QFile::ReadOnly)) {
+            return 0;
+        }
+        for (QByteArray line: status.readAll().split('\n')) {
+            if (line.startsWith("VmRSS:")) {
+                return line.mid(6).trimmed().split(' ').front().toDouble();
+            }
+        }
+        return 0;
+    }
+
+    std::map<parameters, bool> base_parameters(bool bytes) {
+        std::map<parameters, bool> params;
+        for (auto i: {parameters::Hidden, parameters::FirstMatch, parameters::ShowLine, parameters::Watch,
+                      parameters::Ordered, parameters::MultiPattern, parameters::Regex, parameters::IgnoreCase}) {
+            params[i] = false;
+        }
+        params[parameters::Recursive] = true;
+        params[parameters::Preprocess] = true;
+        params[parameters::ByteIndex] = bytes;
+        return params;
+    }
+
+    struct Run {
+        double milliseconds = 0;
+        size_t files = 0;
+        size_t matches = 0;
+    };
+
+    Run search(SearchEngine& engine, Query const& query, QString const& directory) {
+        Run run;
+        SearchEngine::Callbacks callbacks;
+        callbacks.matches = [&run](MatchBatch const& batch) {
+            run.files += batch.size();
+            run.matches += batch.coordinates.size();
+        };
+        auto start = std::chrono::steady_clock::now();
+        if (query.regex) {
+            engine.search_regex(query.pattern, {directory}, callbacks);
+        } else {
+            engine.search(query.multi ? SearchEngine::split_patterns(query.pattern) :
+                          std::vector<QString>{query.pattern}, {directory}, callbacks);
+        }
+        run.milliseconds = milliseconds_since(start);
+        return run;
+    }
+
+    size_t candidates(TrigramIndex const& index, Query const& query) {
+        std::set<uint32_t> result;
+        for (auto const& i: index.directories) {
+            std::vector<uint32_t> files;
+            if (query.regex) {
+                files = regex_query::candidates(regex_query::analyze(query.pattern, index.kind(), query.ignore_case),
+                                                i.second);
+                result.insert(files.begin(), files.end());
+                continue;
+            }
+            for (auto const& pattern: query.multi ? SearchEngine::split_patterns(query.pattern) :
+                                                    std::vector<QString>{query.pattern}) {
+                files = i.second.candidates(string_trigrams(pattern, index.kind(), query.ignore_case));
+                result.insert(files.begin(), files.end());
+            }
+        }
+        return result.size();
+    }
+
+    QJsonObject measure(Corpus const& corpus, QString const& index_path, int threads, int repeat, bool bytes) {
+        const double MEBIBYTE = 1 << 20;
+        QJsonObject report{{"corpus", corpus.name}, {"files", double(corpus.files)},
+                           {"bytes", double(corpus.bytes)}};
+
+        std::map<parameters, bool> params = base_parameters(bytes);
+        SearchEngine builder(params);
+        builder.set_thread_count(threads);
+        evict(corpus.directory);
+        double rss = rss_kib();
+        auto start = std::chrono::steady_clock::now();
+        builder.build_index({corpus.directory});
+        double build = milliseconds_since(start);
+        rss = rss_kib() - rss;
+        builder.save_index(index_path);
+        TrigramIndex const& index = *builder.index();
+        report["index"] = QJsonObject{{"build_ms", build},
+                                      {"files", double(index.file_count())},
+                                      {"trigrams", double(index.trigram_count())},
+                                      {"memory_bytes", double(index.memory_usage())},
+                                      {"legacy_memory_bytes", double(index.legacy_memory_usage())},
+                                      {"file_bytes", double(QFileInfo(index_path).size())},
+                                      {"rss_growth_kib", rss}};
+
+        // a literal that occurs nowhere makes every byte be read and compared
+        std::map<parameters, bool> scan_params = params;
+        scan_params[parameters::Preprocess] = false;
+        SearchEngine scanner(scan_params);
+        scanner.set_thread_count(threads);
+        Query absent{"full scan", "qqzzqqzzq"};
+        evict(corpus.directory);
+        double cold = search(scanner, absent, corpus.directory).milliseconds;
+        std::vector<double> warm;
+        for (int i = 0; i < repeat; ++i) {
+            warm.push_back(search(scanner, absent, corpus.directory).milliseconds);
+        }
+        report["scan"] = QJsonObject{{"cold_ms", cold},
+                                     {"warm_ms", median(warm)},
+                                     {"cold_mb_per_s", corpus.bytes / MEBIBYTE / (cold / 1000)},
+                                     {"warm_mb_per_s", corpus.bytes / MEBIBYTE / (median(warm) / 1000)}};
+
+        QJsonArray queries;
+        for (auto const& query: corpus.queries) {
+            std::map<parameters, bool> query_params = params;
+            query_params[parameters::Regex] = query.regex;
+            query_params[parameters::IgnoreCase] = query.ignore_case;
+            query_params[parameters::MultiPattern] = query.multi;
+            SearchEngine engine(query_params);
+            engine.set_thread_count(threads);
+
+            evict(corpus.directory);
+            evict(index_path);
+            start = std::chrono::steady_clock::now();
+            engine.load_index(index_path);
+            double load = milliseconds_since(start);
+            Run first = search(engine, query, corpus.directory);
+            std::vector<double> times;
+            for (int i = 0; i < repeat; ++i) {
+                times.push_back(search(engine, query, corpus.directory).milliseconds);
+            }
+            size_t passed = candidates(*engine.index(), query);
+            queries.append(QJsonObject{{"name", query.name},
+                                       {"pattern", query.pattern},
+                                       {"candidates", double(passed)},
+                                       {"selectivity", double(passed) / std::max<size_t>(index.file_count(), 1)},
+                                       {"files_matched", double(first.files)},
+                                       {"matches", double(first.matches)},
+                                       {"index_load_cold_ms", load},
+                                       {"cold_ms", first.milliseconds},
+                                       {"warm_ms", median(times)}});
+        }
+        report["queries"] = queries;
+        return report;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("substringFinderBench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks indexing and search on deterministic synthetic corpora.");
+    parser.addHelpOption();
+    QCommandLineOption scale_option("scale", "Corpus size factor.", "factor", "1");
+    QCommandLineOption seed_option("seed", "Generator seed.", "seed", "2018");
+    QCommandLineOption repeat_option("repeat", "Warm runs per measurement, the median is reported.", "count", "5");
+    QCommandLineOption threads_option({"j", "threads"}, "Worker threads, 0 for one per core.", "count", "0");
+    QCommandLineOption directory_option("directory", "Where to generate corpora instead of a temporary directory.",
+                                        "path");
+    QCommandLineOption bytes_option("bytes", "Build indexes of UTF-8 bytes instead of decoded characters.");
+    parser.addOptions({scale_option, seed_option, repeat_option, threads_option, directory_option, bytes_option});
+    parser.process(app);
+
+    double scale = parser.value(scale_option).toDouble();
+    uint64_t seed = parser.value(seed_option).toULongLong();
+    int repeat = std::max(1, parser.value(repeat_option).toInt());
+    int threads = parser.value(threads_option).toInt();
+    bool bytes = parser.isSet(bytes_option);
+    if (scale <= 0) {
+        QTextStream(stderr) << "The scale has to be positive\n";
+        return 2;
+    }
+
+    QTemporaryDir temporary;
+    QString root = parser.isSet(directory_option) ? parser.value(directory_option) : temporary.path();
+    QDir().mkpath(root);
+    auto count = [scale](size_t files) { return std::max<size_t>(1, size_t(files * scale)); };
+
+    QTextStream log(stderr);
+    QJsonArray corpora;
+    struct Shape {
+        char const* name;
+        size_t files;
+        int64_t file_size;
+        bool wide;
+        int binary_one_in;
+    };
+    const Shape SHAPES[] = {
+        {"many small files", 20000, 2 << 10, false, 0},
+        {"few huge files", 4, 32 << 20, false, 0},
+        {"non-ascii text", 2000, 16 << 10, true, 0},
+        {"binary mixed in", 2000, 16 << 10, false, 2}};
+    for (size_t i = 0; i < sizeof(SHAPES) / sizeof(SHAPES[0]); ++i) {
+        Shape const& shape = SHAPES[i];
+        log << "generating " << shape.name << '\n';
+        log.flush();
+        Corpus corpus = make_corpus(root, shape.name, seed + i, count(shape.files), shape.file_size,
+                                    shape.wide, shape.binary_one_in);
+        log << "measuring " << shape.name << ": " << corpus.files << " files, "
+            << corpus.bytes / (1 << 20) << " MiB\n";
+        log.flush();
+        corpora.append(measure(corpus, root + "/" + QString("index-%1.sfti").arg(i), threads, repeat, bytes));
+    }
+
+    QJsonObject report{{"seed", QString::number(seed)},
+                       {"scale", scale},
+                       {"repeat", repeat},
+                       {"threads", threads},
+                       {"byte_index", bytes},
+                       {"ideal_threads", QThread::idealThreadCount()},
+                       {"corpora", corpora}};
+    QTextStream(stdout) << QJsonDocument(report).toJson(QJsonDocument::Indented);
+    return 0;
+}
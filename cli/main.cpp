@@ -0,0 +1,222 @@
+#include "../utils/searchengine.h"
+#include "../utils/indexfile.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QFileInfo>
+#include <QTextStream>
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <list>
+
+
+/*
+ * Command-line front of the engine. Every record goes to stdout as one JSON
+ * object per line with a "type" of match, error, binary, index, summary or
+ * stats; usage errors go to stderr. Like grep, the exit code is 2 on errors,
+ * files that couldn't be read included, otherwise 0 when something matched
+ * and 1 when nothing did.
+ */
+namespace {
+    void print(QJsonObject const& record) {
+        QByteArray line = QJsonDocument(record).toJson(QJsonDocument::Compact);
+        line += '\n';
+        std::fwrite(line.constData(), 1, line.size(), stdout);
+    }
+
+    int fail(QString const& message) {
+        QTextStream(stderr) << message << '\n';
+        return 2;
+    }
+
+    // failed is set once a file couldn't be read
+    SearchEngine::Callbacks report_problems(bool& failed) {
+        SearchEngine::Callbacks callbacks;
+        callbacks.error = [&failed](QString const& file_name) {
+            print({{"type", "error"}, {"file", file_name}});
+            failed = true;
+        };
+        callbacks.binary = [](QString const& file_name) {
+            print({{"type", "binary"}, {"file", file_name}});
+        };
+        return callbacks;
+    }
+
+    std::list<QString> absolute(QStringList const& directories) {
+        std::list<QString> result;
+        for (auto const& i: directories) {
+            result.push_back(QFileInfo(i).absoluteFilePath());
+        }
+        return result;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("substringFinderCli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Searches directories for substrings, optionally through a trigram index.\n\n"
+                                     "  index <directories>           build or update the index and save it\n"
+                                     "  search <pattern> [directories]  search, the indexed directories by default");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "index or search");
+    QCommandLineOption index_option({"i", "index"}, "Index file to load and save.", "file",
+                                    index_file::default_path());
+    QCommandLineOption no_index_option("no-index", "Traverse the directories instead of using the index.");
+    QCommandLineOption bytes_option("bytes", "Index UTF-8 bytes instead of decoded characters.");
+    QCommandLineOption regex_option({"e", "regex"}, "The pattern is a regular expression.");
+    QCommandLineOption multi_option({"m", "multi"}, "Several patterns separated by |, \\ escapes | and \\.");
+    QCommandLineOption ignore_case_option({"c", "ignore-case"}, "Ignore case.");
+    QCommandLineOption first_match_option({"f", "first-match"}, "Report only the first match in a file.");
+    QCommandLineOption lines_option({"l", "lines"}, "Report line, column and the text around each match.");
+    QCommandLineOption ordered_option({"o", "ordered"}, "Report files in the order they are listed.");
+    QCommandLineOption hidden_option("hidden", "Include hidden files.");
+    QCommandLineOption flat_option("no-recursive", "Don't descend into subdirectories.");
+    QCommandLineOption threads_option({"j", "threads"}, "Worker threads, 0 for one per core.", "count", "0");
+    QCommandLineOption binary_option("binary", "Binary files: skip, text or bytes.", "policy", "skip");
+    QCommandLineOption stats_option("stats", "Print where the time went as a final stats record.");
+    QCommandLineOption include_option("include", "Only files matching the glob, may be repeated.", "glob");
+    QCommandLineOption exclude_option("exclude", "Leave out what matches the glob, may be repeated.", "glob");
+    QCommandLineOption max_size_option("max-size", "Leave out files larger than this, 0 for no limit.", "bytes",
+                                       "0");
+    QCommandLineOption ignore_files_option("ignore-files", "Honor .gitignore and .ignore files, skip .git.");
+    parser.addOptions({index_option, no_index_option, bytes_option, regex_option, multi_option, ignore_case_option,
+                       first_match_option, lines_option, ordered_option, hidden_option, flat_option,
+                       threads_option, binary_option, stats_option, include_option, exclude_option,
+                       max_size_option, ignore_files_option});
+    parser.process(app);
+
+    QStringList arguments = parser.positionalArguments();
+    if (arguments.isEmpty() || (arguments[0] != "index" && arguments[0] != "search")) {
+        return fail("Expected a command, index or search; see --help");
+    }
+    QString command = arguments.takeFirst();
+    const std::map<QString, binary_policy> policies = {
+        {"skip", SkipBinary}, {"text", SearchBinaryAsText}, {"bytes", SearchBinaryAsBytes}};
+    if (policies.count(parser.value(binary_option)) == 0) {
+        return fail("Unknown binary policy: " + parser.value(binary_option));
+    }
+
+    bool regex = parser.isSet(regex_option);
+    std::map<parameters, bool> params;
+    params[parameters::Hidden] = parser.isSet(hidden_option);
+    params[parameters::Recursive] = !parser.isSet(flat_option);
+    params[parameters::FirstMatch] = parser.isSet(first_match_option);
+    params[parameters::ShowLine] = parser.isSet(lines_option);
+    params[parameters::Preprocess] = !parser.isSet(no_index_option);
+    params[parameters::Watch] = false;
+    params[parameters::Ordered] = parser.isSet(ordered_option);
+    params[parameters::MultiPattern] = !regex && parser.isSet(multi_option);
+    params[parameters::Regex] = regex;
+    params[parameters::IgnoreCase] = parser.isSet(ignore_case_option);
+    params[parameters::ByteIndex] = parser.isSet(bytes_option);
+
+    SearchEngine engine(params);
+    engine.set_thread_count(parser.value(threads_option).toInt());
+    engine.set_binary_policy(policies.at(parser.value(binary_option)));
+    engine.set_stats_enabled(parser.isSet(stats_option));
+    PathFilter::Options filter;
+    filter.include = parser.values(include_option);
+    filter.exclude = parser.values(exclude_option);
+    filter.maximum_size = parser.value(max_size_option).toLongLong();
+    filter.ignore_files = parser.isSet(ignore_files_option);
+    engine.set_filter(filter);
+    auto print_stats = [&engine] {
+        if (engine.stats() != nullptr) {
+            QJsonObject record = engine.stats()->to_json();
+            record["type"] = "stats";
+            print(record);
+        }
+    };
+
+    bool failed = false;
+    QString index_path = parser.value(index_option);
+    QString error;
+    bool loaded = params[parameters::Preprocess] && QFileInfo::exists(index_path) &&
+        engine.load_index(index_path, &error);
+    if (!error.isEmpty()) {
+        QTextStream(stderr) << "Index ignored: " << error << '\n';
+    }
+
+    if (command == "index") {
+        if (arguments.isEmpty()) {
+            return fail("Expected directories to index");
+        }
+        std::list<QString> directories = absolute(arguments);
+        engine.build_index(std::set<QString>(directories.begin(), directories.end()), report_problems(failed));
+        if (!engine.save_index(index_path, &error)) {
+            return fail("Couldn't save index: " + error);
+        }
+        print({{"type", "index"}, {"path", index_path},
+               {"directories", int(engine.index()->directories.size())},
+               {"files", double(engine.index()->file_count())},
+               {"trigrams", double(engine.index()->trigram_count())}});
+        print_stats();
+        return failed ? 2 : 0;
+    }
+
+    if (arguments.isEmpty()) {
+        return fail("Expected a pattern");
+    }
+    QString pattern = arguments.takeFirst();
+    std::vector<QString> split = params[parameters::MultiPattern] && !regex ?
+        SearchEngine::split_patterns(pattern) : std::vector<QString>{pattern};
+    if (pattern.isEmpty() || split.empty()) {
+        return fail("The pattern is empty");
+    }
+    std::list<QString> directories = absolute(arguments);
+    if (directories.empty() && loaded) {
+        for (auto const& i: engine.index()->directories) {
+            directories.push_back(i.first);
+        }
+    }
+    if (directories.empty()) {
+        return fail("Expected directories to search");
+    }
+
+    std::vector<QString> patterns;
+    // a batch has an entry per file and pattern
+    std::set<QString> files;
+    size_t matches = 0;
+    SearchEngine::Callbacks callbacks = report_problems(failed);
+    callbacks.started = [&patterns](std::vector<QString> const& list) {
+        patterns = list;
+    };
+    callbacks.matches = [&patterns, &files, &matches](MatchBatch const& batch) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            for (uint64_t j = batch.offsets[i]; j < batch.offsets[i + 1]; ++j) {
+                QJsonObject record{{"type", "match"}, {"file", batch.files[i]},
+                                   {"pattern", patterns[batch.pattern_ids[i]]},
+                                   {"offset", batch.coordinates[j]}};
+                if (!batch.lines.empty() && batch.lines[j].line != 0) {
+                    record["line"] = batch.lines[j].line;
+                    record["column"] = batch.lines[j].column;
+                    record["text"] = batch.lines[j].snippet;
+                }
+                print(record);
+            }
+            matches += batch.offsets[i + 1] - batch.offsets[i];
+            files.insert(batch.files[i]);
+        }
+    };
+
+    if (regex) {
+        QRegularExpression expression(pattern);
+        if (!expression.isValid()) {
+            return fail("Invalid regular expression: " + expression.errorString());
+        }
+        engine.search_regex(pattern, directories, callbacks);
+    } else {
+        engine.search(split, directories, callbacks);
+    }
+    print({{"type", "summary"}, {"files", double(files.size())}, {"matches", double(matches)}});
+    print_stats();
+    std::fflush(stdout);
+    return failed ? 2 : matches > 0 ? 0 : 1;
+}
@@ -2,6 +2,8 @@
 #include "ui_mainwindow.h"
 #include "utils/directoryscanner.h"
 #include "utils/trigrammanager.h"
+#include "utils/indexfile.h"
+#include "utils/searchengine.h"
 
 #include <QCommonStyle>
 #include <QDesktopWidget>
@@ -9,10 +11,13 @@
 #include <QMessageBox>
 #include <QTimer>
 #include <QCheckBox>
+#include <QSignalBlocker>
 #include <QDirIterator>
 #include <QDir>
 #include <QProgressBar>
 #include <QFileInfo>
+#include <QTextStream>
+#include <QRegularExpression>
 #include <QLabel>
 #include <QtCore/QThread>
 #include <QMovie>
@@ -24,6 +29,15 @@
 #include <string>
 
 
+namespace {
+    // pause in typing after which a search as you type starts
+    const int TYPING_PAUSE = 150;
+
+    QString escape_pattern(QString pattern) {
+        return pattern.replace("\\", "\\\\").replace("|", "\\|");
+    }
+}
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
     ui(new Ui::MainWindow) {
@@ -32,9 +46,13 @@ MainWindow::MainWindow(QWidget *parent)
     setGeometry(QStyle::alignedRect(Qt::LeftToRight, Qt::AlignCenter, size(), qApp->desktop()->availableGeometry()));
 
     ui->detailsList->setHidden(true);
+    ui->statsText->setHidden(true);
     ui->cancelButton->setHidden(true);
     ui->scanButton->setDisabled(true);
 
+    matches = new MatchModel(this);
+    ui->stringsList->setModel(matches);
+
     QCommonStyle style;
     ui->actionAdd_Directory->setIcon(style.standardIcon(QCommonStyle::SP_DialogOpenButton));
     ui->actionRemove_Directories_From_List->setIcon(style.standardIcon(QCommonStyle::SP_DialogCloseButton));
@@ -43,6 +61,7 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->actionAdd_Directory, &QAction::triggered, this, &MainWindow::select_directory);
     connect(ui->actionRemove_Directories_From_List, &QAction::triggered,
             this, &MainWindow::remove_directories_from_list);
+    connect(ui->actionLoad_Patterns, &QAction::triggered, this, &MainWindow::load_patterns);
     connect(ui->actionExit, &QAction::triggered, this, &QWidget::close);
 
     connect(ui->recursiveCheckbox, &QCheckBox::toggled, this, &MainWindow::normalize_directories);
@@ -51,30 +70,145 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->recursiveCheckbox, &QCheckBox::stateChanged, this, &MainWindow::handle_scan_button);
     connect(ui->hiddenCheckbox, &QCheckBox::stateChanged, this, &MainWindow::handle_scan_button);
     connect(ui->preprocessCheckBox, &QCheckBox::stateChanged, this, &MainWindow::handle_scan_button);
+    connect(ui->byteIndexCheckbox, &QCheckBox::stateChanged, this, &MainWindow::handle_scan_button);
+    connect(ui->includeEdit, &QLineEdit::textChanged, this, &MainWindow::handle_scan_button);
+    connect(ui->excludeEdit, &QLineEdit::textChanged, this, &MainWindow::handle_scan_button);
+    connect(ui->maxSizeSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::handle_scan_button);
+    connect(ui->ignoreFilesCheckbox, &QCheckBox::stateChanged, this, &MainWindow::handle_scan_button);
     connect(ui->preprocessCheckBox, &QCheckBox::toggled, ui->prepareButton, &QPushButton::setVisible);
     connect(ui->preprocessCheckBox, &QCheckBox::toggled, ui->scanButton, &QPushButton::setDisabled);
+    connect(ui->liveCheckbox, &QCheckBox::toggled, this, &MainWindow::restart_watcher);
+    connect(ui->recursiveCheckbox, &QCheckBox::toggled, this, &MainWindow::restart_watcher);
+    connect(ui->hiddenCheckbox, &QCheckBox::toggled, this, &MainWindow::restart_watcher);
+    connect(ui->statsCheckbox, &QCheckBox::toggled, this, [this](bool checked) {
+        ui->statsText->setHidden(!checked || ui->statsText->toPlainText().isEmpty());
+    });
 
     connect(ui->inputString, &QLineEdit::returnPressed, ui->scanButton, &QPushButton::click);
 
-    qRegisterMetaType<std::list<int>>("coordinates");
-    qRegisterMetaType<std::map<QString, std::map<QString,
-            std::set<std::list<QChar>>>>*>("trigrams");
+    typing = new QTimer(this);
+    typing->setSingleShot(true);
+    typing->setInterval(TYPING_PAUSE);
+    connect(typing, &QTimer::timeout, this, &MainWindow::instant_search);
+    connect(ui->inputString, &QLineEdit::textEdited, this, [this] {
+        if (ui->instantCheckbox->isChecked()) {
+            typing->start();
+        }
+    });
+    connect(ui->instantCheckbox, &QCheckBox::toggled, this, [this] {
+        query_cache->clear();
+    });
+    connect(ui->cancelButton, &QPushButton::clicked, this, [this] {
+        typing->stop();
+        search_again = false;
+    });
+
+    qRegisterMetaType<std::shared_ptr<MatchBatch>>("std::shared_ptr<MatchBatch>");
+    qRegisterMetaType<TrigramIndex*>("TrigramIndex*");
+
+    load_index();
+    restart_watcher();
 }
 
+/*
+ * A search, a build or a live update may still read the index from their
+ * threads, so they are interrupted and waited for before it is applied,
+ * saved and freed. Their threads quit on their own once done, the event
+ * loop of this one doesn't run anymore.
+ */
 MainWindow::~MainWindow() {
+    emit closing();
+    for (QThread* thread: {scan_thread.data(), index_thread.data(), live_thread.data()}) {
+        if (thread != nullptr) {
+            thread->wait();
+        }
+    }
+    if (watcher_thread != nullptr) {
+        watcher_thread->quit();
+        watcher_thread->wait();
+        delete watcher;
+    }
+    if (live_result != nullptr) {
+        apply_live(live_result);
+    }
+    if (index_changed) {
+        save_index();
+    }
     delete preprocessing;
 }
 
+void MainWindow::load_index() {
+    QString path = index_file::default_path();
+    if (!QFile::exists(path)) {
+        return;
+    }
+    QString error;
+    preprocessing = index_file::load(get_parameters(), path, &error);
+    if (preprocessing == nullptr) {
+        ui->statusBar->showMessage("Saved index ignored: " + error);
+        return;
+    }
+    for (auto const& i: preprocessing->directories) {
+        add_directory(i.first);
+    }
+    // the saved index is of whatever kind it was built as
+    {
+        QSignalBlocker blocker(ui->byteIndexCheckbox);
+        ui->byteIndexCheckbox->setChecked(preprocessing->kind() == ByteTrigrams);
+    }
+    directories_to_preprocess.clear();
+    ui->scanButton->setDisabled(false);
+}
+
+void MainWindow::save_index() {
+    QString error;
+    if (preprocessing != nullptr && !index_file::save(*preprocessing, index_file::default_path(), &error)) {
+        ui->statusBar->showMessage("Couldn't save index: " + error);
+        return;
+    }
+    index_changed = false;
+}
+
 std::map<parameters, bool> MainWindow::get_parameters() {
     std::map<parameters, bool> result;
     result[parameters::Hidden] = ui->hiddenCheckbox->checkState();
     result[parameters::Recursive] = ui->recursiveCheckbox->checkState();
     result[parameters::FirstMatch] = ui->firstMatchCheckbox->checkState();
+    result[parameters::ShowLine] = ui->showLineCheckbox->checkState();
     result[parameters::Preprocess] = ui->preprocessCheckBox->checkState();
+    result[parameters::Watch] = ui->liveCheckbox->checkState();
+    result[parameters::Ordered] = ui->orderedCheckbox->checkState();
+    result[parameters::MultiPattern] = ui->multiPatternCheckbox->checkState();
+    result[parameters::Regex] = ui->regexCheckbox->checkState();
+    result[parameters::IgnoreCase] = ui->ignoreCaseCheckbox->checkState();
+    result[parameters::ByteIndex] = ui->byteIndexCheckbox->checkState();
 
     return std::move(result);
 }
 
+// nullptr when nothing is filtered, so walks don't pay for it
+std::shared_ptr<PathFilter const> MainWindow::get_filter() {
+    auto globs = [](QString const& text) {
+        QStringList result;
+        for (QString const& i: text.split(' ')) {
+            if (!i.isEmpty()) {
+                result.append(i);
+            }
+        }
+        return result;
+    };
+    PathFilter::Options options;
+    options.include = globs(ui->includeEdit->text());
+    options.exclude = globs(ui->excludeEdit->text());
+    options.maximum_size = int64_t(ui->maxSizeSpinBox->value()) << 20;
+    options.ignore_files = ui->ignoreFilesCheckbox->isChecked();
+    if (options.include.isEmpty() && options.exclude.isEmpty() && options.maximum_size == 0 &&
+            !options.ignore_files) {
+        return nullptr;
+    }
+    return std::make_shared<PathFilter const>(options);
+}
+
 void MainWindow::notification(const char* content,
                               const char* window_title = "Notification",
                               int time = 4000) {
@@ -156,10 +290,39 @@ void MainWindow::add_directory(QString const& dir) {
 void MainWindow::remove_directory(int row) {
     QString name = get_directory_name(row);
     ui->directoriesTable->removeRow(row);
+    query_cache->clear();
     directories_to_preprocess.erase(name);
     if (preprocessing != nullptr) {
-        (*preprocessing).erase(name);
+        // a live update may still be reading this directory's index
+        if (live_running || live_result != nullptr) {
+            removed_during_update.insert(name);
+        } else {
+            index_changed |= preprocessing->directories.erase(name) > 0;
+        }
+    }
+}
+
+void MainWindow::load_patterns() {
+    QString file_name = QFileDialog::getOpenFileName(this, "Load Patterns, One per Line");
+    if (file_name.isEmpty()) {
+        return;
+    }
+    QFile file(file_name);
+    if (!file.open(QFile::ReadOnly)) {
+        notification("Couldn't read the pattern file");
+        return;
     }
+    QStringList patterns;
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine();
+        if (!line.isEmpty()) {
+            patterns.append(escape_pattern(line));
+        }
+    }
+    ui->inputString->setText(patterns.join('|'));
+    ui->multiPatternCheckbox->setChecked(true);
+    ui->regexCheckbox->setChecked(false);
 }
 
 void MainWindow::remove_directories_from_list() {
@@ -191,12 +354,29 @@ void MainWindow::normalize_directories(bool checkbox_state) {
 }
 
 void MainWindow::action() {
+    busy = true;
     ui->preprocessCheckBox->setDisabled(true);
     ui->firstMatchCheckbox->setDisabled(true);
+    ui->multiPatternCheckbox->setDisabled(true);
+    ui->regexCheckbox->setDisabled(true);
+    ui->ignoreCaseCheckbox->setDisabled(true);
+    ui->showLineCheckbox->setDisabled(true);
+    ui->orderedCheckbox->setDisabled(true);
     ui->hiddenCheckbox->setDisabled(true);
     ui->recursiveCheckbox->setDisabled(true);
+    ui->threadsSpinBox->setDisabled(true);
+    ui->binaryComboBox->setDisabled(true);
+    ui->statsCheckbox->setDisabled(true);
+    ui->byteIndexCheckbox->setDisabled(true);
+    ui->includeEdit->setDisabled(true);
+    ui->excludeEdit->setDisabled(true);
+    ui->maxSizeSpinBox->setDisabled(true);
+    ui->ignoreFilesCheckbox->setDisabled(true);
     ui->detailsList->clear();
     ui->detailsList->setHidden(true);
+    binary_files = 0;
+    binary_item = nullptr;
+    stats = ui->statsCheckbox->isChecked() ? std::make_shared<SearchStats>() : nullptr;
     emit clear_details();
 
     ui->scanButton->setDisabled(true);
@@ -210,16 +390,22 @@ std::pair<DirectoryScanner*, QThread*> MainWindow::new_dir_scanner() {
     action();
     QThread* worker_thread = new QThread();
     DirectoryScanner* dir_scanner = new DirectoryScanner(get_parameters(), preprocessing);
+    dir_scanner->set_thread_count(ui->threadsSpinBox->value());
+    dir_scanner->set_binary_policy(static_cast<binary_policy>(ui->binaryComboBox->currentIndex()));
+    dir_scanner->set_stats(stats);
+    dir_scanner->set_filter(get_filter());
     dir_scanner->moveToThread(worker_thread);
 
-    connect(dir_scanner, &DirectoryScanner::new_match, this, &MainWindow::catch_match);
+    connect(dir_scanner, &DirectoryScanner::new_matches, this, &MainWindow::catch_matches);
     connect(dir_scanner, &DirectoryScanner::new_error, this, &MainWindow::catch_error);
-    connect(dir_scanner, &DirectoryScanner::finished, worker_thread, &QThread::quit);
+    connect(dir_scanner, &DirectoryScanner::skipped_binary, this, &MainWindow::catch_binary);
+    connect(dir_scanner, &DirectoryScanner::finished, worker_thread, &QThread::quit, Qt::DirectConnection);
     connect(dir_scanner, &DirectoryScanner::finished, this, &MainWindow::finished_process);
     connect(dir_scanner, &DirectoryScanner::finished, dir_scanner, &DirectoryScanner::deleteLater);
     connect(dir_scanner, &DirectoryScanner::progress, this, &MainWindow::set_progress);
     connect(worker_thread, &QThread::finished, worker_thread, &QThread::deleteLater);
     connect(ui->cancelButton, &QPushButton::clicked, worker_thread, &QThread::requestInterruption);
+    connect(this, &MainWindow::closing, worker_thread, &QThread::requestInterruption);
 
     return {dir_scanner, worker_thread};
 }
@@ -230,19 +416,29 @@ void MainWindow::handle_scan_button() {
         for (int i = 0; i < ui->directoriesTable->rowCount(); ++i) {
             directories_to_preprocess.insert(get_directory_name(i));
         }
-        if (preprocessing != nullptr) {
-            delete preprocessing;
-            preprocessing = nullptr;
-        }
     }
 }
 
 void MainWindow::finished_process() {
+    busy = false;
     ui->preprocessCheckBox->setDisabled(false);
     ui->firstMatchCheckbox->setDisabled(false);
+    ui->multiPatternCheckbox->setDisabled(false);
+    ui->regexCheckbox->setDisabled(false);
+    ui->ignoreCaseCheckbox->setDisabled(false);
+    ui->showLineCheckbox->setDisabled(false);
+    ui->orderedCheckbox->setDisabled(false);
     ui->hiddenCheckbox->setDisabled(false);
     ui->recursiveCheckbox->setDisabled(false);
-    ui->prepareButton->setDisabled(false);
+    ui->threadsSpinBox->setDisabled(false);
+    ui->binaryComboBox->setDisabled(false);
+    ui->statsCheckbox->setDisabled(false);
+    ui->byteIndexCheckbox->setDisabled(false);
+    ui->includeEdit->setDisabled(false);
+    ui->excludeEdit->setDisabled(false);
+    ui->maxSizeSpinBox->setDisabled(false);
+    ui->ignoreFilesCheckbox->setDisabled(false);
+    ui->prepareButton->setDisabled(live_running);
     ui->actionRemove_Directories_From_List->setDisabled(false);
     ui->actionAdd_Directory->setDisabled(false);
     ui->cancelButton->setHidden(true);
@@ -250,6 +446,26 @@ void MainWindow::finished_process() {
     for (int i = 0; i < ui->directoriesTable->rowCount(); ++i) {
         static_cast<QProgressBar*>(ui->directoriesTable->cellWidget(i, 0))->setValue(0);
     }
+    // the workers are done, the stats won't change anymore
+    if (stats != nullptr) {
+        ui->statsText->setPlainText(stats->to_text());
+        ui->statsText->setHidden(false);
+    }
+
+    if (live_result != nullptr) {
+        apply_live(live_result);
+        live_result = nullptr;
+    }
+    update_live();
+
+    // result_ready still sees search_again and stays quiet about the superseded search
+    scan_thread = nullptr;
+    if (search_again) {
+        QTimer::singleShot(0, this, [this] {
+            search_again = false;
+            instant_search();
+        });
+    }
 }
 
 void MainWindow::preparations() {
@@ -257,66 +473,268 @@ void MainWindow::preparations() {
         notification("Please choose directories to scan");
         return;
     }
-    if (directories_to_preprocess.size() == 0) {
-        notification("There's nothing to preprocess");
-        return;
-    }
     if (preprocessing == nullptr) {
-        preprocessing = new std::map<QString, std::map<QString, std::set<int64_t>>>();
+        preprocessing = new TrigramIndex();
+    }
+    // directories already in the index are updated incrementally
+    std::set<QString> directories;
+    for (int i = 0; i < ui->directoriesTable->rowCount(); ++i) {
+        directories.insert(get_directory_name(i));
     }
     action();
     ui->directoriesTable->setStyleSheet("QProgressBar::chunk { background-color: rgba(0, 0, 255, 100) }");
 
     QThread* thread = new QThread();
-    TrigramManager* tm = new TrigramManager(directories_to_preprocess, get_parameters());
+    TrigramManager* tm = new TrigramManager(directories, get_parameters(), preprocessing);
+    tm->set_thread_count(ui->threadsSpinBox->value());
+    tm->set_stats(stats);
+    index_filter = get_filter();
+    tm->set_filter(index_filter);
     tm->moveToThread(thread);
 
     connect(thread, &QThread::started, tm, &TrigramManager::manage_trigrams);
     connect(thread, &QThread::finished, thread, &QThread::deleteLater);
     connect(tm, &TrigramManager::result, this, &MainWindow::prepared);
     connect(tm, &TrigramManager::finished, tm, &TrigramManager::deleteLater);
-    connect(tm, &TrigramManager::finished, thread, &QThread::quit);
+    connect(tm, &TrigramManager::finished, thread, &QThread::quit, Qt::DirectConnection);
     connect(tm, &TrigramManager::finished, this, &MainWindow::finished_process);
     connect(tm, &TrigramManager::throw_progress, this, &MainWindow::set_progress);
     connect(tm, &TrigramManager::throw_error, this, &MainWindow::catch_error);
+    connect(tm, &TrigramManager::throw_binary, this, &MainWindow::catch_binary);
     connect(ui->cancelButton, &QPushButton::clicked, tm, &TrigramManager::canceled);
+    connect(this, &MainWindow::closing, tm, &TrigramManager::canceled);
+    index_thread = thread;
     thread->start();
 }
 
-void MainWindow::prepared(std::map<QString, std::map<QString,
-                          std::set<int64_t>>>* result) {
+void MainWindow::prepared(TrigramIndex* result) {
     ui->scanButton->setDisabled(false);
-    if (preprocessing != nullptr) {
-        delete preprocessing;
+    if (preprocessing == nullptr) {
+        preprocessing = new TrigramIndex();
+    }
+    // directories indexed as the other kind of trigrams can't be kept alongside
+    if (result->kind() != preprocessing->kind()) {
+        preprocessing->directories.clear();
     }
-    preprocessing = result;
+    for (auto& i: result->directories) {
+        preprocessing->directories[i.first] = std::move(i.second);
+    }
+    preprocessing->params = result->params;
+    delete result;
     directories_to_preprocess.clear();
+    query_cache->clear();
+
+    const double MEBIBYTE = 1 << 20;
+    ui->statusBar->showMessage(QString("Index: %1 files, %2 trigrams, %3 MiB (std::set layout: ~%4 MiB)")
+                               .arg(QString::number(preprocessing->file_count()))
+                               .arg(QString::number(preprocessing->trigram_count()))
+                               .arg(QString::number(preprocessing->memory_usage() / MEBIBYTE, 'f', 1))
+                               .arg(QString::number(preprocessing->legacy_memory_usage() / MEBIBYTE, 'f', 1)));
+    save_index();
+    restart_watcher();
+}
+
+void MainWindow::restart_watcher() {
+    if (watcher_thread != nullptr) {
+        watcher_thread->quit();
+        watcher_thread->wait();
+        delete watcher;
+        watcher = nullptr;
+        watcher_thread = nullptr;
+    }
+    live_changes.clear();
+
+    std::map<parameters, bool> params = get_parameters();
+    if (!params[parameters::Watch] || preprocessing == nullptr || preprocessing->directories.empty()) {
+        return;
+    }
+    std::set<QString> directories;
+    for (auto const& i: preprocessing->directories) {
+        directories.insert(i.first);
+    }
+    watcher_thread = new QThread();
+    watcher = new IndexWatcher(directories, params);
+    watcher->moveToThread(watcher_thread);
+
+    connect(watcher_thread, &QThread::started, watcher, &IndexWatcher::watch_directories);
+    connect(watcher_thread, &QThread::finished, watcher_thread, &QThread::deleteLater);
+    connect(watcher, &IndexWatcher::changed, this, &MainWindow::files_changed);
+    connect(watcher, &IndexWatcher::throw_error, this, [this](QString const& message) {
+        ui->statusBar->showMessage(message);
+    });
+    watcher_thread->start();
+}
+
+// an empty set stands for the whole directory and absorbs any single paths
+void MainWindow::files_changed(std::map<QString, std::set<QString>> const& paths) {
+    query_cache->clear();
+    for (auto const& i: paths) {
+        if (preprocessing == nullptr || preprocessing->directories.count(i.first) == 0) {
+            continue;
+        }
+        auto current = live_changes.find(i.first);
+        if (current == live_changes.end()) {
+            live_changes[i.first] = i.second;
+        } else if (i.second.empty() || current->second.empty()) {
+            current->second.clear();
+        } else {
+            current->second.insert(i.second.begin(), i.second.end());
+            if (current->second.size() > IndexWatcher::STORM_LIMIT) {
+                current->second.clear();
+            }
+        }
+    }
+    update_live();
 }
 
+void MainWindow::update_live() {
+    if (busy || live_running || live_result != nullptr || live_changes.empty() || preprocessing == nullptr) {
+        return;
+    }
+    std::set<QString> directories;
+    for (auto const& i: live_changes) {
+        directories.insert(i.first);
+    }
+    live_running = true;
+    ui->prepareButton->setDisabled(true);
+
+    QThread* thread = new QThread();
+    TrigramManager* tm = new TrigramManager(directories, preprocessing->params, preprocessing);
+    tm->set_changes(live_changes);
+    tm->set_thread_count(ui->threadsSpinBox->value());
+    tm->set_filter(index_filter);
+    live_changes.clear();
+    tm->moveToThread(thread);
+
+    connect(thread, &QThread::started, tm, &TrigramManager::manage_trigrams);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+    connect(tm, &TrigramManager::result, this, &MainWindow::live_updated);
+    connect(tm, &TrigramManager::finished, tm, &TrigramManager::deleteLater);
+    connect(tm, &TrigramManager::finished, thread, &QThread::quit, Qt::DirectConnection);
+    connect(tm, &TrigramManager::finished, this, &MainWindow::live_finished);
+    connect(this, &MainWindow::closing, tm, &TrigramManager::canceled);
+    live_thread = thread;
+    thread->start();
+}
+
+// a search in progress keeps reading the old index, the update waits for it
+void MainWindow::live_updated(TrigramIndex* result) {
+    if (busy) {
+        live_result = result;
+    } else {
+        apply_live(result);
+    }
+}
+
+void MainWindow::apply_live(TrigramIndex* result) {
+    for (auto& i: result->directories) {
+        if (removed_during_update.count(i.first) == 0) {
+            preprocessing->directories[i.first] = std::move(i.second);
+        }
+    }
+    for (auto const& i: removed_during_update) {
+        preprocessing->directories.erase(i);
+    }
+    removed_during_update.clear();
+    delete result;
+    index_changed = true;
+    query_cache->clear();
+    ui->statusBar->showMessage(QString("Index updated: %1 files")
+                               .arg(QString::number(preprocessing->file_count())));
+}
+
+void MainWindow::live_finished() {
+    live_running = false;
+    if (!busy) {
+        ui->prepareButton->setDisabled(false);
+    }
+    update_live();
+}
+
+// an explicit search reads the files afresh
 void MainWindow::directories_scan() {
-    ui->stringsList->clear();
+    typing->stop();
+    query_cache->clear();
+    start_scan(false);
+}
+
+// a search still running is superseded: it is interrupted and this one starts once it stopped
+void MainWindow::instant_search() {
+    if (busy) {
+        if (scan_thread != nullptr) {
+            scan_thread->requestInterruption();
+        }
+        search_again = true;
+        return;
+    }
+    if (ui->scanButton->isEnabled()) {
+        start_scan(true);
+    }
+}
+
+// while typing an incomplete pattern is no reason for a notification
+void MainWindow::start_scan(bool typed) {
     QString input_string = ui->inputString->text();
     if (input_string.size() == 0) {
-        notification("Please write a string to search for");
+        if (!typed) {
+            notification("Please write a string to search for");
+        }
         return;
     }
 
     if (ui->directoriesTable->rowCount() == 0) {
-        notification("Please choose directories to scan");
+        if (!typed) {
+            notification("Please choose directories to scan");
+        }
         return;
     }
-    auto [dir_scanner, worker_thread] = new_dir_scanner();
-    dir_scanner->add_scan_properties(input_string);
+    // a regular expression has its own alternation, so it takes precedence over multiple patterns
+    bool regex = get_parameters()[parameters::Regex];
+    if (regex) {
+        QRegularExpression expression(input_string);
+        if (!expression.isValid()) {
+            if (!typed) {
+                notification(("Invalid regular expression: " + expression.errorString()).toUtf8().constData());
+            }
+            return;
+        }
+    }
 
-    if (!get_parameters()[parameters::Preprocess] || input_string.size() < 3) {
-        std::list<QString> directories;
-        for (int i = 0; i < ui->directoriesTable->rowCount(); ++i) {
-            QString directory_name = get_directory_name(i);
-            directories.push_back(directory_name);
+    std::vector<QString> split;
+    if (!regex && get_parameters()[parameters::MultiPattern]) {
+        split = SearchEngine::split_patterns(input_string);
+        if (split.empty()) {
+            if (!typed) {
+                notification("Please write a string to search for");
+            }
+            return;
         }
-        dir_scanner->add_directories(std::move(directories));
     }
 
+    auto [dir_scanner, worker_thread] = new_dir_scanner();
+    typed_scan = typed;
+    scan_thread = worker_thread;
+    if (typed) {
+        dir_scanner->set_cache(query_cache);
+    }
+    multiple_patterns = !regex && get_parameters()[parameters::MultiPattern];
+    if (regex) {
+        dir_scanner->add_regex(input_string);
+    } else if (multiple_patterns) {
+        dir_scanner->add_scan_properties(split);
+    } else {
+        dir_scanner->add_scan_properties(input_string);
+    }
+    matches->reset(dir_scanner->get_patterns(), multiple_patterns, get_parameters()[parameters::FirstMatch]);
+
+    // indexed directories are answered by the index, the rest are traversed
+    std::list<QString> directories;
+    for (int i = 0; i < ui->directoriesTable->rowCount(); ++i) {
+        QString directory_name = get_directory_name(i);
+        directories.push_back(directory_name);
+    }
+    dir_scanner->add_directories(std::move(directories));
+
     connect(worker_thread, &QThread::started, dir_scanner, &DirectoryScanner::scan_directories);
     connect(dir_scanner, &DirectoryScanner::finished, this, &MainWindow::result_ready);
     worker_thread->start();
@@ -324,7 +742,14 @@ void MainWindow::directories_scan() {
 
 void MainWindow::result_ready() {
     ui->scanButton->setDisabled(false);
-    int count = ui->stringsList->invisibleRootItem()->childCount();
+    size_t count = matches->file_count();
+    if (search_again) {
+        return;
+    }
+    if (typed_scan) {
+        ui->statusBar->showMessage(QString("%1 matching file(s)").arg(QString::number(count)));
+        return;
+    }
     if (count == 0) {
         notification("No matches found");
     } else {
@@ -332,19 +757,11 @@ void MainWindow::result_ready() {
     }
 }
 
-void MainWindow::catch_match(QString const& file_name, std::list<int> const& coordinates, bool first_match) {
-    QTreeWidgetItem* parent = new QTreeWidgetItem(ui->stringsList);
-    parent->setText(0, file_name + ": " + QString::number(coordinates.size()));
-    ui->stringsList->insertTopLevelItem(0, parent);
-    if (!first_match) {
-        for (auto i: coordinates) {
-            QTreeWidgetItem* item = new QTreeWidgetItem(parent);
-            item->setText(0, QString::number(i));
-        }
-    }
+void MainWindow::catch_matches(std::shared_ptr<MatchBatch> const& batch) {
+    matches->append(*batch);
 }
 
-void MainWindow::catch_error(QString const& file_name) {
+void MainWindow::add_detail(QListWidgetItem* item) {
     if (ui->detailsList->count() == 0) {
         QPushButton* button = new QPushButton("show details");
         ui->mainGrid->addWidget(button);
@@ -352,9 +769,23 @@ void MainWindow::catch_error(QString const& file_name) {
         connect(this, &MainWindow::clear_details, button, &QPushButton::deleteLater);
         connect(this, &MainWindow::clear_details, ui->statusBar, &QStatusBar::clearMessage);
     }
-    ui->detailsList->addItem(new QListWidgetItem(file_name));
+    ui->detailsList->addItem(item);
+}
+
+void MainWindow::catch_error(QString const& file_name) {
+    add_detail(new QListWidgetItem(file_name));
+    int troubled = ui->detailsList->count() - (binary_item != nullptr);
     ui->statusBar->showMessage(QString("Troubled reading: ") +
-                                QString(QString::number(ui->detailsList->count())) + " file(s) troubled reading");
+                                QString(QString::number(troubled)) + " file(s) troubled reading");
+}
+
+// binary files are only counted, a build tree can have thousands of them
+void MainWindow::catch_binary(QString const&) {
+    if (binary_item == nullptr) {
+        binary_item = new QListWidgetItem();
+        add_detail(binary_item);
+    }
+    binary_item->setText("Binary files skipped: " + QString::number(++binary_files));
 }
 
 void MainWindow::set_progress(QString const& directory, double progress) {
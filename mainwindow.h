@@ -3,10 +3,18 @@
 
 #include "utils/parameters.h"
 #include "utils/directoryscanner.h"
+#include "utils/indexwatcher.h"
+#include "utils/matchmodel.h"
+#include "utils/searchstats.h"
+#include "utils/querycache.h"
+#include "utils/pathfilter.h"
 
 #include <QMainWindow>
-#include <QTreeWidget>
+#include <QTreeView>
 #include <QProgressBar>
+#include <QListWidget>
+#include <QPointer>
+#include <QTimer>
 #include <memory>
 #include <set>
 #include <list>
@@ -27,6 +35,7 @@ public:
 private slots:
     void select_directory();
     void remove_directories_from_list();
+    void load_patterns();
     void normalize_directories(bool checkbox_state);
 
     void details_manager();
@@ -34,30 +43,75 @@ private slots:
 
     void finished_process();
     void preparations();
-    void prepared(std::map<QString, std::map<QString,
-                  std::set<int64_t>>>* result);
+    void prepared(TrigramIndex* result);
     void directories_scan();
+    void instant_search();
     void result_ready();
 
-    void catch_match(QString const& file_name, std::list<int> const& coordinates, bool first_match);
+    void files_changed(std::map<QString, std::set<QString>> const& paths);
+    void live_updated(TrigramIndex* result);
+    void live_finished();
+    void restart_watcher();
+
+    void catch_matches(std::shared_ptr<MatchBatch> const& batch);
     void catch_error(QString const& file_name);
+    void catch_binary(QString const& file_name);
     void set_progress(QString const& directory, double progress);
 
 signals:
     void clear_details();
+    // threads reading the index stop before the window frees it
+    void closing();
 
 private:
     void action();
+    void add_detail(QListWidgetItem* item);
     QString get_directory_name(int row);
     void add_directory(QString const& dir);
     void remove_directory(int row);
+    void load_index();
+    void save_index();
+    void update_live();
+    void apply_live(TrigramIndex* result);
 
     std::map<parameters, bool> get_parameters();
+    std::shared_ptr<PathFilter const> get_filter();
     std::pair<DirectoryScanner*, QThread*> new_dir_scanner();
+    void start_scan(bool typed);
 
     void notification(const char* content, const char* window_title, int time);
-    std::map<QString, std::map<QString, std::set<int64_t>>>* preprocessing = nullptr;
+    TrigramIndex* preprocessing = nullptr;
+    // the thread of a build that started from the index
+    QPointer<QThread> index_thread;
+    bool index_changed = false;
+    bool multiple_patterns = false;
+    MatchModel* matches = nullptr;
+    std::shared_ptr<SearchStats> stats;
+    size_t binary_files = 0;
+    QListWidgetItem* binary_item = nullptr;
     std::set<QString> directories_to_preprocess;
+    // what the index was built with, live updates keep to it
+    std::shared_ptr<PathFilter const> index_filter;
+
+    // live index: changes reported by the watcher are applied in the
+    // background, one update at a time and never while a scan reads the index
+    IndexWatcher* watcher = nullptr;
+    QThread* watcher_thread = nullptr;
+    std::map<QString, std::set<QString>> live_changes;
+    bool busy = false;
+    bool live_running = false;
+    QPointer<QThread> live_thread;
+    TrigramIndex* live_result = nullptr;
+    std::set<QString> removed_during_update;
+
+    // as you type: a search starts once typing pauses and supersedes the one
+    // still running, which is interrupted first; recent searches are cached
+    // until the files or the index may have changed
+    QTimer* typing = nullptr;
+    QPointer<QThread> scan_thread;
+    bool typed_scan = false;
+    bool search_again = false;
+    std::shared_ptr<QueryCache> query_cache = std::make_shared<QueryCache>();
 
     Ui::MainWindow* ui;
 };
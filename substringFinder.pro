@@ -23,20 +23,14 @@ QMAKE_CXXFLAGS += -std=c++17
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(utils/engine.pri)
+
 SOURCES += \
         main.cpp \
-        mainwindow.cpp \
-    utils/directoryscanner.cpp \
-    utils/qcharhash.cpp \
-    utils/trigrammanager.cpp \
-    utils/trigramworker.cpp
+        mainwindow.cpp
 
 HEADERS += \
-        mainwindow.h \
-        utils/parameters.h \
-    utils/directoryscanner.h \
-    utils/trigrammanager.h \
-    utils/trigramworker.h
+        mainwindow.h
 
 FORMS += \
         mainwindow.ui
@@ -0,0 +1,216 @@
+#include "check.h"
+#include "../utils/searchengine.h"
+#include "../utils/trigramindex.h"
+
+#include <QCoreApplication>
+#include <QTemporaryDir>
+#include <QTextCodec>
+#include <QFile>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <cstdint>
+
+
+/*
+ * A file large enough to be indexed in blocks, with a needle planted across
+ * several block boundaries. Searching it through the index, which only scans
+ * the ranges of candidate blocks, has to find what a full scan finds, at the
+ * same positions, lines and columns.
+ *
+ * A regular expression is matched against a large file a window at a time,
+ * anchors and lookbehinds have to work as they would on the whole file.
+ */
+namespace {
+    const uint64_t BLOCK = DirectoryIndex::BLOCK_SIZE;
+    const QByteArray NEEDLE = "xyzzy-42-plugh";
+
+    struct Random {
+        uint64_t state;
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+    };
+
+    // lines of words over a few letters, two- and four-byte characters among them, none of the needle's letters
+    QByteArray text(uint64_t size) {
+        Random random{7};
+        QByteArray result;
+        result.reserve(size + 256);
+        while (uint64_t(result.size()) < size) {
+            for (uint64_t words = 5 + random.next() % 10; words > 0; --words) {
+                for (uint64_t letters = 2 + random.next() % 6; letters > 0; --letters) {
+                    uint64_t kind = random.next() % 40;
+                    result += kind == 0 ? QByteArray("\xc3\xa9") : kind == 1 ? QByteArray("\xf0\x9f\x98\x80") :
+                                          QByteArray(1, char('a' + random.next() % 8));
+                }
+                result += ' ';
+            }
+            result += '\n';
+        }
+        return result;
+    }
+
+    // the needle over the bytes at offset, or a little after so no character is cut in two
+    void plant(QByteArray& content, int offset) {
+        while ((uint8_t(content[offset]) & 0xc0) == 0x80) {
+            ++offset;
+        }
+        content.replace(offset, NEEDLE.size(), NEEDLE);
+        for (int i = offset + NEEDLE.size(); i < content.size() && (uint8_t(content[i]) & 0xc0) == 0x80; ++i) {
+            content[i] = 'a';
+        }
+    }
+
+    using Found = std::tuple<QString, int, int, int, QString>;
+
+    std::vector<Found> search(SearchEngine& engine, QString const& directory) {
+        std::vector<Found> result;
+        SearchEngine::Callbacks callbacks;
+        callbacks.matches = [&result](MatchBatch const& batch) {
+            for (size_t i = 0; i < batch.size(); ++i) {
+                for (uint64_t j = batch.offsets[i]; j < batch.offsets[i + 1]; ++j) {
+                    result.emplace_back(batch.files[i], batch.coordinates[j], batch.lines[j].line,
+                                        batch.lines[j].column, batch.lines[j].snippet);
+                }
+            }
+        };
+        engine.search({QString::fromUtf8(NEEDLE)}, {directory}, callbacks);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::map<parameters, bool> parameters_with(bool preprocess, bool byte_index, bool regex = false) {
+        return {{parameters::Hidden, false}, {parameters::Recursive, true}, {parameters::FirstMatch, false},
+                {parameters::ShowLine, true}, {parameters::Preprocess, preprocess}, {parameters::Watch, false},
+                {parameters::Ordered, false}, {parameters::MultiPattern, false}, {parameters::Regex, regex},
+                {parameters::IgnoreCase, false}, {parameters::ByteIndex, byte_index}};
+    }
+
+    void test_blocks(QString const& directory, QByteArray const& content, std::vector<int> const& planted,
+                     bool byte_index) {
+        char const* kind = byte_index ? "byte trigrams" : "char trigrams";
+        SearchEngine indexed(parameters_with(true, byte_index));
+        indexed.build_index({directory});
+        if (!CHECK_FOR(indexed.index() != nullptr && indexed.index()->directories.count(directory) == 1, kind)) {
+            return;
+        }
+        DirectoryIndex const& index = indexed.index()->directories.at(directory);
+        if (!CHECK_FOR(index.file_count() == 1 && index.is_blocked(0), kind)) {
+            return;
+        }
+
+        // every planted needle lies whole in a range, and the ranges leave most of the file out
+        trigram_kind trigrams = byte_index ? ByteTrigrams : CharTrigrams;
+        auto ranges = index.ranges(0, string_trigrams(QString::fromUtf8(NEEDLE), trigrams), NEEDLE.size());
+        for (int offset: planted) {
+            CHECK_FOR(std::any_of(ranges.begin(), ranges.end(), [&](DirectoryIndex::BlockRange const& i) {
+                return i.begin <= uint64_t(offset) && uint64_t(offset) + NEEDLE.size() <= i.end;
+            }), kind);
+        }
+        uint64_t covered = 0;
+        for (auto const& i: ranges) {
+            covered += i.end - i.begin;
+        }
+        CHECK_FOR(covered < uint64_t(content.size()) / 2, kind);
+
+        SearchEngine scanned(parameters_with(false, byte_index));
+        std::vector<Found> expected = search(scanned, directory);
+        std::vector<Found> found = search(indexed, directory);
+        CHECK_FOR(expected.size() == planted.size(), kind);
+        CHECK_FOR(found == expected, kind);
+    }
+
+    // positions of the matches of pattern in the files below directory
+    std::vector<int> regex_matches(QString const& pattern, QString const& directory) {
+        std::vector<int> result;
+        SearchEngine::Callbacks callbacks;
+        callbacks.matches = [&result](MatchBatch const& batch) {
+            result.insert(result.end(), batch.coordinates.begin(), batch.coordinates.end());
+        };
+        SearchEngine engine(parameters_with(false, false, true));
+        engine.search_regex(pattern, {directory}, callbacks);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // lines of the same length, over three windows of 64 MiB
+    void test_regex_windows(QString const& directory) {
+        const int LINES = 600000;
+        const QByteArray LINE = "foo " + QByteArray(250, 'x') + " end\n";
+        const QByteArray LAST = "last end\n";
+        QFile file(directory + "/lines.txt");
+        if (!CHECK(file.open(QFile::WriteOnly))) {
+            return;
+        }
+        QByteArray chunk;
+        for (int i = 0; i < 1000; ++i) {
+            chunk += LINE;
+        }
+        bool written = true;
+        for (int i = 0; i < LINES / 1000; ++i) {
+            written = written && file.write(chunk) == chunk.size();
+        }
+        written = written && file.write(LAST) == LAST.size();
+        file.close();
+        if (!CHECK(written)) {
+            return;
+        }
+        int size = LINES * LINE.size() + LAST.size();
+
+        std::vector<int> lines;
+        for (int i = 0; i < LINES; ++i) {
+            lines.push_back(i * LINE.size());
+        }
+        std::vector<int> following(lines.begin() + 1, lines.end());
+        CHECK((regex_matches("^foo", directory) == std::vector<int>{0}));
+        CHECK((regex_matches("\\Afoo", directory) == std::vector<int>{0}));
+        CHECK(regex_matches("(?m)^foo", directory) == lines);
+        CHECK(regex_matches("(?<=\\n)foo", directory) == following);
+        CHECK((regex_matches("end$", directory) == std::vector<int>{size - 4}));
+        CHECK((regex_matches("end\\Z", directory) == std::vector<int>{size - 4}));
+        CHECK(regex_matches("end\\z", directory).empty());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    // ranges are only scanned by the byte search, which needs UTF-8 text
+    QTextCodec::setCodecForLocale(QTextCodec::codecForName("UTF-8"));
+
+    QTemporaryDir temporary;
+    if (!CHECK(temporary.isValid())) {
+        return check::result();
+    }
+    QString directory = temporary.path();
+    QByteArray content = text(17 * BLOCK + 12345);
+    // across boundaries by a few bytes either way, at a block start, in the first block and at the end
+    for (int offset: {100, int(BLOCK) - 4, int(2 * BLOCK) - 1, int(5 * BLOCK) - NEEDLE.size() + 1,
+                      int(8 * BLOCK), int(11 * BLOCK) - NEEDLE.size() / 2, content.size() - NEEDLE.size() - 2}) {
+        plant(content, offset);
+    }
+    std::vector<int> planted;
+    for (int i = content.indexOf(NEEDLE); i >= 0; i = content.indexOf(NEEDLE, i + 1)) {
+        planted.push_back(i);
+    }
+    QFile file(directory + "/large.txt");
+    if (!CHECK(file.open(QFile::WriteOnly) && file.write(content) == content.size())) {
+        return check::result();
+    }
+    file.close();
+
+    test_blocks(directory, content, planted, false);
+    test_blocks(directory, content, planted, true);
+
+    QTemporaryDir windows;
+    if (CHECK(windows.isValid())) {
+        test_regex_windows(windows.path());
+    }
+    return check::result();
+}
@@ -0,0 +1,39 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+
+/*
+ * Just enough of a test framework for the engine tests: a failed CHECK
+ * prints where it was and the test goes on, main returns check::result()
+ * so ctest sees the failure.
+ */
+namespace check {
+    inline int& failures() {
+        static int count = 0;
+        return count;
+    }
+
+    inline bool report(bool passed, char const* condition, char const* file, int line, char const* context) {
+        if (!passed) {
+            ++failures();
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed%s%s\n", file, line, condition,
+                         context[0] != '\0' ? " for " : "", context);
+        }
+        return passed;
+    }
+
+    inline int result() {
+        if (failures() > 0) {
+            std::fprintf(stderr, "%d checks failed\n", failures());
+        }
+        return failures() == 0 ? 0 : 1;
+    }
+}
+
+#define CHECK(condition) check::report((condition), #condition, __FILE__, __LINE__, "")
+// context names the case being checked, for checks run in a loop
+#define CHECK_FOR(condition, context) check::report((condition), #condition, __FILE__, __LINE__, (context))
+
+#endif // CHECK_H
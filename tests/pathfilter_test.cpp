@@ -0,0 +1,222 @@
+#include "check.h"
+#include "../utils/pathfilter.h"
+
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
+
+#include <cstring>
+
+
+/*
+ * Globs and rules in the syntax of .gitignore, as git reads them: the
+ * corners of the glob syntax, rule lines with their escapes, negation and
+ * directory-only marks, the options, and ignore files in nested directories
+ * whose anchored rules are relative to where the file is.
+ */
+namespace {
+    bool globbed(char const* pattern, char const* path) {
+        return Glob(pattern).matches(path, path + std::strlen(path));
+    }
+
+    bool accepted(PathFilter const& filter, char const* relative, bool directory = false, int64_t size = 0) {
+        return filter.accepts(nullptr, relative, relative + std::strlen(relative), directory, size);
+    }
+
+    PathFilter excluding(QStringList const& exclude) {
+        PathFilter::Options options;
+        options.exclude = exclude;
+        return PathFilter(options);
+    }
+
+    void test_any_directories() {
+        CHECK(globbed("**/foo", "foo"));
+        CHECK(globbed("**/foo", "a/foo"));
+        CHECK(globbed("**/foo", "a/b/c/foo"));
+        CHECK(!globbed("**/foo", "a/xfoo"));
+        CHECK(!globbed("**/foo", "a/foo/b"));
+
+        CHECK(globbed("build/**", "build/x"));
+        CHECK(globbed("build/**", "build/x/y/z"));
+        CHECK(!globbed("build/**", "build"));
+        CHECK(!globbed("build/**", "a/build/x"));
+
+        CHECK(globbed("a/**/b", "a/b"));
+        CHECK(globbed("a/**/b", "a/x/y/b"));
+        CHECK(!globbed("a/**/b", "ab"));
+        CHECK(!globbed("a/**/b", "a/xb"));
+
+        CHECK(globbed("*.c", "x.c"));
+        CHECK(!globbed("*.c", "a/x.c"));
+        CHECK(globbed("src/*.c", "src/x.c"));
+        CHECK(!globbed("src/*.c", "src/a/x.c"));
+    }
+
+    void test_sets() {
+        CHECK(globbed("[a-c]x", "bx"));
+        CHECK(!globbed("[a-c]x", "dx"));
+        CHECK(globbed("[!a-z]x", "Ax"));
+        CHECK(globbed("[!a-z]x", "1x"));
+        CHECK(!globbed("[!a-z]x", "qx"));
+        CHECK(globbed("[^a-z]x", "Ax"));
+        // never the separator, even negated
+        CHECK(!globbed("[!a-z]x", "/x"));
+
+        // a leading ']' is a member, not the end of the set
+        CHECK(globbed("[]a]", "]"));
+        CHECK(globbed("[]a]", "a"));
+        CHECK(!globbed("[]a]", "b"));
+        CHECK(globbed("[!]]", "a"));
+        CHECK(!globbed("[!]]", "]"));
+        CHECK(globbed("[a-]", "-"));
+
+        // without its closing bracket, '[' is itself
+        CHECK(globbed("[ab", "[ab"));
+        CHECK(!globbed("[ab", "a"));
+    }
+
+    void test_escapes() {
+        CHECK(globbed("\\*x", "*x"));
+        CHECK(!globbed("\\*x", "ax"));
+        CHECK(globbed("\\[a]", "[a]"));
+        CHECK(globbed("a\\?", "a?"));
+        CHECK(!globbed("a\\?", "ab"));
+
+        // trailing spaces are dropped from a rule unless escaped
+        PathFilter trimmed = excluding({"name  "});
+        CHECK(!accepted(trimmed, "name"));
+        CHECK(accepted(trimmed, "name "));
+        PathFilter escaped = excluding({"name\\ "});
+        CHECK(!accepted(escaped, "name "));
+        CHECK(accepted(escaped, "name"));
+        CHECK(accepted(escaped, "name  "));
+
+        PathFilter hash = excluding({"#comment", "\\#literal"});
+        CHECK(accepted(hash, "#comment"));
+        CHECK(!accepted(hash, "#literal"));
+    }
+
+    void test_rules() {
+        // the last matching rule decides, a '!' keeps what an earlier one leaves out
+        PathFilter negated = excluding({"*.log", "!keep.log"});
+        CHECK(!accepted(negated, "a.log"));
+        CHECK(accepted(negated, "keep.log"));
+        CHECK(accepted(negated, "dir/keep.log"));
+        PathFilter renegated = excluding({"!keep.log", "*.log"});
+        CHECK(!accepted(renegated, "keep.log"));
+
+        PathFilter directories = excluding({"build/"});
+        CHECK(!accepted(directories, "build", true));
+        CHECK(!accepted(directories, "a/build", true));
+        CHECK(accepted(directories, "build"));
+        CHECK(accepted(directories, "a/build"));
+
+        // a '/' anywhere but at the end anchors a rule to the root
+        PathFilter anchored = excluding({"/top.txt", "docs/*.md", "name"});
+        CHECK(!accepted(anchored, "top.txt"));
+        CHECK(accepted(anchored, "a/top.txt"));
+        CHECK(!accepted(anchored, "docs/a.md"));
+        CHECK(accepted(anchored, "x/docs/a.md"));
+        CHECK(!accepted(anchored, "name"));
+        CHECK(!accepted(anchored, "a/b/name"));
+    }
+
+    void test_options() {
+        PathFilter::Options options;
+        options.include = QStringList{"*.cpp", "src/*.h"};
+        options.exclude = QStringList{"*_test.cpp"};
+        options.maximum_size = 100;
+        PathFilter filter(options);
+
+        CHECK(accepted(filter, "a.cpp", false, 50));
+        CHECK(accepted(filter, "a.cpp", false, 100));
+        CHECK(!accepted(filter, "a.cpp", false, 101));
+        CHECK(accepted(filter, "src/a.h", false, 10));
+        CHECK(!accepted(filter, "src/a.h", false, 1000));
+        CHECK(!accepted(filter, "lib/a.h", false, 10));
+        CHECK(!accepted(filter, "a.txt", false, 10));
+        CHECK(!accepted(filter, "a_test.cpp", false, 10));
+        // directories are walked whatever their size and name, what is in them is filtered
+        CHECK(accepted(filter, "lib", true, 4096));
+        CHECK(accepted(filter, "big", true, 1000000));
+
+        PathFilter unlimited{PathFilter::Options()};
+        CHECK(accepted(unlimited, "huge.bin", false, int64_t(1) << 40));
+        CHECK(accepted(unlimited, ".git", true));
+    }
+
+    bool write(QString const& path, QByteArray const& content) {
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly) && file.write(content) == content.size();
+    }
+
+    // rules of an ignore file below the root are relative to its directory
+    void test_nested() {
+        QTemporaryDir temporary;
+        if (!CHECK(temporary.isValid())) {
+            return;
+        }
+        QString root = temporary.path();
+        if (!CHECK(QDir(root).mkpath("sub/deeper") &&
+                   write(root + "/.gitignore", "*.tmp\nbuild/\n/top.txt\n") &&
+                   write(root + "/sub/.gitignore", "/gen\na/b.txt\n!keep.tmp\n") &&
+                   write(root + "/sub/deeper/.ignore", "*.txt\n"))) {
+            return;
+        }
+
+        PathFilter::Options options;
+        options.ignore_files = true;
+        PathFilter filter(options);
+        QByteArray base = QFile::encodeName(root);
+        auto reached = [&](char const* path, bool directory = false) {
+            return filter.reaches(base, base + '/' + path, directory, 0);
+        };
+
+        CHECK(!reached("x.tmp"));
+        CHECK(!reached("a/x.tmp"));
+        CHECK(!reached("build", true));
+        CHECK(!reached("build/x.c"));
+        CHECK(!reached("top.txt"));
+        CHECK(reached("sub/top.txt"));
+        CHECK(!reached(".git", true));
+        CHECK(!reached(".git/config"));
+
+        // "/gen" in sub/.gitignore is sub/gen, not gen or sub/x/gen
+        CHECK(!reached("sub/gen", true));
+        CHECK(!reached("sub/gen/x.c"));
+        CHECK(reached("gen", true));
+        CHECK(reached("sub/x/gen", true));
+        CHECK(!reached("sub/a/b.txt"));
+        CHECK(reached("a/b.txt"));
+        CHECK(reached("sub/x/a/b.txt"));
+
+        // deeper files take precedence
+        CHECK(reached("sub/keep.tmp"));
+        CHECK(reached("sub/x/keep.tmp"));
+        CHECK(!reached("keep.tmp"));
+        CHECK(!reached("sub/other.tmp"));
+        CHECK(!reached("sub/deeper/top.txt"));
+        CHECK(reached("sub/notes.txt"));
+
+        // the scope handed back applies the same rules to entries of the directory
+        std::shared_ptr<PathFilter::Scope const> scope;
+        QByteArray sub = base + "/sub";
+        if (CHECK(filter.reaches(base, sub, true, 0, &scope))) {
+            scope = filter.enter(scope, sub, 3);
+            char const* gen = "sub/gen";
+            CHECK(!filter.accepts(scope.get(), gen, gen + std::strlen(gen), true, 0));
+            char const* keep = "sub/keep.tmp";
+            CHECK(filter.accepts(scope.get(), keep, keep + std::strlen(keep), false, 0));
+        }
+    }
+}
+
+int main() {
+    test_any_directories();
+    test_sets();
+    test_escapes();
+    test_rules();
+    test_options();
+    test_nested();
+    return check::result();
+}
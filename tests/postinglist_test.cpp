@@ -0,0 +1,251 @@
+#include "check.h"
+#include "../utils/postinglist.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace {
+    // splitmix64, so the lists are the same everywhere
+    struct Random {
+        uint64_t state;
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+    };
+
+    std::vector<uint8_t> encoded(std::vector<uint32_t> const& ids) {
+        std::vector<uint8_t> result;
+        posting_list::encode(ids.data(), ids.data() + ids.size(), result);
+        return result;
+    }
+
+    std::vector<uint32_t> round_trip(std::vector<uint32_t> const& ids) {
+        std::vector<uint8_t> bytes = encoded(ids);
+        return posting_list::decode(bytes.data(), bytes.data() + bytes.size());
+    }
+
+    // the type byte of every container, in order
+    std::vector<uint8_t> container_types(std::vector<uint8_t> const& bytes) {
+        auto varint = [&](size_t& i) {
+            uint32_t value = 0;
+            for (int shift = 0; ; shift += 7) {
+                uint8_t byte = bytes[i++];
+                value |= uint32_t(byte & 0x7f) << shift;
+                if (byte < 0x80) {
+                    return value;
+                }
+            }
+        };
+        std::vector<uint8_t> result;
+        size_t i = 0;
+        varint(i);
+        while (i < bytes.size()) {
+            result.push_back(bytes[i++]);
+            varint(i);
+            varint(i);
+            i += varint(i);
+        }
+        return result;
+    }
+
+    // every step of `step` ids in [from, to)
+    std::vector<uint32_t> range(uint64_t from, uint64_t to, uint32_t step = 1) {
+        std::vector<uint32_t> result;
+        for (uint64_t i = from; i < to; i += step) {
+            result.push_back(uint32_t(i));
+        }
+        return result;
+    }
+
+    // about `density` of the ids below `limit`
+    std::vector<uint32_t> random_list(Random& random, uint32_t limit, double density) {
+        std::vector<uint32_t> result;
+        uint64_t threshold = uint64_t(density * double(UINT32_MAX));
+        for (uint32_t i = 0; i < limit; ++i) {
+            if ((random.next() & UINT32_MAX) < threshold) {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
+
+    void test_edges() {
+        CHECK(round_trip({}).empty());
+        std::vector<uint8_t> empty = encoded({});
+        PostingCursor cursor(empty.data(), empty.data() + empty.size());
+        CHECK(!cursor.valid());
+        CHECK(cursor.size() == 0);
+
+        for (uint32_t id: {0u, 1u, 65535u, 65536u, 65537u, 131071u, 0xfffeffffu, 0xffff0000u, UINT32_MAX}) {
+            std::string name = "single id " + std::to_string(id);
+            CHECK_FOR(round_trip({id}) == std::vector<uint32_t>{id}, name.c_str());
+            std::vector<uint8_t> bytes = encoded({id});
+            PostingCursor single(bytes.data(), bytes.data() + bytes.size());
+            CHECK_FOR(single.valid() && single.value() == id && single.size() == 1, name.c_str());
+            single.next();
+            CHECK_FOR(!single.valid(), name.c_str());
+        }
+    }
+
+    // an array takes a byte per id when ids are consecutive, so the bitmap wins past 8192 of them
+    void test_containers() {
+        for (uint32_t count: {1u, 8191u, 8192u, 8193u, 30000u, 65536u}) {
+            std::string name = std::to_string(count) + " consecutive ids";
+            std::vector<uint32_t> ids = range(0, count);
+            std::vector<uint8_t> bytes = encoded(ids);
+            CHECK_FOR(container_types(bytes) == std::vector<uint8_t>{
+                          uint8_t(count > 8192 ? posting_list::Bitmap : posting_list::Array)}, name.c_str());
+            CHECK_FOR(posting_list::decode(bytes.data(), bytes.data() + bytes.size()) == ids, name.c_str());
+        }
+
+        // sparse, dense, sparse, with the dense chunk ending on the last id of its 2^16
+        std::vector<uint32_t> mixed = range(0, 65536, 1000);
+        std::vector<uint32_t> dense = range(65536, 131072, 2);
+        dense.push_back(131071);
+        mixed.insert(mixed.end(), dense.begin(), dense.end());
+        std::vector<uint32_t> sparse = range(131072, 300000, 777);
+        mixed.insert(mixed.end(), sparse.begin(), sparse.end());
+        std::vector<uint8_t> bytes = encoded(mixed);
+        CHECK((container_types(bytes) == std::vector<uint8_t>{posting_list::Array, posting_list::Bitmap,
+                                                              posting_list::Array, posting_list::Array,
+                                                              posting_list::Array}));
+        CHECK(posting_list::decode(bytes.data(), bytes.data() + bytes.size()) == mixed);
+    }
+
+    void test_chunk_boundaries() {
+        std::vector<std::vector<uint32_t>> lists = {
+            {65535, 65536},
+            {0, 65535, 65536, 131071, 131072},
+            {65536 * 5 - 1, 65536 * 5, 65536 * 9},
+            {0, UINT32_MAX},
+            {0xfffe0000u, 0xfffeffffu, 0xffff0000u, 0xffff0001u, UINT32_MAX},
+            range(65536 - 10000, 65536 + 10000),
+            range(0xffff0000u - 20000, uint64_t(UINT32_MAX) + 1, 3),
+        };
+        for (size_t i = 0; i < lists.size(); ++i) {
+            std::string name = "list " + std::to_string(i);
+            CHECK_FOR(round_trip(lists[i]) == lists[i], name.c_str());
+        }
+    }
+
+    // a cursor seeks to the first id at or after the target, like lower_bound
+    void test_seek() {
+        Random random{1};
+        for (double density: {0.001, 0.05, 0.5, 0.95}) {
+            std::vector<uint32_t> ids = random_list(random, 300000, density);
+            std::vector<uint8_t> bytes = encoded(ids);
+            PostingCursor cursor(bytes.data(), bytes.data() + bytes.size());
+            CHECK(cursor.size() == ids.size());
+            uint32_t target = 0;
+            while (true) {
+                target += uint32_t(random.next() % 5000);
+                cursor.seek(target);
+                auto expected = std::lower_bound(ids.begin(), ids.end(), target);
+                std::string name = "density " + std::to_string(density) + ", target " + std::to_string(target);
+                if (expected == ids.end()) {
+                    CHECK_FOR(!cursor.valid(), name.c_str());
+                    break;
+                }
+                if (!CHECK_FOR(cursor.valid() && cursor.value() == *expected, name.c_str())) {
+                    break;
+                }
+            }
+        }
+    }
+
+    void test_intersect() {
+        Random random{2};
+        std::vector<double> densities = {0.0005, 0.01, 0.2, 0.6, 0.97};
+        for (int round = 0; round < 40; ++round) {
+            size_t count = 1 + round % 4;
+            uint32_t limit = uint32_t(1 + random.next() % 400000);
+            std::vector<std::vector<uint32_t>> ids;
+            std::vector<std::vector<uint8_t>> bytes;
+            for (size_t i = 0; i < count; ++i) {
+                ids.push_back(random_list(random, limit, densities[random.next() % densities.size()]));
+                bytes.push_back(encoded(ids.back()));
+            }
+            std::vector<uint32_t> expected = ids[0];
+            for (size_t i = 1; i < count; ++i) {
+                std::vector<uint32_t> next;
+                std::set_intersection(expected.begin(), expected.end(), ids[i].begin(), ids[i].end(),
+                                      std::back_inserter(next));
+                expected.swap(next);
+            }
+            std::vector<std::pair<uint8_t const*, uint8_t const*>> lists;
+            for (auto const& i: bytes) {
+                lists.emplace_back(i.data(), i.data() + i.size());
+            }
+            std::string name = "round " + std::to_string(round);
+            CHECK_FOR(posting_list::intersect(lists) == expected, name.c_str());
+        }
+
+        std::vector<uint8_t> empty = encoded({});
+        std::vector<uint8_t> full = encoded(range(0, 70000));
+        CHECK(posting_list::intersect({}).empty());
+        CHECK(posting_list::intersect({{full.data(), full.data() + full.size()},
+                                       {empty.data(), empty.data() + empty.size()}}).empty());
+    }
+
+    bool well_formed(std::vector<uint8_t> const& bytes, uint64_t limit) {
+        return posting_list::well_formed(bytes.data(), bytes.data() + bytes.size(), limit);
+    }
+
+    // lists from a file are checked before any cursor reads them
+    void test_well_formed() {
+        CHECK(well_formed(encoded({}), 0));
+        std::vector<uint32_t> mixed = range(0, 65536, 1000);
+        std::vector<uint32_t> dense = range(65536, 131072, 3);
+        mixed.insert(mixed.end(), dense.begin(), dense.end());
+        mixed.push_back(0x12345678);
+        std::vector<uint8_t> bytes = encoded(mixed);
+        CHECK(well_formed(bytes, uint64_t(mixed.back()) + 1));
+        CHECK(!well_formed(bytes, mixed.back()));
+        for (size_t size = 0; size < bytes.size(); ++size) {
+            std::string name = "first " + std::to_string(size) + " bytes";
+            CHECK_FOR(!well_formed(std::vector<uint8_t>(bytes.begin(), bytes.begin() + size), UINT32_MAX),
+                      name.c_str());
+        }
+        std::vector<uint8_t> longer = bytes;
+        longer.push_back(0);
+        CHECK(!well_formed(longer, UINT32_MAX));
+
+        // a bitmap read as an array and an array read as a bitmap
+        std::vector<uint8_t> retyped = encoded(range(0, 10000));
+        retyped[2] = posting_list::Array;
+        CHECK(!well_formed(retyped, UINT32_MAX));
+        retyped = encoded({1, 2, 3});
+        retyped[1] = posting_list::Bitmap;
+        CHECK(!well_formed(retyped, UINT32_MAX));
+
+        using posting_list::Array;
+        CHECK(well_formed({2, Array, 0, 1, 1, 3, Array, 1, 1, 1, 5}, 65542));
+        // containers out of order, a repeated id, a count the payload doesn't hold, a payload past the end
+        CHECK(!well_formed({2, Array, 1, 1, 1, 5, Array, 0, 1, 1, 3}, UINT32_MAX));
+        CHECK(!well_formed({2, Array, 0, 2, 2, 5, 0}, UINT32_MAX));
+        CHECK(!well_formed({3, Array, 0, 3, 2, 5, 1}, UINT32_MAX));
+        CHECK(!well_formed({1, Array, 0, 1, 4, 5}, UINT32_MAX));
+        // varints without an end, or too long for 32 bits
+        CHECK(!well_formed({0x80}, UINT32_MAX));
+        CHECK(!well_formed({0xff, 0xff, 0xff, 0xff, 0x1f}, UINT32_MAX));
+        CHECK(!well_formed({1, 7, 0, 1, 1, 0}, UINT32_MAX));
+    }
+}
+
+int main() {
+    test_edges();
+    test_containers();
+    test_chunk_boundaries();
+    test_seek();
+    test_intersect();
+    test_well_formed();
+    return check::result();
+}
@@ -0,0 +1,97 @@
+#include "check.h"
+#include "../utils/regexquery.h"
+#include "../utils/trigramindex.h"
+
+#include <QRegularExpression>
+#include <QString>
+
+#include <algorithm>
+#include <vector>
+
+
+/*
+ * The trigram plan of a regular expression may let through files without a
+ * match, never drop one with a match: for every pattern, every file
+ * QRegularExpression matches has to be among the candidates.
+ */
+namespace {
+    const std::vector<QString> CORPUS = {
+        "hello world\nsecond line",
+        "HELLO WORLD",
+        "color and colour, grey and gray",
+        "abbbbc ac abc",
+        "foo\nbar\nbaz",
+        "the quick brown fox jumps over the lazy dog",
+        "phone 555-1234, fax 555-9876",
+        "Straße STRASSE strasse",
+        "ſtreet is a street with a long s",
+        "Kelvin and kelvin",
+        "café CAFÉ cafe",
+        "x1y2z3 xyz xxyz",
+        "function(arg) { return arg * 2; }",
+        "aaaaaaaaaaaa",
+        "ab\ncd\nef",
+        "",
+        "no match here at all",
+    };
+
+    const std::vector<QString> PATTERNS = {
+        "hello", "world|line", "(hel|wor)l[do]", "colou?r", "gr(a|e)y", "ab*c", "ab+c", "a.c",
+        "qu?ick", "fo*x", "(foo|bar)\\nba", "ba[rz]", "[a-c]{2}", "[^a-z ]{3}", "\\d{3}-\\d{4}",
+        "555-(1234|9876)", "^foo$", "^bar", "dog$", "\\bquick\\b", "(?i)hello", "x+y*z",
+        "(ab|cd)\\n(cd|ef)", "Straße", "strasse", "street", "kelvin", "café", "CAFE",
+        "a{3,}", "(a|b|c)(d|e)?", "return arg", "\\(arg\\)", ".*", "lazy|", "z(x|y)?z",
+        "s[tT]r", "[sS]t[rR]", "fax|phone", "(?:colo)(?:u)?r",
+    };
+
+    DirectoryIndex build(trigram_kind kind) {
+        DirectoryIndex index;
+        for (size_t i = 0; i < CORPUS.size(); ++i) {
+            index.add_file("/corpus/" + QString::number(i), FileStamp(), string_trigrams(CORPUS[i], kind));
+        }
+        index.invert();
+        return index;
+    }
+
+    void test_never_stricter(trigram_kind kind, bool ignore_case) {
+        DirectoryIndex index = build(kind);
+        for (auto const& pattern: PATTERNS) {
+            QRegularExpression regex(pattern, ignore_case ? QRegularExpression::CaseInsensitiveOption :
+                                                            QRegularExpression::NoPatternOption);
+            if (!CHECK_FOR(regex.isValid(), pattern.toUtf8().constData())) {
+                continue;
+            }
+            std::vector<uint32_t> candidates = regex_query::candidates(
+                        regex_query::analyze(pattern, kind, ignore_case), index);
+            for (uint32_t i = 0; i < CORPUS.size(); ++i) {
+                if (!regex.match(CORPUS[i]).hasMatch()) {
+                    continue;
+                }
+                QByteArray name = QString("%1 in file %2, %3%4").arg(pattern).arg(i)
+                        .arg(kind == ByteTrigrams ? "bytes" : "chars").arg(ignore_case ? ", ignoring case" : "")
+                        .toUtf8();
+                CHECK_FOR(std::binary_search(candidates.begin(), candidates.end(), i), name.constData());
+            }
+        }
+    }
+
+    // a literal does narrow the candidates, or the checks above would pass with every file let through
+    void test_narrows() {
+        for (trigram_kind kind: {CharTrigrams, ByteTrigrams}) {
+            DirectoryIndex index = build(kind);
+            std::vector<uint32_t> candidates = regex_query::candidates(regex_query::analyze("quick", kind), index);
+            CHECK(candidates == std::vector<uint32_t>{5});
+            candidates = regex_query::candidates(regex_query::analyze("555-(1234|9876)", kind), index);
+            CHECK(candidates == std::vector<uint32_t>{6});
+        }
+    }
+}
+
+int main() {
+    for (trigram_kind kind: {CharTrigrams, ByteTrigrams}) {
+        test_never_stricter(kind, false);
+        test_never_stricter(kind, true);
+    }
+    test_narrows();
+    return check::result();
+}
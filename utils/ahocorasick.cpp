@@ -0,0 +1,69 @@
+#include "ahocorasick.h"
+
+#include <algorithm>
+#include <map>
+#include <queue>
+
+
+template <typename T>
+AhoCorasick<T>::AhoCorasick(std::vector<std::vector<T>> const& patterns)
+    : states(1),
+      root(size_t(1) << (8 * sizeof(T)), ROOT) {
+
+    std::vector<std::map<T, uint32_t>> children(1);
+    for (uint32_t id = 0; id < patterns.size(); ++id) {
+        uint32_t state = ROOT;
+        for (T c: patterns[id]) {
+            auto child = children[state].find(c);
+            if (child == children[state].end()) {
+                children[state][c] = states.size();
+                state = states.size();
+                states.emplace_back();
+                children.emplace_back();
+            } else {
+                state = child->second;
+            }
+        }
+        states[state].pattern = id;
+    }
+
+    for (uint32_t state = 0; state < states.size(); ++state) {
+        states[state].edges_begin = labels.size();
+        for (auto const& i: children[state]) {
+            labels.push_back(i.first);
+            targets.push_back(i.second);
+        }
+        states[state].edges_end = labels.size();
+    }
+    for (auto const& i: children[ROOT]) {
+        root[i.first] = i.second;
+    }
+
+    // breadth first, so failure links always point to already finished states
+    std::queue<uint32_t> queue;
+    for (auto const& i: children[ROOT]) {
+        queue.push(i.second);
+    }
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop();
+        for (auto const& i: children[state]) {
+            uint32_t child = i.second;
+            uint32_t fail = next(states[state].fail, i.first);
+            states[child].fail = fail;
+            states[child].output = first_output(fail);
+            queue.push(child);
+        }
+    }
+}
+
+template <typename T>
+uint32_t AhoCorasick<T>::edge(uint32_t state, T c) const {
+    auto begin = labels.begin() + states[state].edges_begin;
+    auto end = labels.begin() + states[state].edges_end;
+    auto it = std::lower_bound(begin, end, c);
+    return it != end && *it == c ? targets[it - labels.begin()] : NONE;
+}
+
+template class AhoCorasick<uint8_t>;
+template class AhoCorasick<uint16_t>;
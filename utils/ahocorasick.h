@@ -0,0 +1,80 @@
+#ifndef AHOCORASICK_H
+#define AHOCORASICK_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * Aho-Corasick automaton over bytes (uint8_t) or UTF-16 code units
+ * (uint16_t), finding every occurrence of every pattern in one pass.
+ * Transitions out of the root are a dense table, deeper ones sorted edge
+ * lists searched by binary search, with failure links followed on a miss.
+ *
+ *     uint32_t state = ROOT;
+ *     for (T c: text) {
+ *         state = automaton.next(state, c);
+ *         for (uint32_t s = automaton.first_output(state); s != NONE; s = automaton.next_output(s))
+ *             // automaton.pattern(s) ends at c
+ *     }
+ */
+template <typename T>
+class AhoCorasick {
+public:
+    static constexpr uint32_t ROOT = 0;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // patterns must be non-empty and distinct, ids are their indices
+    explicit AhoCorasick(std::vector<std::vector<T>> const& patterns);
+
+    uint32_t next(uint32_t state, T c) const {
+        for (;;) {
+            if (state == ROOT) {
+                return root[c];
+            }
+            uint32_t result = edge(state, c);
+            if (result != NONE) {
+                return result;
+            }
+            state = states[state].fail;
+        }
+    }
+
+    uint32_t first_output(uint32_t state) const {
+        return states[state].pattern != NONE ? state : states[state].output;
+    }
+
+    uint32_t next_output(uint32_t state) const {
+        return states[state].output;
+    }
+
+    uint32_t pattern(uint32_t state) const {
+        return states[state].pattern;
+    }
+
+    size_t state_count() const {
+        return states.size();
+    }
+
+private:
+    struct State {
+        uint32_t fail = ROOT;
+        uint32_t output = NONE;     // nearest state on the failure chain ending a pattern
+        uint32_t pattern = NONE;
+        uint32_t edges_begin = 0;
+        uint32_t edges_end = 0;
+    };
+
+    uint32_t edge(uint32_t state, T c) const;
+
+    std::vector<State> states;
+    std::vector<uint32_t> root;
+    std::vector<T> labels;
+    std::vector<uint32_t> targets;
+};
+
+extern template class AhoCorasick<uint8_t>;
+extern template class AhoCorasick<uint16_t>;
+
+#endif // AHOCORASICK_H
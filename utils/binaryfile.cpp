@@ -0,0 +1,78 @@
+#include "binaryfile.h"
+
+#include <QTextCodec>
+
+
+namespace {
+    const int UTF8_MIB = 106;
+
+    bool control(uint8_t c) {
+        return (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\b' && c != 0x1b) ||
+               c == 0x7f;
+    }
+
+    // length of the UTF-8 sequence at begin, 0 if it is invalid; a sequence cut off by end counts as valid
+    size_t utf8_sequence(uint8_t const* begin, uint8_t const* end) {
+        size_t length = *begin >= 0xf5 ? 0 : *begin >= 0xf0 ? 4 : *begin >= 0xe0 ? 3 : *begin >= 0xc2 ? 2 : 0;
+        for (size_t i = 1; i < length && begin + i != end; ++i) {
+            if ((begin[i] & 0xc0) != 0x80) {
+                return 0;
+            }
+        }
+        return length;
+    }
+}
+
+/*
+ * A NUL byte makes a block binary, as for git and grep, unless it starts
+ * with a UTF-16 or UTF-32 byte order mark. Otherwise it is binary when more than one
+ * byte in eight is a control character or, for UTF-8 text, not part of a
+ * valid sequence. Legacy 8-bit encodings are only judged by control
+ * characters, their text is rarely valid UTF-8.
+ */
+bool binary_file::looks_binary(uint8_t const* begin, uint8_t const* end, bool utf8) {
+    if (utf8_start(begin, end) == nullptr) {
+        return false;
+    }
+    size_t suspicious = 0;
+    for (uint8_t const* it = begin; it < end; ) {
+        if (*it == 0) {
+            return true;
+        }
+        if (*it < 0x80 || !utf8) {
+            suspicious += control(*it);
+            ++it;
+            continue;
+        }
+        size_t length = utf8_sequence(it, end);
+        suspicious += length == 0;
+        it += length == 0 ? 1 : length;
+    }
+    return suspicious * 8 > size_t(end - begin);
+}
+
+// FF FE also starts the UTF-32LE mark
+uint8_t const* binary_file::utf8_start(uint8_t const* begin, uint8_t const* end) {
+    size_t size = end - begin;
+    if (size >= 2 && ((begin[0] == 0xff && begin[1] == 0xfe) || (begin[0] == 0xfe && begin[1] == 0xff))) {
+        return nullptr;
+    }
+    if (size >= 4 && begin[0] == 0 && begin[1] == 0 && begin[2] == 0xfe && begin[3] == 0xff) {
+        return nullptr;
+    }
+    if (size >= 3 && begin[0] == 0xef && begin[1] == 0xbb && begin[2] == 0xbf) {
+        return begin + 3;
+    }
+    return begin;
+}
+
+bool binary_file::is_binary(QFile& file) {
+    char block[SNIFF_SIZE];
+    qint64 size = file.peek(block, SNIFF_SIZE);
+    if (size <= 0) {
+        return false;
+    }
+    QTextCodec* codec = QTextCodec::codecForLocale();
+    bool utf8 = codec != nullptr && codec->mibEnum() == UTF8_MIB;
+    return looks_binary(reinterpret_cast<uint8_t const*>(block), reinterpret_cast<uint8_t const*>(block) + size, utf8);
+}
@@ -0,0 +1,24 @@
+#ifndef BINARYFILE_H
+#define BINARYFILE_H
+
+#include <QFile>
+
+#include <cstdint>
+
+
+// what searching does with files the classifier considers binary; they are never indexed
+enum binary_policy {SkipBinary, SearchBinaryAsText, SearchBinaryAsBytes};
+
+namespace binary_file {
+    const int SNIFF_SIZE = 8000;
+
+    bool looks_binary(uint8_t const* begin, uint8_t const* end, bool utf8);
+
+    // where UTF-8 text starts past its byte order mark, nullptr after a UTF-16 or UTF-32 one
+    uint8_t const* utf8_start(uint8_t const* begin, uint8_t const* end);
+
+    // peeks at the start of an open file without moving its position
+    bool is_binary(QFile& file);
+}
+
+#endif // BINARYFILE_H
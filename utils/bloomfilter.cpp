@@ -0,0 +1,46 @@
+#include "bloomfilter.h"
+
+
+// the splitmix64 finalizer, trigrams themselves are far from uniform
+uint64_t bloom_filter::hash(int64_t trigram) {
+    uint64_t z = uint64_t(trigram) + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// trigrams must be deduplicated, a repeated one would only inflate the filter
+size_t bloom_filter::build(std::vector<int64_t> const& trigrams, std::vector<uint64_t>& words) {
+    size_t size = 1;
+    while (size * 64 < trigrams.size() * BITS_PER_TRIGRAM) {
+        size *= 2;
+    }
+    if (size > MAXIMUM_WORDS) {
+        return 0;
+    }
+    size_t first = words.size();
+    words.resize(first + size, 0);
+    uint64_t mask = size * 64 - 1;
+    for (auto i: trigrams) {
+        uint64_t h = hash(i);
+        uint64_t step = (h >> 32) | 1;
+        for (int k = 0; k < HASHES; ++k, h += step) {
+            words[first + ((h & mask) >> 6)] |= uint64_t(1) << (h & 63);
+        }
+    }
+    return size;
+}
+
+bool bloom_filter::contains(uint64_t const* words, size_t size, uint64_t hash) {
+    if (size == 0) {
+        return true;
+    }
+    uint64_t mask = size * 64 - 1;
+    uint64_t step = (hash >> 32) | 1;
+    for (int k = 0; k < HASHES; ++k, hash += step) {
+        if ((words[(hash & mask) >> 6] & (uint64_t(1) << (hash & 63))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * Bloom filters summarizing the trigrams of one block of a large file (see
+ * DirectoryIndex). A filter is a power-of-two number of 64-bit words with at
+ * least BITS_PER_TRIGRAM bits per distinct trigram, and every trigram sets
+ * HASHES bits derived from one 64-bit hash of it by double hashing. At 8 bits
+ * and 3 hashes an absent trigram passes with a probability of about 3%, and a
+ * query needs all of its trigrams to pass. An empty filter stands for a block
+ * with too many trigrams to summarize and lets everything through.
+ */
+namespace bloom_filter {
+    const size_t BITS_PER_TRIGRAM = 8;
+    const int HASHES = 3;
+    const size_t MAXIMUM_WORDS = 1 << 15;
+
+    uint64_t hash(int64_t trigram);
+
+    // appends the filter of the trigrams to words and returns its size in words
+    size_t build(std::vector<int64_t> const& trigrams, std::vector<uint64_t>& words);
+    bool contains(uint64_t const* words, size_t size, uint64_t hash);
+}
+
+#endif // BLOOMFILTER_H
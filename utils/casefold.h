@@ -0,0 +1,61 @@
+#ifndef CASEFOLD_H
+#define CASEFOLD_H
+
+#include <QChar>
+#include <QString>
+
+#include <cstdint>
+
+
+/*
+ * Simple case folding of single UTF-16 code units. It never changes the
+ * length of a string, so positions found in folded text are positions in the
+ * original. Surrogates are left alone: supplementary characters only match
+ * exactly.
+ */
+inline ushort fold_case(ushort c) {
+    if (c < 0x80) {
+        return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+    }
+    return c >= 0xd800 && c < 0xe000 ? c : QChar::toCaseFolded(uint(c));
+}
+
+inline void fold_case(ushort const* begin, ushort const* end, ushort* out) {
+    for (; begin != end; ++begin, ++out) {
+        *out = fold_case(*begin);
+    }
+}
+
+inline QString fold_case(QString const& string) {
+    QString result(string.size(), QChar());
+    fold_case(string.utf16(), string.utf16() + string.size(), reinterpret_cast<ushort*>(result.data()));
+    return result;
+}
+
+// for UTF-8 text: only ASCII letters are folded
+inline uint8_t fold_ascii(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+inline void fold_ascii(uint8_t const* begin, uint8_t const* end, uint8_t* out) {
+    for (; begin != end; ++begin, ++out) {
+        *out = fold_ascii(*begin);
+    }
+}
+
+/*
+ * Whether folding ASCII bytes finds the same matches of the folded pattern
+ * as folding the decoded text: the pattern has to be ASCII and free of 'k'
+ * and 's', which U+212A KELVIN SIGN and U+017F LATIN SMALL LETTER LONG S
+ * fold to.
+ */
+inline bool ascii_foldable(QString const& folded) {
+    for (QChar c: folded) {
+        if (c.unicode() >= 0x80 || c == 'k' || c == 's') {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // CASEFOLD_H
@@ -2,32 +2,100 @@
 
 #include <unordered_map>
 #include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QTextCodec>
 
 #include <QtCore/QThread>
 #include <QDebug>
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
-DirectoryScanner::DirectoryScanner(std::map<parameters, bool> const& params,
-                                   std::map<QString, std::map<QString, std::set<int64_t>>>* trigrams)
+
+DirectoryScanner::DirectoryScanner(std::map<parameters, bool> const& params, TrigramIndex* trigrams)
     : params(params),
       trigrams(trigrams) {
 
-    iterator_flags = params.at(parameters::Recursive) ?
-         QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags;
-    directory_flags = {QDir::NoDotAndDotDot, QDir::Files};
-    if (params.at(parameters::Hidden)) {
-        directory_flags |= QDir::Hidden;
-    }
+    ignore_case = params.at(parameters::IgnoreCase);
+    show_line = params.at(parameters::ShowLine);
+    qRegisterMetaType<std::shared_ptr<MatchBatch>>("std::shared_ptr<MatchBatch>");
 }
 
-DirectoryScanner::~DirectoryScanner() {
-    delete preprocess;
+DirectoryScanner::~DirectoryScanner() {}
+
+namespace {
+    const int UTF8_MIB = 106;
+
+    // the union of ranges, each one keeping the units and lines of its start
+    std::vector<DirectoryIndex::BlockRange> merged(std::vector<DirectoryIndex::BlockRange> ranges) {
+        std::sort(ranges.begin(), ranges.end(), [](auto const& a, auto const& b) { return a.begin < b.begin; });
+        std::vector<DirectoryIndex::BlockRange> result;
+        for (auto const& i: ranges) {
+            if (!result.empty() && i.begin <= result.back().end) {
+                result.back().end = std::max(result.back().end, i.end);
+            } else {
+                result.push_back(i);
+            }
+        }
+        return result;
+    }
 }
 
 void DirectoryScanner::add_scan_properties(QString const& input_string) {
-    substring = input_string;
-    preprocess = new std::boyer_moore_horspool_searcher<QChar*, std::hash<QChar>,
-            std::equal_to<void>>(substring.begin(), substring.end());
+    add_scan_properties(std::vector<QString>{input_string});
+}
+
+void DirectoryScanner::add_scan_properties(std::vector<QString> const& input_patterns) {
+    std::set<QString> distinct;
+    std::vector<QString> keys;
+    for (auto const& i: input_patterns) {
+        QString key = ignore_case ? fold_case(i) : i;
+        if (!i.isEmpty() && distinct.insert(key).second) {
+            patterns.push_back(i);
+            keys.push_back(key);
+        }
+    }
+    if (patterns.size() > 1) {
+        std::vector<std::vector<uint16_t>> units;
+        std::vector<std::vector<uint8_t>> bytes;
+        for (auto const& i: keys) {
+            units.emplace_back(i.utf16(), i.utf16() + i.size());
+            QByteArray utf8 = i.toUtf8();
+            bytes.emplace_back(utf8.constData(), utf8.constData() + utf8.size());
+            pattern_bytes.push_back(utf8.size());
+        }
+        automaton = std::make_unique<AhoCorasick<uint16_t>>(units);
+        byte_automaton = std::make_unique<AhoCorasick<uint8_t>>(bytes);
+    }
+    substring = keys.empty() ? QString() : keys.front();
+
+    preprocess = std::make_unique<SubstringSearcher<uint16_t>>(substring.utf16(),
+                                                               substring.utf16() + substring.size());
+
+    // files are decoded with the locale codec, bytes can only be compared when it is UTF-8
+    QTextCodec* codec = QTextCodec::codecForLocale();
+    byte_search = codec != nullptr && codec->mibEnum() == UTF8_MIB;
+    if (ignore_case) {
+        byte_search = byte_search && std::all_of(keys.begin(), keys.end(), ascii_foldable);
+    }
+    needle = substring.toUtf8();
+    byte_preprocess = std::make_unique<SubstringSearcher<uint8_t>>(
+            reinterpret_cast<uint8_t const*>(needle.constData()),
+            reinterpret_cast<uint8_t const*>(needle.constData()) + needle.size());
+}
+
+// the pattern must be valid
+void DirectoryScanner::add_regex(QString const& pattern) {
+    regex = std::make_unique<QRegularExpression>(pattern, ignore_case ?
+        QRegularExpression::CaseInsensitiveOption : QRegularExpression::NoPatternOption);
+    regex->optimize();
+    regex_plan = regex_query::analyze(pattern, trigrams != nullptr ? trigrams->kind() : CharTrigrams, ignore_case);
+    patterns = {pattern};
+    substring = pattern;
+    byte_search = false;
 }
 
 void DirectoryScanner::add_directories(std::list<QString> const& directories) {
@@ -41,126 +109,1023 @@ void DirectoryScanner::add_directories(std::set<QString> const& directories) {
     }
 }
 
-bool DirectoryScanner::substring_find(QString const& directory_name, QString const& file_name) {
-    size_t directory_prefix = directory_name.size() - QDir(directory_name).dirName().size();
-    QString relative_path = file_name.right(file_name.size() - directory_prefix);
+// 0 means one thread per core
+void DirectoryScanner::set_thread_count(int count) {
+    threads = count;
+}
+
+void DirectoryScanner::set_binary_policy(binary_policy policy) {
+    binaries = policy;
+}
+
+// nullptr turns collection off
+void DirectoryScanner::set_stats(std::shared_ptr<SearchStats> const& stats) {
+    this->stats = stats;
+}
+
+// nullptr turns caching off; with a cache a search may be answered or narrowed by an earlier one
+void DirectoryScanner::set_cache(std::shared_ptr<QueryCache> const& cache) {
+    this->cache = cache;
+}
+
+// nullptr searches every file; the filter is applied while listing and to the candidates of the index
+void DirectoryScanner::set_filter(std::shared_ptr<PathFilter const> const& filter) {
+    this->filter = filter;
+}
+
+// batches refer to patterns by their index in this list
+std::vector<QString> const& DirectoryScanner::get_patterns() const {
+    return patterns;
+}
+
+// workers are plain threads, so they ask the scanner's own QThread
+bool DirectoryScanner::interrupted() const {
+    return owner->isInterruptionRequested();
+}
+
+// runs read; with stats its time counts as decoding rather than matching
+template <typename F>
+auto DirectoryScanner::decode(ScanResult& result, F const& read) const {
+    if (stats == nullptr) {
+        return read();
+    }
+    int64_t start = monotonic_ns();
+    auto value = read();
+    result.decode_ns += monotonic_ns() - start;
+    return value;
+}
+
+// called from worker threads: only reads the scanner's state
+DirectoryScanner::ScanResult DirectoryScanner::substring_find(ScanTask const& task) const {
+    QString const& file_name = task.file;
+    ScanResult result;
+    int64_t start = stats != nullptr ? monotonic_ns() : 0;
     QFile file(file_name);
     if (!file.open(QFile::ReadOnly)) {
+        return result;
+    }
+    result.readable = true;
+    result.coordinates.resize(patterns.size());
+    if (show_line) {
+        result.lines.resize(patterns.size());
+    }
+    bool binary = binaries != SearchBinaryAsText && binary_file::is_binary(file);
+    if (stats != nullptr) {
+        result.io_ns = monotonic_ns() - start;
+    }
+    if (binary) {
+        result.binary = true;
+        if (binaries == SearchBinaryAsBytes) {
+            find_raw(file, result);
+        }
+        // binary files have no lines, line 0 keeps the byte offset in view
+        for (size_t i = 0; i < result.lines.size(); ++i) {
+            result.lines[i].resize(result.coordinates[i].size());
+        }
+        return result;
+    }
+    if (regex != nullptr) {
+        find_regex(file, result);
+    } else if (automaton != nullptr) {
+        if (!byte_search || !find_all_bytes(file, result, task.ranges)) {
+            find_all_text(file, result);
+        }
+    } else if (!byte_search || !find_bytes(file, result, task.ranges)) {
+        find_text(file, result);
+    }
+    return result;
+}
+
+/*
+ * Maps the file for searching UTF-8 bytes, skipping a UTF-8 byte order mark.
+ * Returns nullptr, leaving the file untouched, when it can't be mapped or
+ * starts with a UTF-16/UTF-32 byte order mark that QTextStream would decode
+ * differently.
+ */
+uchar* DirectoryScanner::map_utf8(QFile& file, uint8_t const*& begin, uint8_t const*& end) const {
+    qint64 size = file.size();
+    uchar* data = file.map(0, size);
+    if (data == nullptr) {
+        return nullptr;
+    }
+    end = data + size;
+    begin = binary_file::utf8_start(data, end);
+    if (begin == nullptr) {
+        file.unmap(data);
+        return nullptr;
+    }
+    return data;
+}
+
+/*
+ * The parts of a mapped file to search: [begin, end) unless the index narrowed
+ * it down to ranges. With ShowLine a range is widened back to the start of its
+ * line, so columns can be counted from there, and ranges that meet are merged.
+ */
+std::vector<DirectoryScanner::Span> DirectoryScanner::spans(uchar const* data, uint8_t const* begin, uint8_t const* end,
+                                                            std::vector<DirectoryIndex::BlockRange> const& ranges) const {
+    std::vector<Span> result;
+    if (ranges.empty()) {
+        result.push_back({begin, end, 0, 1});
+        return result;
+    }
+    uint64_t size = end - data;
+    for (auto const& i: ranges) {
+        Span span{std::max(data + std::min(i.begin, size), begin), data + std::min(i.end, size),
+                  int(i.units), int(i.lines) + 1};
+        if (span.begin >= span.end) {
+            continue;
+        }
+        if (show_line) {
+            uint8_t const* limit = result.empty() ? begin : result.back().end;
+            uint8_t const* line_start = span.begin;
+            while (line_start > limit && line_start[-1] != '\n') {
+                --line_start;
+            }
+            span.position -= utf16_length(line_start, span.begin);
+            span.begin = line_start;
+        }
+        if (!result.empty() && span.begin <= result.back().end) {
+            result.back().end = std::max(result.back().end, span.end);
+        } else {
+            result.push_back(span);
+        }
+    }
+    return result;
+}
+
+// searches the UTF-8 needle and converts match offsets to the UTF-16 positions find_text would report
+bool DirectoryScanner::find_bytes(QFile& file, ScanResult& result,
+                                  std::vector<DirectoryIndex::BlockRange> const& ranges) const {
+    const qint64 WINDOW = 1 << 22;
+    if (file.size() == 0) {
+        return true;
+    }
+    uint8_t const* begin;
+    uint8_t const* end;
+    uchar* data = map_utf8(file, begin, end);
+    if (data == nullptr) {
         return false;
     }
+
+    size_t found = 0;
+    std::vector<uint8_t> folded;
+    for (auto const& span: spans(data, begin, end, ranges)) {
+        // windows overlap by needle.size() - 1 bytes, so every match starts in exactly one of them
+        uint8_t const* counted = span.begin;
+        int position = span.position;
+        LineTracker<uint8_t> tracker(span.begin, end, span.line, span.position);
+        LineTracker<uint8_t>* lines = show_line ? &tracker : nullptr;
+        for (uint8_t const* window = span.begin; span.end - window >= needle.size(); window += WINDOW) {
+            uint8_t const* last = span.end - window > WINDOW + needle.size() - 1 ?
+                                  window + WINDOW + needle.size() - 1 : span.end;
+            uint8_t const* text = window;
+            if (ignore_case) {
+                folded.resize(last - window);
+                fold_ascii(window, last, folded.data());
+                text = folded.data();
+            }
+            uint8_t const* text_end = text + (last - window);
+            for (uint8_t const* it = text; (it = byte_preprocess->find(it, text_end)) != text_end; ++it) {
+                uint8_t const* match = window + (it - text);
+                position += utf16_length(counted, match);
+                counted = match;
+                if (!record(result, 0, position, found, lines, match)) {
+                    file.unmap(data);
+                    return true;
+                }
+            }
+            if (interrupted() || span.end - window <= WINDOW) {
+                break;
+            }
+        }
+        if (interrupted()) {
+            break;
+        }
+    }
+    file.unmap(data);
+    return true;
+}
+
+// with ShowLine the whole file is decoded at once, so lines can be located in the original text
+void DirectoryScanner::find_text(QFile& file, ScanResult& result) const {
     const int size = substring.size();
     const int BUFFER_SIZE = 1 << 18;
-    std::list<int> coordinates;
     QTextStream stream(&file);
-    QString buffer = stream.read(BUFFER_SIZE);
+    auto read = [&] {
+        return decode(result, [&] {
+            QString buffer = stream.read(BUFFER_SIZE);
+            return ignore_case ? fold_case(buffer) : buffer;
+        });
+    };
+    QString text = show_line ? decode(result, [&] { return stream.readAll(); }) : QString();
+    LineTracker<ushort> tracker(text.utf16(), text.utf16() + text.size());
+    LineTracker<ushort>* lines = show_line ? &tracker : nullptr;
+    QString buffer = !show_line ? read() : decode(result, [&] { return ignore_case ? fold_case(text) : text; });
     int index = 0;
-    while (buffer.size() > size - 1) {
-        auto it = buffer.begin();
-        while ((it = std::search(it, buffer.end(), *preprocess)) != buffer.end()) {
-            coordinates.push_back(index + (it++ - buffer.begin()));
+    size_t found = 0;
+    bool more = true;
+    while (more && buffer.size() > size - 1) {
+        ushort const* begin = buffer.utf16();
+        ushort const* end = begin + buffer.size();
+        for (ushort const* it = begin; more && (it = preprocess->find(it, end)) != end; ++it) {
+            int position = index + (it - begin);
+            ushort const* match = lines != nullptr ? text.utf16() + position : nullptr;
+            more = record(result, 0, position, found, lines, match) && !interrupted();
+        }
+        if (interrupted()) {
+            break;
+        }
+        index += buffer.size() - size + 1;
+        buffer = buffer.mid(buffer.size() - substring.size() + 1);
+        buffer += read();
+    }
+}
+
+/*
+ * With FirstMatch only the first position of each pattern is kept; false
+ * once every pattern was seen. With ShowLine lines locates match, which
+ * points at the position in the text it tracks.
+ */
+template <typename T>
+bool DirectoryScanner::record(ScanResult& result, uint32_t pattern, int position, size_t& found,
+                              LineTracker<T>* lines, T const* match) const {
+    std::vector<int>& coordinates = result.coordinates[pattern];
+    if (params.at(parameters::FirstMatch) && !coordinates.empty()) {
+        return true;
+    }
+    coordinates.push_back(position);
+    if (lines != nullptr) {
+        result.lines[pattern].push_back(lines->locate(match, position));
+    }
+    return !params.at(parameters::FirstMatch) || ++found < patterns.size();
+}
 
-            if (QThread::currentThread()->isInterruptionRequested() || params[parameters::FirstMatch]) {
+/*
+ * The automaton reports a match at its last byte; the UTF-16 position of the
+ * byte after it is counted up monotonically and the pattern length subtracted.
+ */
+bool DirectoryScanner::find_all_bytes(QFile& file, ScanResult& result,
+                                      std::vector<DirectoryIndex::BlockRange> const& ranges) const {
+    const qint64 WINDOW = 1 << 22;
+    if (file.size() == 0) {
+        return true;
+    }
+    uint8_t const* begin;
+    uint8_t const* end;
+    uchar* data = map_utf8(file, begin, end);
+    if (data == nullptr) {
+        return false;
+    }
+
+    size_t found = 0;
+    for (auto const& span: spans(data, begin, end, ranges)) {
+        uint8_t const* counted = span.begin;
+        int position = span.position;
+        LineTracker<uint8_t> tracker(span.begin, end, span.line, span.position);
+        LineTracker<uint8_t>* lines = show_line ? &tracker : nullptr;
+        uint32_t state = AhoCorasick<uint8_t>::ROOT;
+        for (uint8_t const* window = span.begin; window < span.end; window += WINDOW) {
+            uint8_t const* last = span.end - window > WINDOW ? window + WINDOW : span.end;
+            for (uint8_t const* it = window; it != last; ++it) {
+                state = byte_automaton->next(state, ignore_case ? fold_ascii(*it) : *it);
+                uint32_t output = byte_automaton->first_output(state);
+                if (output == AhoCorasick<uint8_t>::NONE) {
+                    continue;
+                }
+                position += utf16_length(counted, it + 1);
+                counted = it + 1;
+                for (; output != AhoCorasick<uint8_t>::NONE; output = byte_automaton->next_output(output)) {
+                    uint32_t pattern = byte_automaton->pattern(output);
+                    if (!record(result, pattern, position - patterns[pattern].size(), found,
+                                lines, it + 1 - pattern_bytes[pattern])) {
+                        file.unmap(data);
+                        return true;
+                    }
+                }
+            }
+            if (interrupted()) {
                 break;
             }
         }
-        if (QThread::currentThread()->isInterruptionRequested()) {
+        if (interrupted()) {
             break;
         }
-        index += buffer.size() - size + 1;
-        buffer = buffer.mid(buffer.size() - substring.size() + 1);
-        buffer += stream.read(BUFFER_SIZE);
     }
+    file.unmap(data);
+    return true;
+}
 
-    qRegisterMetaType<std::list<int>>("coordinates");
-    if (coordinates.size() > 0) {
-        emit new_match(relative_path, coordinates, params[parameters::FirstMatch]);
+// the automaton state carries over between chunks, so no overlap is needed
+void DirectoryScanner::find_all_text(QFile& file, ScanResult& result) const {
+    const int BUFFER_SIZE = 1 << 18;
+    QTextStream stream(&file);
+    int index = 0;
+    size_t found = 0;
+    QString text = show_line ? decode(result, [&] { return stream.readAll(); }) : QString();
+    LineTracker<ushort> tracker(text.utf16(), text.utf16() + text.size());
+    LineTracker<ushort>* lines = show_line ? &tracker : nullptr;
+    auto read = [&] {
+        return decode(result, [&] { return stream.read(BUFFER_SIZE); });
+    };
+    uint32_t state = AhoCorasick<uint16_t>::ROOT;
+    for (QString buffer = show_line ? text : read(); !buffer.isEmpty(); buffer = read()) {
+        if (ignore_case) {
+            buffer = decode(result, [&] { return fold_case(buffer); });
+        }
+        ushort const* data = buffer.utf16();
+        for (int i = 0; i < buffer.size(); ++i) {
+            state = automaton->next(state, data[i]);
+            for (uint32_t output = automaton->first_output(state); output != AhoCorasick<uint16_t>::NONE;
+                 output = automaton->next_output(output)) {
+                uint32_t pattern = automaton->pattern(output);
+                int position = index + i + 1 - patterns[pattern].size();
+                ushort const* match = lines != nullptr ? text.utf16() + position : nullptr;
+                if (!record(result, pattern, position, found, lines, match)) {
+                    return;
+                }
+            }
+        }
+        if (interrupted()) {
+            return;
+        }
+        index += buffer.size();
+    }
+}
+
+/*
+ * Matches need whole lines of text, so a mapped UTF-8 file is decoded a
+ * window of WINDOW bytes of lines at a time (at once for most files) and
+ * anything else through QTextStream, at once, like find_text. A window is
+ * decoded with OVERLAP bytes of lines before and after it and matched from
+ * its start on, so ^ and \A still only match at the start of the file and
+ * lookbehinds see what precedes the window. Only matches starting in the
+ * window are kept, and none reaching the last newline of the decoded text
+ * unless the file ends there, so $ and \z only match at its end as well.
+ * A match is missed if it starts in one window and runs more than OVERLAP
+ * bytes past it, or looks further behind.
+ */
+void DirectoryScanner::find_regex(QFile& file, ScanResult& result) const {
+    const qint64 WINDOW = 1 << 26;
+    const qint64 OVERLAP = 1 << 20;
+    uint8_t const* begin;
+    uint8_t const* end;
+    uchar* data = nullptr;
+    size_t found = 0;
+    QTextCodec* codec = QTextCodec::codecForLocale();
+    if (file.size() > 0 && codec != nullptr && codec->mibEnum() == UTF8_MIB) {
+        data = map_utf8(file, begin, end);
+    }
+    if (data == nullptr) {
+        QTextStream stream(&file);
+        match_regex(decode(result, [&] { return stream.readAll(); }), result, show_line, found);
+        return;
+    }
+
+    // past the newline after at least size bytes from it, or end
+    auto lines_after = [end](uint8_t const* it, qint64 size) {
+        if (end - it <= size) {
+            return end;
+        }
+        uint8_t const* newline = find_newline(it + size, end);
+        return newline != end ? newline + 1 : end;
+    };
+    // the start of the line at least size bytes before it, or begin
+    auto lines_before = [begin](uint8_t const* it, qint64 size) {
+        if (it - begin <= size) {
+            return begin;
+        }
+        return std::find(std::make_reverse_iterator(it - size), std::make_reverse_iterator(begin),
+                         uint8_t('\n')).base();
+    };
+    int position = 0;
+    int line = 1;
+    for (uint8_t const* window = begin; window != end && !interrupted(); ) {
+        uint8_t const* window_end = lines_after(window, WINDOW);
+        uint8_t const* text_begin = lines_before(window, OVERLAP);
+        uint8_t const* text_end = lines_after(window_end, OVERLAP);
+        QString text = decode(result, [&] {
+            return QString::fromUtf8(reinterpret_cast<char const*>(text_begin), text_end - text_begin);
+        });
+        int from = utf16_length(text_begin, window);
+        int limit = window_end == end ? text.size() : from + utf16_length(window, window_end);
+        if (!match_regex(text, result, show_line, found, from, limit, text_end != end, position, line)) {
+            break;
+        }
+        position += limit;
+        line += std::count(window, window_end, uint8_t('\n'));
+        window = window_end;
+    }
+    file.unmap(data);
+}
+
+/*
+ * Matches starting in [from, limit) of text are recorded, the one at from
+ * at position; from starts line line. With cut the file goes on after text,
+ * which ends in a newline, and a match reaching that newline may only be
+ * one because the text ends there. False once FirstMatch has what it needs.
+ */
+bool DirectoryScanner::match_regex(QString const& text, ScanResult& result, bool locate, size_t& found, int from,
+                                   int limit, bool cut, int position, int line) const {
+    LineTracker<ushort> tracker(text.utf16() + from, text.utf16() + text.size(), line, position);
+    LineTracker<ushort>* lines = locate ? &tracker : nullptr;
+    for (auto it = regex->globalMatch(text, from); it.hasNext() && !interrupted(); ) {
+        QRegularExpressionMatch match = it.next();
+        int start = match.capturedStart();
+        if (start >= limit) {
+            break;
+        }
+        if (cut && match.capturedEnd() >= text.size() - 1) {
+            continue;
+        }
+        if (!record(result, 0, position + start - from, found, lines, text.utf16() + start)) {
+            return false;
+        }
     }
     return true;
 }
 
-void DirectoryScanner::scan_directory(QString const& directory_name) {
-    size_t directory_prefix = directory_name.size() - QDir(directory_name).dirName().size();
-    size_t directory_size = 0;
-    size_t current = 0;
-    std::list<QString> files;
-    for (auto i: (*trigrams)[directory_name]) {
-        bool accept = true;
-        int64_t needed = (((int64_t) substring[0].unicode()) << 16) +
-                         (((int64_t) substring[1].unicode()) << 32);
-        for (int j = 2; j < substring.size(); ++j) {
-            needed = (needed >> 16) + (((int64_t) substring[j].unicode()) << 32);
-            if (i.second.find(needed) == i.second.end()) {
-                accept = false;
+// binary files are searched as they are, positions are byte offsets
+void DirectoryScanner::find_raw(QFile& file, ScanResult& result) const {
+    const qint64 WINDOW = 1 << 22;
+    qint64 size = file.size();
+    uchar* data = size > 0 ? file.map(0, size) : nullptr;
+    QByteArray content;
+    uint8_t const* begin = data;
+    uint8_t const* end = data + size;
+    if (data == nullptr) {
+        content = file.readAll();
+        begin = reinterpret_cast<uint8_t const*>(content.constData());
+        end = begin + content.size();
+    }
+    std::vector<uint8_t> folded;
+    if (ignore_case) {
+        folded.resize(end - begin);
+        fold_ascii(begin, end, folded.data());
+        begin = folded.data();
+        end = begin + folded.size();
+    }
+
+    if (regex != nullptr) {
+        size_t found = 0;
+        match_regex(QString::fromLatin1(reinterpret_cast<char const*>(begin), end - begin), result, false, found);
+    } else if (byte_automaton != nullptr) {
+        size_t found = 0;
+        bool more = true;
+        uint32_t state = AhoCorasick<uint8_t>::ROOT;
+        for (uint8_t const* window = begin; more && window < end && !interrupted(); window += WINDOW) {
+            uint8_t const* last = end - window > WINDOW ? window + WINDOW : end;
+            for (uint8_t const* it = window; more && it != last; ++it) {
+                state = byte_automaton->next(state, *it);
+                for (uint32_t output = byte_automaton->first_output(state); more && output != AhoCorasick<uint8_t>::NONE;
+                     output = byte_automaton->next_output(output)) {
+                    uint32_t pattern = byte_automaton->pattern(output);
+                    more = record<uint8_t>(result, pattern, it + 1 - begin - pattern_bytes[pattern], found,
+                                           nullptr, nullptr);
+                }
+            }
+        }
+    } else {
+        for (uint8_t const* it = begin; (it = byte_preprocess->find(it, end)) != end; ++it) {
+            result.coordinates[0].push_back(it - begin);
+            if (params.at(parameters::FirstMatch) || interrupted()) {
                 break;
             }
         }
+    }
+    if (data != nullptr) {
+        file.unmap(data);
+    }
+}
 
-        if (accept) {
-            files.push_back(i.first);
-            directory_size += QFileInfo(i.first).size();
+// called on the listing thread; false once the search stopped
+bool DirectoryScanner::scan_directory(QString const& directory_name, Pipeline& pipeline) {
+    int64_t start = stats != nullptr ? monotonic_ns() : 0;
+    int64_t waited = 0;
+    size_t passed = 0;
+    DirectoryIndex const& index = trigrams->directories.at(directory_name);
+    trigram_kind kind = trigrams->kind();
+    // a file has to be opened if any of the patterns may occur in it
+    std::vector<bool> candidate(index.file_count(), false);
+    if (regex != nullptr) {
+        for (auto i: regex_query::candidates(regex_plan, index)) {
+            candidate[i] = true;
+        }
+    } else {
+        for (auto const& pattern: patterns) {
+            for (auto i: index.candidates(string_trigrams(pattern, kind, ignore_case))) {
+                candidate[i] = true;
+            }
         }
     }
-    for (auto i: files) {
-        QString relative_path = i.right(i.size() - directory_prefix);
-        if (!substring_find(directory_name, i)) {
-            emit new_error(relative_path);
+    // binaries have no trigrams, so they may hold anything when they are searched at all
+    if (binaries != SkipBinary) {
+        for (auto i: index.with_copies(std::vector<uint32_t>(index.binaries.begin(), index.binaries.end()))) {
+            candidate[i] = true;
         }
-        if (QThread::currentThread()->isInterruptionRequested()) {
-            return;
+    }
+    // the index may have been built with another filter, so candidates go through this one
+    QByteArray root = QFile::encodeName(directory_name);
+    int relative = PathFilter::relative_start(root);
+    // whether the walk reaches a directory, and the rules inside it
+    std::map<QByteArray, std::pair<bool, std::shared_ptr<PathFilter::Scope const>>> scopes;
+    auto admitted = [&](QString const& file_name, int64_t size) {
+        QByteArray path = QFile::encodeName(file_name);
+        QByteArray parent = path.left(path.lastIndexOf('/'));
+        auto it = scopes.find(parent);
+        if (it == scopes.end()) {
+            std::shared_ptr<PathFilter::Scope const> scope;
+            bool reached = filter->reaches(root, parent, true, 0, &scope);
+            if (reached) {
+                scope = filter->enter(scope, parent, std::max(0, parent.size() - relative));
+            }
+            it = scopes.emplace(parent, std::make_pair(reached, std::move(scope))).first;
+        }
+        return it->second.first && filter->accepts(it->second.second.get(), path.constData() + relative,
+                                                   path.constData() + path.size(), false, size);
+    };
+    auto hand = [&](ScanTask&& task) {
+        ++passed;
+        int64_t handed = stats != nullptr ? monotonic_ns() : 0;
+        bool more = enqueue(pipeline, std::move(task));
+        if (stats != nullptr) {
+            waited += monotonic_ns() - handed;
+        }
+        return more;
+    };
+
+    // a hard link is its original; any other copy only while neither changed since the index was built
+    auto same_content = [&index](uint32_t copy, uint32_t original) {
+        QString copy_name = index.file_name(copy);
+        QString original_name = index.file_name(original);
+        FileId copy_id = file_id(copy_name);
+        FileId original_id = file_id(original_name);
+        if (copy_id.links > 1 && !(copy_id < original_id) && !(original_id < copy_id)) {
+            return true;
+        }
+        return file_stamp(copy_name) == index.stamps[copy] && file_stamp(original_name) == index.stamps[original];
+    };
+
+    // originals go first, copies are handed after them and only get their results
+    enum Fate : uint8_t {Rejected, Skipped, Queued};
+    std::vector<uint8_t> fate(index.file_count(), Rejected);
+    std::vector<bool> shared(index.copies.size, false);
+    std::vector<bool> has_copies(index.file_count(), false);
+    for (size_t j = 0; j < index.copies.size; ++j) {
+        if (candidate[index.copies[j]] && same_content(index.copies[j], index.originals[j])) {
+            shared[j] = true;
+            has_copies[index.originals[j]] = true;
         }
-        current += QFileInfo(i).size();
-        emit progress(directory_name, ((double) current * 100 / directory_size));
     }
-    emit progress(directory_name, 100);
+    auto search = [&](uint32_t i) {
+        QString file_name = index.file_name(i);
+        int64_t size = QFileInfo(file_name).size();
+        if (filter != nullptr && !admitted(file_name, size)) {
+            return true;
+        }
+        // only the byte search can skip to the blocks of a large file, anything else reads it whole
+        std::vector<DirectoryIndex::BlockRange> ranges;
+        if (regex == nullptr && byte_search && index.is_blocked(i)) {
+            for (auto const& pattern: patterns) {
+                auto found = index.ranges(i, string_trigrams(pattern, kind, ignore_case), pattern.toUtf8().size());
+                ranges.insert(ranges.end(), found.begin(), found.end());
+            }
+            if (ranges.empty()) {
+                fate[i] = Skipped;
+                return true;
+            }
+            ranges = merged(std::move(ranges));
+            size = 0;
+            for (auto const& range: ranges) {
+                size += range.end - range.begin;
+            }
+        }
+        fate[i] = Queued;
+        return hand({directory_name, file_name, size, true, std::move(ranges), QString(), has_copies[i]});
+    };
+    bool more = true;
+    for (uint32_t i = 0; more && i < candidate.size(); ++i) {
+        if (candidate[i] && index.original(i) == i) {
+            more = search(i);
+        }
+    }
+    for (size_t j = 0; more && j < index.copies.size; ++j) {
+        uint32_t copy = index.copies[j];
+        uint32_t original = index.originals[j];
+        if (!candidate[copy] || (shared[j] && fate[original] == Skipped)) {
+            continue;
+        }
+        // a copy that may differ from its original, or whose original this filter rejects, is searched on its own
+        if (!shared[j] || fate[original] == Rejected) {
+            more = search(copy);
+            continue;
+        }
+        QString file_name = index.file_name(copy);
+        if (filter == nullptr || admitted(file_name, QFileInfo(file_name).size())) {
+            more = hand({directory_name, file_name, 0, true, {}, index.file_name(original)});
+        }
+    }
+    if (stats != nullptr) {
+        stats->add(SearchStats::IndexFilter, monotonic_ns() - start - waited);
+        SearchStats::add(stats->candidates, passed);
+        SearchStats::add(stats->rejected, index.file_count() - passed);
+    }
+    return more;
 }
 
 void DirectoryScanner::scan_directories() {
-    if (params[parameters::Preprocess] && substring.size() >= 3) {
-        for (auto i: *trigrams) {
-            scan_directory(i.first);
-            if (QThread::currentThread()->isInterruptionRequested()) {
-                break;
+    owner = QThread::currentThread();
+    scan();
+    emit finished();
+}
+
+void DirectoryScanner::scan() {
+    const size_t QUEUE_SIZE = 1 << 12;
+    // every pattern was empty: results have a slot per pattern, and an empty one would match everywhere
+    if (patterns.empty()) {
+        return;
+    }
+    ThreadClock clock(stats.get(), ThreadClock::Driver);
+    std::shared_ptr<QueryCache::Entry const> previous;
+    std::shared_ptr<QueryCache::Entry> record;
+    if (cache != nullptr) {
+        QString scope = cache_scope();
+        QString query = cache_query();
+        if (auto hit = cache->find(scope, query)) {
+            replay(*hit);
+            return;
+        }
+        record = std::make_shared<QueryCache::Entry>();
+        record->scope = scope;
+        record->query = query;
+        if (regex == nullptr && automaton == nullptr) {
+            record->pattern = substring;
+            previous = cache->narrowest(scope, substring);
+        }
+    }
+
+    Pipeline pipeline(QUEUE_SIZE);
+    // a regular expression can always be planned against the index, at worst every file is a candidate
+    bool indexed = params[parameters::Preprocess] && trigrams != nullptr && (regex != nullptr ||
+        std::all_of(patterns.begin(), patterns.end(), [](QString const& i) { return i.size() >= 3; }));
+    // directories missing from the index are traversed
+    std::vector<QString> filtered;
+    std::vector<QString> traversed;
+    for (auto const& i: directories) {
+        pipeline.directories[i];
+        if (indexed && trigrams->directories.count(i) > 0) {
+            filtered.push_back(i);
+        } else {
+            traversed.push_back(i);
+        }
+    }
+
+    // files are searched while the rest are still being listed
+    std::thread producer([&] {
+        ThreadClock producer_clock(stats.get(), ThreadClock::Step);
+        bool more = true;
+        if (previous != nullptr) {
+            // the pattern contains the earlier one, so it can only be where that one was
+            for (auto it = previous->files.begin(); more && it != previous->files.end(); ++it) {
+                more = !interrupted() && enqueue(pipeline, {it->first, it->second, QFileInfo(it->second).size(),
+                                                            false, {}});
+            }
+            for (auto const& i: directories) {
+                listed(pipeline, i);
             }
+            filtered.clear();
+            traversed.clear();
         }
-    } else {
-        for (auto i: directories) {
-            directory_dfs(i, &DirectoryScanner::substring_find);
-            if (QThread::currentThread()->isInterruptionRequested()) {
+        for (auto const& i: filtered) {
+            more = scan_directory(i, pipeline) && !interrupted();
+            if (!more) {
                 break;
             }
+            listed(pipeline, i);
+        }
+        if (more) {
+            list_directories(traversed, pipeline);
         }
+        {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            pipeline.complete = true;
+        }
+        pipeline.queue.close();
+    });
+    search_files(pipeline, record);
+    pipeline.queue.close();
+    producer.join();
+    if (record != nullptr && !interrupted()) {
+        cache->insert(record);
     }
-    emit finished();
 }
 
-void DirectoryScanner::directory_dfs(QString const& directory_name,
-                                     std::function<bool(DirectoryScanner&, QString const&,
-                                                        QString const&)> process) {
-    size_t directory_prefix = directory_name.size() - QDir(directory_name).dirName().size();
-    size_t directory_size = 0;
-    size_t current = 0;
+// the batches, errors and progress of a cached search, as if it ran again
+void DirectoryScanner::replay(QueryCache::Entry const& entry) {
+    for (auto const& i: entry.errors) {
+        emit new_error(i);
+    }
+    for (auto const& i: entry.skipped) {
+        emit skipped_binary(i);
+    }
+    for (auto const& i: entry.batches) {
+        emit new_matches(i);
+    }
+    for (auto const& i: directories) {
+        emit progress(i, 100);
+    }
+}
 
-    for (QDirIterator it(directory_name, directory_flags, iterator_flags); it.hasNext(); ) {
-        it.next();
-        directory_size += it.fileInfo().size();
+// whatever decides which files a search reads and how; directories are separated by '\0'
+QString DirectoryScanner::cache_scope() const {
+    QStringList parts;
+    for (auto const& i: directories) {
+        parts.append(i);
     }
+    parts.append(QString::number(params.at(parameters::Hidden)) + QString::number(params.at(parameters::Recursive)) +
+                 QString::number(ignore_case) + QString::number(binaries));
+    if (filter != nullptr) {
+        parts.append(filter->description());
+    }
+    return parts.join(QChar(0));
+}
 
-    if (directory_size == 0) {
-        emit progress(directory_name, 100);
-        return;
+// the patterns and whatever else shapes the results of the files read
+QString DirectoryScanner::cache_query() const {
+    QString mode = regex != nullptr ? "r" : automaton != nullptr ? "m" : "s";
+    QStringList parts{mode + QString::number(params.at(parameters::FirstMatch)) + QString::number(show_line) +
+                      QString::number(params.at(parameters::MultiPattern))};
+    for (auto const& i: patterns) {
+        parts.append(i);
     }
+    return parts.join(QChar(0));
+}
+
+// with Ordered a single thread lists the files, so they come in the same order every time
+void DirectoryScanner::list_directories(std::vector<QString> const& roots, Pipeline& pipeline) {
+    DirectoryWalker walker(params, params.at(parameters::Ordered) ? 1 : threads);
+    walker.set_stats(stats.get());
+    walker.set_filter(filter);
+    walker.walk(roots, [&](size_t root, QString const& path, int64_t size, FileId const& id) {
+        if (interrupted()) {
+            return false;
+        }
+        if (stats != nullptr) {
+            SearchStats::add(stats->files_listed);
+        }
+        ScanTask task{roots[root], path, size, false, {}};
+        // hard links to one file are searched once
+        if (id.links > 1) {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            auto link = pipeline.links.emplace(id, path);
+            if (link.second) {
+                task.linked = true;
+            } else {
+                task.original = link.first->second;
+                task.size = 0;
+            }
+        }
+        return enqueue(pipeline, std::move(task));
+    }, [&](size_t root) {
+        listed(pipeline, roots[root]);
+    });
+}
 
-    for (QDirIterator it(directory_name, directory_flags, iterator_flags); it.hasNext(); ) {
-        it.next();
-        QString file_path = it.filePath();
-        QString relative_path = file_path.right(file_path.size() - directory_prefix);
-        if (!process(*this, directory_name, file_path)) {
+// called from the listing threads; false once the search stopped
+bool DirectoryScanner::enqueue(Pipeline& pipeline, ScanTask&& task) const {
+    size_t number;
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        number = pipeline.listed++;
+        pipeline.directories[task.directory].first += task.size;
+    }
+    return pipeline.queue.push({number, std::move(task)});
+}
+
+// every file of the directory has been listed
+void DirectoryScanner::listed(Pipeline& pipeline, QString const& directory) const {
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.directories[directory].second = true;
+}
+
+/*
+ * Files are searched by a pool of worker threads as soon as they are listed,
+ * while this thread hands the results to the GUI. With the Ordered parameter
+ * results are emitted in the order files were listed (index order or
+ * traversal order), otherwise as soon as they are found. Progress is the
+ * share of the bytes listed so far that was searched, and stays below 100%
+ * until the directory is listed completely.
+ */
+void DirectoryScanner::search_files(Pipeline& pipeline, std::shared_ptr<QueryCache::Entry>& record) {
+    struct Searched {
+        size_t number;
+        ScanTask task;
+        ScanResult result;
+    };
+    std::vector<Searched> completed;
+    std::mutex mutex;
+    std::condition_variable ready;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < thread_count(threads); ++i) {
+        workers.emplace_back([&] {
+            ThreadClock clock(stats.get(), ThreadClock::Worker);
+            int64_t busy = 0;
+            while (auto task = pipeline.queue.take()) {
+                if (interrupted()) {
+                    break;
+                }
+                ScanResult result;
+                if (task->second.original.isEmpty()) {
+                    int64_t start = stats != nullptr ? monotonic_ns() : 0;
+                    result = substring_find(task->second);
+                    if (stats != nullptr) {
+                        result.total_ns = monotonic_ns() - start;
+                        busy += result.total_ns;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.push_back({task->first, std::move(task->second), std::move(result)});
+                ready.notify_one();
+            }
+            if (stats != nullptr) {
+                SearchStats::add(stats->worker_busy_ns, busy);
+            }
+        });
+    }
+
+    // matches and progress reach the GUI in batches, not one queued signal per file
+    const auto FLUSH_INTERVAL = std::chrono::milliseconds(100);
+    const size_t FLUSH_SIZE = 1 << 16;
+    auto pending = std::make_shared<MatchBatch>();
+    std::map<QString, int64_t> searched;
+    std::set<QString> advanced;
+    auto flushed = std::chrono::steady_clock::now();
+    auto flush = [&] {
+        if (pending->size() != 0) {
+            if (record != nullptr) {
+                record->batches.push_back(pending);
+            }
+            emit new_matches(pending);
+            pending = std::make_shared<MatchBatch>();
+        }
+        for (auto const& i: advanced) {
+            std::pair<int64_t, bool> listing;
+            {
+                std::lock_guard<std::mutex> lock(pipeline.mutex);
+                listing = pipeline.directories[i];
+            }
+            double value = listing.first > 0 ? (double) searched[i] * 100 / listing.first : 100;
+            emit progress(i, listing.second ? value : std::min(value, 99.0));
+        }
+        advanced.clear();
+        flushed = std::chrono::steady_clock::now();
+    };
+
+    auto report = [&](ScanTask const& task, ScanResult const& result) {
+        size_t directory_prefix = task.directory.size() - QDir(task.directory).dirName().size();
+        QString relative_path = task.file.right(task.file.size() - directory_prefix);
+        if (!result.readable) {
             emit new_error(relative_path);
         }
-        current += it.fileInfo().size();
-        emit progress(directory_name, ((double) current * 100 / directory_size));
-        if (QThread::currentThread()->isInterruptionRequested()) {
+        if (result.binary && binaries == SkipBinary) {
+            emit skipped_binary(relative_path);
+        }
+        for (size_t pattern = 0; pattern < result.coordinates.size(); ++pattern) {
+            if (!result.coordinates[pattern].empty()) {
+                pending->add(relative_path, pattern, result.coordinates[pattern],
+                             show_line ? result.lines[pattern] : std::vector<LinePosition>());
+            }
+        }
+        account(task, result);
+        if (record != nullptr) {
+            size_t matches = 0;
+            for (auto const& i: result.coordinates) {
+                matches += i.size();
+            }
+            if (!result.readable) {
+                record->errors.push_back(relative_path);
+            }
+            if (result.binary && binaries == SkipBinary) {
+                record->skipped.push_back(relative_path);
+            }
+            if (matches > 0 || !result.readable || (result.binary && binaries == SkipBinary)) {
+                record->files.emplace_back(task.directory, task.file);
+            }
+            // too many matches to keep, the search isn't cached
+            record->matches += matches;
+            if (record->matches > QueryCache::MAXIMUM_MATCHES) {
+                record = nullptr;
+            }
+        }
+
+        searched[task.directory] += task.size;
+        advanced.insert(task.directory);
+        if (pending->coordinates.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    };
+
+    // results of originals by file, and copies that came before their original's result
+    std::map<QString, ScanResult> linked_results;
+    std::map<QString, std::vector<ScanTask>> waiting_copies;
+    auto deliver = [&](Searched const& item) {
+        ScanTask const& task = item.task;
+        if (!task.original.isEmpty()) {
+            auto found = linked_results.find(task.original);
+            if (found == linked_results.end()) {
+                waiting_copies[task.original].push_back(task);
+            } else {
+                report(task, found->second);
+            }
             return;
         }
+        report(task, item.result);
+        if (task.linked) {
+            auto waiting = waiting_copies.find(task.file);
+            if (waiting != waiting_copies.end()) {
+                for (auto const& i: waiting->second) {
+                    report(i, item.result);
+                }
+                waiting_copies.erase(waiting);
+            }
+            linked_results.emplace(task.file, item.result);
+        }
+    };
+
+    // with Ordered, files that were searched before the ones listed earlier wait in early
+    std::map<size_t, Searched> early;
+    std::vector<Searched> arrived;
+    size_t delivered = 0;
+    while (!interrupted()) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait_for(lock, std::chrono::milliseconds(50), [&] { return !completed.empty(); });
+            arrived.swap(completed);
+        }
+        for (auto& i: arrived) {
+            if (params.at(parameters::Ordered)) {
+                early.emplace(i.number, std::move(i));
+            } else {
+                deliver(i);
+                ++delivered;
+            }
+        }
+        arrived.clear();
+        for (auto it = early.begin(); it != early.end() && it->first == delivered; it = early.erase(it)) {
+            deliver(it->second);
+            ++delivered;
+        }
+        if (std::chrono::steady_clock::now() - flushed >= FLUSH_INTERVAL) {
+            flush();
+        }
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        if (pipeline.complete && delivered == pipeline.listed) {
+            break;
+        }
+    }
+    // directories with nothing to search are done too
+    if (!interrupted()) {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        for (auto const& i: pipeline.directories) {
+            advanced.insert(i.first);
+        }
+    }
+    flush();
+
+    pipeline.queue.close();
+    for (auto& i: workers) {
+        i.join();
+    }
+}
+
+// called on the scanner's thread for every delivered file
+void DirectoryScanner::account(ScanTask const& task, ScanResult const& result) const {
+    if (stats == nullptr) {
+        return;
+    }
+    size_t matches = 0;
+    for (auto const& i: result.coordinates) {
+        matches += i.size();
+    }
+    // a copy cost nothing, its original was accounted for
+    if (!task.original.isEmpty()) {
+        SearchStats::add(stats->duplicates);
+        SearchStats::add(stats->files_matched, matches > 0);
+        SearchStats::add(stats->matches, matches);
+        return;
+    }
+    if (!result.readable) {
+        SearchStats::add(stats->unreadable);
+        return;
     }
+    SearchStats::add(stats->files_opened);
+    SearchStats::add(stats->bytes_opened, task.size);
+    SearchStats::add(stats->binary, result.binary);
+    SearchStats::add(stats->files_matched, matches > 0);
+    SearchStats::add(stats->matches, matches);
+    SearchStats::add(stats->false_positives, task.indexed && matches == 0);
+    stats->add(SearchStats::OpenRead, result.io_ns);
+    stats->add(SearchStats::Decoding, result.decode_ns);
+    stats->add(SearchStats::Matching, result.total_ns - result.io_ns - result.decode_ns);
 }
@@ -2,19 +2,35 @@
 #define DIRECTORYSCANNER_H
 
 #include "parameters.h"
-#include "qcharhash.cpp"
+#include "trigramindex.h"
+#include "workqueue.h"
+#include "substringsearch.h"
+#include "ahocorasick.h"
+#include "regexquery.h"
+#include "casefold.h"
+#include "binaryfile.h"
+#include "matchmodel.h"
+#include "linetracker.h"
+#include "searchstats.h"
+#include "directorywalker.h"
+#include "querycache.h"
 
 #include <QString>
 #include <QObject>
 #include <QFlags>
 #include <QDir>
-#include <QDirIterator>
+#include <QFile>
+#include <QByteArray>
+#include <QRegularExpression>
 
 #include <map>
 #include <vector>
 #include <set>
-#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <cstdint>
+#include <climits>
 #include <algorithm>
 
 
@@ -22,42 +38,146 @@ class DirectoryScanner : public QObject {
     Q_OBJECT
 
 public:
-    DirectoryScanner(std::map<parameters, bool> const& params,
-                     std::map<QString, std::map<QString, std::set<int64_t>>>* trigrams);
+    DirectoryScanner(std::map<parameters, bool> const& params, TrigramIndex* trigrams);
 
     ~DirectoryScanner();
 
     void add_scan_properties(QString const& input_string);
+    void add_scan_properties(std::vector<QString> const& input_patterns);
+    void add_regex(QString const& pattern);
     void add_directories(std::list<QString> const& directories);
     void add_directories(std::set<QString> const& directories);
-
+    void set_thread_count(int count);
+    void set_binary_policy(binary_policy policy);
+    void set_stats(std::shared_ptr<SearchStats> const& stats);
+    void set_cache(std::shared_ptr<QueryCache> const& cache);
+    void set_filter(std::shared_ptr<PathFilter const> const& filter);
+    std::vector<QString> const& get_patterns() const;
 
 public slots:
     void scan_directories();
 
 signals:
-    void new_match(QString const& file_name,
-                   std::list<int> const& coordinates,
-                   bool first_match);
+    void new_matches(std::shared_ptr<MatchBatch> const& batch);
     void new_error(QString const& file_name);
+    void skipped_binary(QString const& file_name);
     void progress(QString const& directory, double progress);
     void finished();
 
 private:
-    void scan_directory(QString const& directory_name);
-    bool substring_find(QString const& file_name, QString const& relative_path);
-
-    void directory_dfs(QString const& directory_name,
-                       std::function<bool(DirectoryScanner&, QString const&, QString const&)> process);
+    struct ScanTask {
+        QString directory;
+        QString file;
+        int64_t size;
+        bool indexed;
+        // byte ranges of a blocked file that may hold a match, the whole file if empty
+        std::vector<DirectoryIndex::BlockRange> ranges;
+        // a file with the content of original isn't read, it gets the matches found there
+        QString original = QString();
+        // the file is the original of others, its result is kept for them
+        bool linked = false;
+    };
+
+    // part of a mapped file to search, starting at a UTF-16 position and line
+    struct Span {
+        uint8_t const* begin;
+        uint8_t const* end;
+        int position;
+        int line;
+    };
+
+    // coordinates[i] are the positions of patterns[i], with ShowLine lines[i] where they are
+    struct ScanResult {
+        bool readable = false;
+        bool binary = false;
+        std::vector<std::vector<int>> coordinates;
+        std::vector<std::vector<LinePosition>> lines;
+        // only with stats: time the file took, split into phases by the coordinator
+        int64_t total_ns = 0;
+        int64_t io_ns = 0;
+        int64_t decode_ns = 0;
+    };
+
+    /*
+     * Files go from the thread listing them to the search workers through a
+     * bounded queue, numbered in the order they were listed. Listed bytes per
+     * directory, and whether its listing is complete, let progress be
+     * estimated before everything is listed. Copies of a file, known from
+     * the index or as hard links, are only searched once.
+     */
+    struct Pipeline {
+        explicit Pipeline(size_t capacity) : queue(capacity) {}
+
+        BoundedQueue<std::pair<size_t, ScanTask>> queue;
+        std::mutex mutex;
+        std::map<QString, std::pair<int64_t, bool>> directories;
+        // the first path listed of every file with several hard links
+        std::map<FileId, QString> links;
+        size_t listed = 0;
+        bool complete = false;
+    };
+
+    void scan();
+    bool scan_directory(QString const& directory_name, Pipeline& pipeline);
+    void list_directories(std::vector<QString> const& roots, Pipeline& pipeline);
+    bool enqueue(Pipeline& pipeline, ScanTask&& task) const;
+    void listed(Pipeline& pipeline, QString const& directory) const;
+    void search_files(Pipeline& pipeline, std::shared_ptr<QueryCache::Entry>& record);
+    void replay(QueryCache::Entry const& entry);
+    QString cache_scope() const;
+    QString cache_query() const;
+    ScanResult substring_find(ScanTask const& task) const;
+    uchar* map_utf8(QFile& file, uint8_t const*& begin, uint8_t const*& end) const;
+    std::vector<Span> spans(uchar const* data, uint8_t const* begin, uint8_t const* end,
+                            std::vector<DirectoryIndex::BlockRange> const& ranges) const;
+    bool find_bytes(QFile& file, ScanResult& result, std::vector<DirectoryIndex::BlockRange> const& ranges) const;
+    void find_text(QFile& file, ScanResult& result) const;
+    bool find_all_bytes(QFile& file, ScanResult& result,
+                        std::vector<DirectoryIndex::BlockRange> const& ranges) const;
+    void find_all_text(QFile& file, ScanResult& result) const;
+    void find_regex(QFile& file, ScanResult& result) const;
+    bool match_regex(QString const& text, ScanResult& result, bool locate, size_t& found, int from = 0,
+                     int limit = INT_MAX, bool cut = false, int position = 0, int line = 1) const;
+    void find_raw(QFile& file, ScanResult& result) const;
+    template <typename T>
+    bool record(ScanResult& result, uint32_t pattern, int position, size_t& found,
+                LineTracker<T>* lines, T const* match) const;
+    template <typename F>
+    auto decode(ScanResult& result, F const& read) const;
+    void account(ScanTask const& task, ScanResult const& result) const;
+    bool interrupted() const;
 
     std::list<QString> directories;
-    QFlags<QDirIterator::IteratorFlag> iterator_flags;
-    QFlags<QDir::Filter> directory_flags;
     std::map<parameters, bool> params;
 
+    // with IgnoreCase substring, needle and the automata are case-folded and so is the text they are searched in
+    bool ignore_case = false;
+    bool show_line = false;
     QString substring;
-    std::boyer_moore_horspool_searcher<QChar*, std::hash<QChar>, std::equal_to<void>>* preprocess = nullptr;
-    std::map<QString, std::map<QString, std::set<int64_t>>>* trigrams = nullptr;
+    std::unique_ptr<SubstringSearcher<uint16_t>> preprocess;
+
+    // UTF-8 form of substring, searched directly in mapped files
+    QByteArray needle;
+    std::unique_ptr<SubstringSearcher<uint8_t>> byte_preprocess;
+    bool byte_search = false;
+
+    // with several patterns all of them are found in one pass by an automaton
+    std::vector<QString> patterns;
+    std::unique_ptr<AhoCorasick<uint16_t>> automaton;
+    std::unique_ptr<AhoCorasick<uint8_t>> byte_automaton;
+    std::vector<int> pattern_bytes;
+
+    // a regular expression is matched by QRegularExpression, the query picks candidate files
+    std::unique_ptr<QRegularExpression> regex;
+    regex_query::Query regex_plan;
+
+    TrigramIndex* trigrams = nullptr;
+    QThread* owner = nullptr;
+    int threads = 0;
+    binary_policy binaries = SkipBinary;
+    std::shared_ptr<SearchStats> stats;
+    std::shared_ptr<QueryCache> cache;
+    std::shared_ptr<PathFilter const> filter;
 };
 
 #endif // DIRECTORYSCANNER_H
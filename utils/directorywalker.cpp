@@ -0,0 +1,207 @@
+#include "directorywalker.h"
+#include "workqueue.h"
+
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+
+DirectoryWalker::DirectoryWalker(std::map<parameters, bool> const& params, int threads)
+    : hidden(params.at(parameters::Hidden)),
+      recursive(params.at(parameters::Recursive)),
+      threads(threads) {}
+
+// nullptr turns collection off
+void DirectoryWalker::set_stats(SearchStats* stats) {
+    this->stats = stats;
+}
+
+// nullptr lists everything
+void DirectoryWalker::set_filter(std::shared_ptr<PathFilter const> const& filter) {
+    this->filter = filter;
+}
+
+/*
+ * Directories waiting to be read are kept on a stack, so the walk stays
+ * depth-first and the stack small. A root is done once the directories read
+ * or waiting under it drop to zero; a root the filter rejects is done at
+ * once.
+ */
+void DirectoryWalker::walk(std::vector<QString> const& roots, Found const& found, Done const& done,
+                           std::vector<QString> const& bases) {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Directory> waiting;
+    std::vector<int> starts(roots.size());
+    std::vector<size_t> remaining(roots.size(), 1);
+    size_t active = 0;
+    bool stopped = false;
+    for (size_t i = roots.size(); i-- > 0; ) {
+        QByteArray path = QFile::encodeName(roots[i]);
+        QByteArray base = bases.empty() ? path : QFile::encodeName(bases[i]);
+        starts[i] = PathFilter::relative_start(base);
+        std::shared_ptr<PathFilter::Scope const> scope;
+        if (filter != nullptr && !filter->reaches(base, path, true, 0, &scope)) {
+            remaining[i] = 0;
+            continue;
+        }
+        waiting.push_back({i, std::move(path), std::move(scope)});
+    }
+    for (size_t i = 0; i < roots.size(); ++i) {
+        if (remaining[i] == 0 && done) {
+            done(i);
+        }
+    }
+
+    auto work = [&] {
+        std::vector<Directory> subdirectories;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopped || !waiting.empty() || active == 0; });
+            if (stopped || waiting.empty()) {
+                break;
+            }
+            Directory directory = std::move(waiting.back());
+            waiting.pop_back();
+            size_t root = directory.root;
+            ++active;
+            lock.unlock();
+            subdirectories.clear();
+            bool more = list(directory, starts[root], subdirectories, found);
+            lock.lock();
+            --active;
+            for (auto& i: subdirectories) {
+                waiting.push_back(std::move(i));
+            }
+            remaining[root] += subdirectories.size();
+            if (--remaining[root] == 0 && done) {
+                done(root);
+            }
+            stopped |= !more;
+            wake.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < thread_count(threads); ++i) {
+        workers.emplace_back([&] {
+            ThreadClock clock(stats, ThreadClock::Step);
+            work();
+        });
+    }
+    work();
+    for (auto& i: workers) {
+        i.join();
+    }
+}
+
+// false once found asked to stop; time spent in found is not traversal
+bool DirectoryWalker::list(Directory const& current, int relative_start, std::vector<Directory>& subdirectories,
+                           Found const& found) const {
+    int64_t start = stats != nullptr ? monotonic_ns() : 0;
+    size_t root = current.root;
+    QByteArray const& path = current.path;
+    std::shared_ptr<PathFilter::Scope const> scope;
+    if (filter != nullptr) {
+        scope = filter->enter(current.scope, path, std::max(0, path.size() - relative_start));
+    }
+    auto admits = [&](QByteArray const& entry, bool is_directory, int64_t size) {
+        return filter == nullptr || filter->accepts(scope.get(), entry.constData() + relative_start,
+                                                    entry.constData() + entry.size(), is_directory, size);
+    };
+
+    int64_t handed = 0;
+    auto hand = [&](QString const& file_name, int64_t size, FileId const& id) {
+        if (stats == nullptr) {
+            return found(root, file_name, size, id);
+        }
+        int64_t before = monotonic_ns();
+        bool result = found(root, file_name, size, id);
+        handed += monotonic_ns() - before;
+        return result;
+    };
+
+    bool more = true;
+#ifdef Q_OS_UNIX
+    DIR* directory = opendir(path.constData());
+    if (directory == nullptr) {
+        return true;
+    }
+    int descriptor = dirfd(directory);
+    QByteArray prefix = path.endsWith('/') ? path : path + '/';
+    while (more) {
+        dirent* entry = readdir(directory);
+        if (entry == nullptr) {
+            break;
+        }
+        char const* name = entry->d_name;
+        if (name[0] == '.' && (!hidden || name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+            continue;
+        }
+        if (entry->d_type == DT_DIR) {
+            if (recursive) {
+                QByteArray subdirectory = prefix + name;
+                if (admits(subdirectory, true, 0)) {
+                    subdirectories.push_back({root, std::move(subdirectory), scope});
+                }
+            }
+            continue;
+        }
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        // a link is listed as what it points to, but a link to a directory isn't followed
+        struct stat info;
+        bool link = entry->d_type == DT_LNK;
+        if (fstatat(descriptor, name, &info, link ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        if (S_ISLNK(info.st_mode)) {
+            link = true;
+            if (fstatat(descriptor, name, &info, 0) != 0) {
+                continue;
+            }
+        }
+        QByteArray file_name = prefix + name;
+        if (S_ISDIR(info.st_mode)) {
+            if (recursive && !link && admits(file_name, true, 0)) {
+                subdirectories.push_back({root, std::move(file_name), scope});
+            }
+        } else if (S_ISREG(info.st_mode) && admits(file_name, false, info.st_size)) {
+            more = hand(QFile::decodeName(file_name), info.st_size,
+                        {uint64_t(info.st_dev), uint64_t(info.st_ino), uint64_t(info.st_nlink)});
+        }
+    }
+    closedir(directory);
+#else
+    QDir::Filters filters = QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot;
+    if (hidden) {
+        filters |= QDir::Hidden;
+    }
+    for (QFileInfo const& i: QDir(QFile::decodeName(path)).entryInfoList(filters, QDir::NoSort)) {
+        QByteArray file_name = QFile::encodeName(i.filePath());
+        if (i.isDir()) {
+            if (recursive && !i.isSymLink() && admits(file_name, true, 0)) {
+                subdirectories.push_back({root, std::move(file_name), scope});
+            }
+        } else if (admits(file_name, false, i.size()) && !(more = hand(i.filePath(), i.size(), FileId()))) {
+            break;
+        }
+    }
+#endif
+    if (stats != nullptr) {
+        stats->add(SearchStats::Traversal, monotonic_ns() - start - handed);
+    }
+    return more;
+}
@@ -0,0 +1,68 @@
+#ifndef DIRECTORYWALKER_H
+#define DIRECTORYWALKER_H
+
+#include "parameters.h"
+#include "searchstats.h"
+#include "pathfilter.h"
+#include "filestamp.h"
+
+#include <QString>
+#include <QByteArray>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+
+/*
+ * Lists the files under several roots with a pool of threads, the way
+ * QDirIterator with the Hidden and Recursive parameters would: regular files
+ * and links to them, no links to directories followed. Directories waiting
+ * to be read are shared, so a thread that is done with one takes the next,
+ * and every file is handed on as soon as it is read rather than after the
+ * whole tree. On Unix entries come from readdir, whose types spare a stat
+ * for everything but files and links.
+ *
+ * With a filter, entries it rejects are dropped as they are read, so a
+ * directory left out is never opened.
+ */
+class DirectoryWalker {
+public:
+    // found(root, path, size, id) is called from the walking threads
+    using Found = std::function<bool(size_t root, QString const& path, int64_t size, FileId const& id)>;
+    // done(root) once every file under roots[root] was found
+    using Done = std::function<void(size_t root)>;
+
+    DirectoryWalker(std::map<parameters, bool> const& params, int threads);
+
+    void set_stats(SearchStats* stats);
+    void set_filter(std::shared_ptr<PathFilter const> const& filter);
+
+    /*
+     * Blocks until the roots are listed or found returned false. Filters
+     * match paths relative to bases[root], a directory above roots[root] or
+     * the root itself, which it is when bases are left out.
+     */
+    void walk(std::vector<QString> const& roots, Found const& found, Done const& done = Done(),
+              std::vector<QString> const& bases = std::vector<QString>());
+
+private:
+    struct Directory {
+        size_t root;
+        QByteArray path;
+        std::shared_ptr<PathFilter::Scope const> scope;
+    };
+
+    bool list(Directory const& current, int relative_start, std::vector<Directory>& subdirectories,
+              Found const& found) const;
+
+    bool hidden;
+    bool recursive;
+    int threads;
+    SearchStats* stats = nullptr;
+    std::shared_ptr<PathFilter const> filter;
+};
+
+#endif // DIRECTORYWALKER_H
@@ -0,0 +1,129 @@
+#include "duplicatefinder.h"
+
+#include <QFile>
+
+#include <cstring>
+
+
+namespace {
+    const qint64 BUFFER_SIZE = 1 << 18;
+    const uint64_t MULTIPLIER = 0xff51afd7ed558ccdULL;
+
+    // words of 8 bytes each go through a multiply and a shift; a tail is padded with zeros and its length
+    uint64_t mix(uint64_t hash, char const* data, size_t size) {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * MULTIPLIER;
+            hash ^= hash >> 32;
+        }
+        if (i < size) {
+            uint64_t word = 0;
+            std::memcpy(&word, data + i, size - i);
+            hash = (hash ^ word ^ (uint64_t(size - i) << 56)) * MULTIPLIER;
+            hash ^= hash >> 32;
+        }
+        return hash;
+    }
+}
+
+/*
+ * Files are hashed and compared outside the lock, so two workers may hash
+ * the first file of a size at once; both get the same hash. Two copies
+ * compared at once may both be taken for originals, which only costs a
+ * search. Empty files aren't worth it, and some special files claim to be
+ * empty whatever they hold.
+ */
+QString DuplicateFinder::original(QString const& directory, QString const& file_name, uint64_t size) {
+    if (size == 0) {
+        return QString();
+    }
+    FileId id = file_id(file_name);
+    QString first;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Directory& files = directories[directory];
+        if (id.links > 1) {
+            auto link = files.links.emplace(id, file_name);
+            if (!link.second) {
+                return link.first->second;
+            }
+        }
+        std::vector<Candidate>& same = files.sizes[size];
+        if (same.empty()) {
+            same.push_back({file_name, 0, false, true});
+            return QString();
+        }
+        if (!same.front().hashed) {
+            first = same.front().name;
+        }
+    }
+
+    bool readable;
+    uint64_t hash = content_hash(file_name, readable);
+    if (!readable) {
+        return QString();
+    }
+    bool first_readable = false;
+    uint64_t first_hash = first.isEmpty() ? 0 : content_hash(first, first_readable);
+
+    std::vector<QString> matching;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Candidate>& same = directories[directory].sizes[size];
+        if (!first.isEmpty() && !same.front().hashed) {
+            same.front().hash = first_hash;
+            same.front().hashed = true;
+            same.front().readable = first_readable;
+        }
+        for (auto const& i: same) {
+            if (i.hashed && i.readable && i.hash == hash) {
+                matching.push_back(i.name);
+            }
+        }
+    }
+    for (auto const& i: matching) {
+        if (same_content(i, file_name)) {
+            return i;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    directories[directory].sizes[size].push_back({file_name, hash, true, true});
+    return QString();
+}
+
+uint64_t DuplicateFinder::content_hash(QString const& file_name, bool& ok) {
+    QFile file(file_name);
+    ok = file.open(QFile::ReadOnly);
+    if (!ok) {
+        return 0;
+    }
+    QByteArray buffer(BUFFER_SIZE, 0);
+    uint64_t hash = 0;
+    qint64 read;
+    while ((read = file.read(buffer.data(), BUFFER_SIZE)) > 0) {
+        hash = mix(hash, buffer.constData(), read);
+    }
+    ok = read == 0;
+    return hash;
+}
+
+bool DuplicateFinder::same_content(QString const& first, QString const& second) {
+    QFile left(first);
+    QFile right(second);
+    if (!left.open(QFile::ReadOnly) || !right.open(QFile::ReadOnly)) {
+        return false;
+    }
+    QByteArray left_buffer(BUFFER_SIZE, 0);
+    QByteArray right_buffer(BUFFER_SIZE, 0);
+    qint64 read;
+    while ((read = left.read(left_buffer.data(), BUFFER_SIZE)) > 0) {
+        if (right.read(right_buffer.data(), read) != read ||
+                std::memcmp(left_buffer.constData(), right_buffer.constData(), read) != 0) {
+            return false;
+        }
+    }
+    return read == 0 && right.atEnd();
+}
@@ -0,0 +1,53 @@
+#ifndef DUPLICATEFINDER_H
+#define DUPLICATEFINDER_H
+
+#include "filestamp.h"
+
+#include <QString>
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+
+/*
+ * Tells the workers of an index build which files have the content of a file
+ * read before in this build under the same directory; files kept from the
+ * previous index and those of other directories aren't looked at. Hard
+ * links are known by their id alone. Other files are only read for a hash
+ * once a second file of their size turns up, so a file whose size no other
+ * file has costs a stat and nothing more. A file whose size and 64-bit hash
+ * match those of one seen before is compared with it byte by byte, a hash
+ * alone isn't taken for equal content. Shared by the workers, which ask
+ * from their own threads.
+ */
+class DuplicateFinder {
+public:
+    // the file seen first with the same content, an empty string if this is it
+    QString original(QString const& directory, QString const& file_name, uint64_t size);
+
+    // false in ok if the file couldn't be read whole
+    static uint64_t content_hash(QString const& file_name, bool& ok);
+    // false if either couldn't be read whole
+    static bool same_content(QString const& first, QString const& second);
+
+private:
+    struct Candidate {
+        QString name;
+        uint64_t hash;
+        // the first file of a size isn't hashed until another one comes
+        bool hashed;
+        bool readable;
+    };
+
+    struct Directory {
+        std::map<FileId, QString> links;
+        std::map<uint64_t, std::vector<Candidate>> sizes;
+    };
+
+    std::mutex mutex;
+    std::map<QString, Directory> directories;
+};
+
+#endif // DUPLICATEFINDER_H
@@ -0,0 +1,52 @@
+# GUI-free search engine, shared by the GUI and the command-line tool
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/ahocorasick.cpp \
+    $$PWD/binaryfile.cpp \
+    $$PWD/bloomfilter.cpp \
+    $$PWD/directoryscanner.cpp \
+    $$PWD/directorywalker.cpp \
+    $$PWD/duplicatefinder.cpp \
+    $$PWD/filestamp.cpp \
+    $$PWD/indexfile.cpp \
+    $$PWD/indexwatcher.cpp \
+    $$PWD/matchmodel.cpp \
+    $$PWD/pathfilter.cpp \
+    $$PWD/postinglist.cpp \
+    $$PWD/qcharhash.cpp \
+    $$PWD/querycache.cpp \
+    $$PWD/regexquery.cpp \
+    $$PWD/searchengine.cpp \
+    $$PWD/searchstats.cpp \
+    $$PWD/substringsearch.cpp \
+    $$PWD/trigramindex.cpp \
+    $$PWD/trigrammanager.cpp \
+    $$PWD/trigramworker.cpp
+
+HEADERS += \
+    $$PWD/ahocorasick.h \
+    $$PWD/binaryfile.h \
+    $$PWD/bloomfilter.h \
+    $$PWD/casefold.h \
+    $$PWD/directoryscanner.h \
+    $$PWD/directorywalker.h \
+    $$PWD/duplicatefinder.h \
+    $$PWD/filestamp.h \
+    $$PWD/indexfile.h \
+    $$PWD/indexwatcher.h \
+    $$PWD/linetracker.h \
+    $$PWD/matchmodel.h \
+    $$PWD/parameters.h \
+    $$PWD/pathfilter.h \
+    $$PWD/postinglist.h \
+    $$PWD/querycache.h \
+    $$PWD/regexquery.h \
+    $$PWD/searchengine.h \
+    $$PWD/searchstats.h \
+    $$PWD/substringsearch.h \
+    $$PWD/trigramindex.h \
+    $$PWD/trigrammanager.h \
+    $$PWD/trigramworker.h \
+    $$PWD/workqueue.h
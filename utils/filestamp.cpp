@@ -0,0 +1,46 @@
+#include "filestamp.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+
+FileStamp file_stamp(QString const& file_name) {
+    FileStamp result;
+#ifdef Q_OS_UNIX
+    struct stat info;
+    if (stat(QFile::encodeName(file_name).constData(), &info) == 0) {
+        result.size = info.st_size;
+#ifdef Q_OS_LINUX
+        result.modified = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#else
+        result.modified = (int64_t) info.st_mtime * 1000000000;
+#endif
+        result.inode = info.st_ino;
+    }
+#else
+    QFileInfo info(file_name);
+    result.size = info.size();
+    result.modified = info.lastModified().toMSecsSinceEpoch() * 1000000;
+#endif
+    return result;
+}
+
+FileId file_id(QString const& file_name) {
+    FileId result;
+#ifdef Q_OS_UNIX
+    struct stat info;
+    if (stat(QFile::encodeName(file_name).constData(), &info) == 0) {
+        result.device = info.st_dev;
+        result.inode = info.st_ino;
+        result.links = info.st_nlink;
+    }
+#else
+    Q_UNUSED(file_name);
+#endif
+    return result;
+}
@@ -0,0 +1,41 @@
+#ifndef FILESTAMP_H
+#define FILESTAMP_H
+
+#include <QString>
+
+#include <cstdint>
+
+
+// what an index remembers about a file to notice that it has changed
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t modified = 0;
+    uint64_t inode = 0;
+
+    bool operator==(FileStamp const& other) const {
+        return size == other.size && modified == other.modified && inode == other.inode;
+    }
+    bool operator!=(FileStamp const& other) const {
+        return !(*this == other);
+    }
+};
+
+FileStamp file_stamp(QString const& file_name);
+
+
+// a file as the file system knows it: hard links to one file have the same id
+struct FileId {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    // 0 where links aren't counted
+    uint64_t links = 0;
+
+    bool operator<(FileId const& other) const {
+        return device != other.device ? device < other.device : inode < other.inode;
+    }
+};
+
+// links is 0 if the file can't be stat'ed, or on systems without inodes
+FileId file_id(QString const& file_name);
+
+#endif // FILESTAMP_H
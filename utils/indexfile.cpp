@@ -0,0 +1,271 @@
+#include "indexfile.h"
+#include "postinglist.h"
+
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDir>
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+    const uint32_t MAGIC = 'S' | 'F' << 8 | 'T' << 16 | 'I' << 24;
+    const uint32_t HIDDEN = 1;
+    const uint32_t RECURSIVE = 2;
+    const uint32_t BYTE_INDEX = 4;
+    const size_t ALIGNMENT = 8;
+
+    uint32_t flags(std::map<parameters, bool> const& params) {
+        return (params.at(parameters::Hidden) ? HIDDEN : 0) |
+               (params.at(parameters::Recursive) ? RECURSIVE : 0);
+    }
+
+    class Writer {
+    public:
+        explicit Writer(QSaveFile& file) : file(file) {}
+
+        template <typename T>
+        void value(T value) {
+            write(&value, sizeof(T));
+        }
+
+        template <typename T>
+        void array(array_view<T> const& view) {
+            write(view.data, view.size * sizeof(T));
+            static const char zeros[ALIGNMENT] = {};
+            write(zeros, (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT);
+        }
+
+        bool ok() const { return !failed; }
+
+    private:
+        void write(void const* data, size_t size) {
+            if (size > 0 && file.write(static_cast<char const*>(data), size) != (qint64) size) {
+                failed = true;
+            }
+            position += size;
+        }
+
+        QSaveFile& file;
+        size_t position = 0;
+        bool failed = false;
+    };
+
+    class Reader {
+    public:
+        Reader(uint8_t const* data, size_t size) : data(data), size(size) {}
+
+        template <typename T>
+        T value() {
+            T result{};
+            if (check(sizeof(T))) {
+                std::memcpy(&result, data + position, sizeof(T));
+                position += sizeof(T);
+            }
+            return result;
+        }
+
+        template <typename T>
+        array_view<T> array(uint64_t count) {
+            if (count > size / sizeof(T) || !check(count * sizeof(T))) {
+                failed = true;
+                return {};
+            }
+            array_view<T> result(reinterpret_cast<T const*>(data + position), count);
+            position += count * sizeof(T);
+            position += (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT;
+            return result;
+        }
+
+        bool ok() const { return !failed; }
+
+    private:
+        bool check(size_t bytes) {
+            failed |= position > size || bytes > size - position;
+            return !failed;
+        }
+
+        uint8_t const* data;
+        size_t size;
+        size_t position = 0;
+        bool failed = false;
+    };
+
+    void set_error(QString* error, QString const& message) {
+        if (error != nullptr) {
+            *error = message;
+        }
+    }
+}
+
+QString index_file::default_path() {
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QDir().mkpath(directory);
+    return directory + "/trigrams.index";
+}
+
+bool index_file::save(TrigramIndex const& index, QString const& path, QString* error) {
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly)) {
+        set_error(error, file.errorString());
+        return false;
+    }
+
+    Writer writer(file);
+    writer.value<uint32_t>(MAGIC);
+    writer.value<uint32_t>(VERSION);
+    writer.value<uint32_t>(flags(index.params) | (index.kind() == ByteTrigrams ? BYTE_INDEX : 0));
+    writer.value<uint32_t>(index.directories.size());
+    for (auto const& i: index.directories) {
+        DirectoryIndex const& directory = i.second;
+        writer.value<uint64_t>(i.first.size());
+        writer.array(array_view<ushort>(i.first.utf16(), i.first.size()));
+        writer.value<uint64_t>(directory.file_count());
+        writer.value<uint64_t>(directory.names.size);
+        writer.value<uint64_t>(directory.unindexed.size);
+        writer.value<uint64_t>(directory.binaries.size);
+        writer.value<uint64_t>(directory.keys.size);
+        writer.value<uint64_t>(directory.postings.size);
+        writer.value<uint64_t>(directory.blocked.size);
+        writer.value<uint64_t>(directory.block_ends.size);
+        writer.value<uint64_t>(directory.blooms.size);
+        writer.value<uint64_t>(directory.copies.size);
+        writer.array(directory.name_offsets);
+        writer.array(directory.names);
+        writer.array(directory.stamps);
+        writer.array(directory.unindexed);
+        writer.array(directory.binaries);
+        writer.array(directory.keys);
+        writer.array(directory.posting_offsets);
+        writer.array(directory.postings);
+        writer.array(directory.blocked);
+        writer.array(directory.block_offsets);
+        writer.array(directory.block_ends);
+        writer.array(directory.bloom_offsets);
+        writer.array(directory.blooms);
+        writer.array(directory.copies);
+        writer.array(directory.originals);
+    }
+
+    if (!writer.ok() || !file.commit()) {
+        set_error(error, file.errorString());
+        return false;
+    }
+    return true;
+}
+
+TrigramIndex* index_file::load(std::map<parameters, bool> const& params,
+                               QString const& path, QString* error) {
+    auto file = std::make_shared<QFile>(path);
+    if (!file->open(QFile::ReadOnly)) {
+        set_error(error, file->errorString());
+        return nullptr;
+    }
+    uint8_t const* data = file->map(0, file->size());
+    if (data == nullptr) {
+        set_error(error, file->errorString());
+        return nullptr;
+    }
+
+    Reader reader(data, file->size());
+    uint32_t magic = reader.value<uint32_t>();
+    uint32_t version = reader.value<uint32_t>();
+    uint32_t index_flags = reader.value<uint32_t>();
+    uint32_t directory_count = reader.value<uint32_t>();
+    if (!reader.ok() || magic != MAGIC) {
+        set_error(error, "not a trigram index");
+        return nullptr;
+    }
+    if (version != VERSION) {
+        set_error(error, QString("unsupported index version %1").arg(version));
+        return nullptr;
+    }
+    if ((index_flags & ~BYTE_INDEX) != flags(params)) {
+        set_error(error, "index was built with different Hidden/Recursive parameters");
+        return nullptr;
+    }
+
+    TrigramIndex* index = new TrigramIndex();
+    index->params = params;
+    index->params[parameters::ByteIndex] = (index_flags & BYTE_INDEX) != 0;
+    index->mapping = file;
+    for (uint32_t i = 0; i < directory_count && reader.ok(); ++i) {
+        uint64_t path_length = reader.value<uint64_t>();
+        array_view<ushort> directory_path = reader.array<ushort>(path_length);
+        uint64_t file_count = reader.value<uint64_t>();
+        uint64_t names_length = reader.value<uint64_t>();
+        uint64_t unindexed_count = reader.value<uint64_t>();
+        uint64_t binary_count = reader.value<uint64_t>();
+        uint64_t key_count = reader.value<uint64_t>();
+        uint64_t postings_size = reader.value<uint64_t>();
+        uint64_t blocked_count = reader.value<uint64_t>();
+        uint64_t block_count = reader.value<uint64_t>();
+        uint64_t blooms_size = reader.value<uint64_t>();
+        uint64_t copy_count = reader.value<uint64_t>();
+        if (file_count > UINT32_MAX || key_count > UINT32_MAX || blocked_count > file_count ||
+                copy_count > file_count) {
+            break;
+        }
+
+        DirectoryIndex directory;
+        directory.name_offsets = reader.array<uint64_t>(file_count + 1);
+        directory.names = reader.array<ushort>(names_length);
+        directory.stamps = reader.array<FileStamp>(file_count);
+        directory.unindexed = reader.array<uint32_t>(unindexed_count);
+        directory.binaries = reader.array<uint32_t>(binary_count);
+        directory.keys = reader.array<int64_t>(key_count);
+        directory.posting_offsets = reader.array<uint64_t>(key_count + 1);
+        directory.postings = reader.array<uint8_t>(postings_size);
+        directory.blocked = reader.array<uint32_t>(blocked_count);
+        directory.block_offsets = reader.array<uint64_t>(blocked_count + 1);
+        directory.block_ends = reader.array<DirectoryIndex::BlockEnd>(block_count);
+        directory.bloom_offsets = reader.array<uint64_t>(block_count + 1);
+        directory.blooms = reader.array<uint64_t>(blooms_size);
+        directory.copies = reader.array<uint32_t>(copy_count);
+        directory.originals = reader.array<uint32_t>(copy_count);
+        if (!reader.ok()) {
+            break;
+        }
+        // every offset and id is used to index another array, so none may point past it, and
+        // the lists searched by bisection have to be sorted
+        auto outside = [file_count](uint32_t i) { return i >= file_count; };
+        auto bounded = [&](array_view<uint32_t> const& ids) {
+            return std::none_of(ids.begin(), ids.end(), outside);
+        };
+        auto sorted = [&](array_view<uint32_t> const& ids) {
+            return bounded(ids) && std::is_sorted(ids.begin(), ids.end());
+        };
+        auto monotone = [](array_view<uint64_t> const& offsets, uint64_t end) {
+            return std::is_sorted(offsets.begin(), offsets.end()) && offsets[offsets.size - 1] == end;
+        };
+        if (!monotone(directory.name_offsets, names_length) ||
+                !monotone(directory.posting_offsets, postings_size) ||
+                !monotone(directory.block_offsets, block_count) ||
+                !monotone(directory.bloom_offsets, blooms_size) ||
+                !sorted(directory.unindexed) || !sorted(directory.binaries) || !sorted(directory.blocked) ||
+                !sorted(directory.copies) || !bounded(directory.originals) ||
+                !std::is_sorted(directory.keys.begin(), directory.keys.end())) {
+            break;
+        }
+        // posting lists are read by cursors that don't look for their end
+        bool postings_valid = true;
+        for (uint64_t k = 0; postings_valid && k < key_count; ++k) {
+            postings_valid = posting_list::well_formed(directory.postings.data + directory.posting_offsets[k],
+                                                       directory.postings.data + directory.posting_offsets[k + 1],
+                                                       file_count);
+        }
+        if (!postings_valid) {
+            break;
+        }
+        QString name(reinterpret_cast<QChar const*>(directory_path.data), path_length);
+        index->directories[name] = std::move(directory);
+    }
+
+    if (!reader.ok() || index->directories.size() != directory_count) {
+        set_error(error, "index file is truncated or corrupted");
+        delete index;
+        return nullptr;
+    }
+    return index;
+}
@@ -0,0 +1,45 @@
+#ifndef INDEXFILE_H
+#define INDEXFILE_H
+
+#include "trigramindex.h"
+
+#include <QString>
+
+#include <map>
+
+
+/*
+ * Versioned on-disk form of TrigramIndex. Every array is stored 8-byte
+ * aligned in host byte order, so a loaded index is a set of views into the
+ * mapped file and nothing is deserialized.
+ *
+ * header    := "SFTI" version:u32 flags:u32 directory_count:u32 directory*
+ * directory := path_length:u64 path:u16[] file_count:u64 names_length:u64
+ *              unindexed_count:u64 binary_count:u64 key_count:u64 postings_size:u64
+ *              blocked_count:u64 block_count:u64 blooms_size:u64
+ *              copy_count:u64
+ *              name_offsets:u64[file_count + 1] names:u16[]
+ *              stamps:FileStamp[file_count] unindexed:u32[] binaries:u32[]
+ *              keys:i64[] posting_offsets:u64[key_count + 1] postings:u8[]
+ *              blocked:u32[] block_offsets:u64[blocked_count + 1]
+ *              block_ends:BlockEnd[block_count]
+ *              bloom_offsets:u64[block_count + 1] blooms:u64[]
+ *              copies:u32[copy_count] originals:u32[copy_count]
+ *
+ * flags record the Hidden and Recursive parameters the index was built with;
+ * load() rejects an index whose flags differ from the requested parameters.
+ * A third flag marks an index of byte trigrams, which is loaded as such
+ * whatever the ByteIndex parameter asks for. Queries trust what they read,
+ * so load() also reads every posting list through once and checks that
+ * offsets and ids stay within their arrays and that sorted lists are.
+ */
+namespace index_file {
+    const uint32_t VERSION = 6;
+
+    QString default_path();
+    bool save(TrigramIndex const& index, QString const& path, QString* error = nullptr);
+    TrigramIndex* load(std::map<parameters, bool> const& params,
+                       QString const& path, QString* error = nullptr);
+}
+
+#endif // INDEXFILE_H
@@ -0,0 +1,180 @@
+#include "indexwatcher.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+
+namespace {
+#ifdef Q_OS_LINUX
+    const uint32_t EVENTS = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+}
+
+IndexWatcher::IndexWatcher(std::set<QString> const& directories, std::map<parameters, bool> const& params)
+    : directories(directories),
+      params(params) {
+
+    qRegisterMetaType<std::map<QString, std::set<QString>>>("std::map<QString, std::set<QString>>");
+}
+
+IndexWatcher::~IndexWatcher() {
+#ifdef Q_OS_LINUX
+    if (descriptor >= 0) {
+        close(descriptor);
+    }
+#endif
+}
+
+// runs in the watcher's own thread, so the notifier and timers live there
+void IndexWatcher::watch_directories() {
+#ifdef Q_OS_LINUX
+    descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (descriptor < 0) {
+        emit throw_error("Live index unavailable: inotify_init1 failed");
+        return;
+    }
+
+    quiet = new QTimer(this);
+    quiet->setSingleShot(true);
+    deadline = new QTimer(this);
+    deadline->setSingleShot(true);
+    connect(quiet, &QTimer::timeout, this, &IndexWatcher::flush);
+    connect(deadline, &QTimer::timeout, this, &IndexWatcher::flush);
+
+    for (auto const& i: directories) {
+        watch(i, i);
+    }
+
+    notifier = new QSocketNotifier(descriptor, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &IndexWatcher::read_events);
+#endif
+}
+
+void IndexWatcher::watch(QString const& root, QString const& path) {
+#ifdef Q_OS_LINUX
+    int wd = inotify_add_watch(descriptor, QFile::encodeName(path).constData(), EVENTS);
+    if (wd < 0) {
+        if (errno == ENOSPC && !limit_reported) {
+            limit_reported = true;
+            emit throw_error("Live index: inotify watch limit reached, "
+                             "raise fs.inotify.max_user_watches");
+        }
+        return;
+    }
+    watches.insert(wd, {root, path});
+
+    if (!params.at(parameters::Recursive)) {
+        return;
+    }
+    QFlags<QDir::Filter> filter = {QDir::Dirs, QDir::NoDotAndDotDot, QDir::NoSymLinks};
+    if (params.at(parameters::Hidden)) {
+        filter |= QDir::Hidden;
+    }
+    for (QDirIterator it(path, filter); it.hasNext(); ) {
+        watch(root, it.next());
+    }
+#else
+    Q_UNUSED(root);
+    Q_UNUSED(path);
+#endif
+}
+
+void IndexWatcher::read_events() {
+#ifdef Q_OS_LINUX
+    alignas(inotify_event) char buffer[1 << 16];
+    for (;;) {
+        ssize_t length = read(descriptor, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;
+        }
+        for (char* position = buffer; position < buffer + length; ) {
+            inotify_event const* event = reinterpret_cast<inotify_event const*>(position);
+            position += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                for (auto const& i: directories) {
+                    refresh(i);
+                }
+                continue;
+            }
+            if (!watches.contains(event->wd)) {
+                continue;
+            }
+            QString root = watches[event->wd].first;
+            QString directory = watches[event->wd].second;
+            if (event->mask & IN_IGNORED) {
+                watches.remove(event->wd);
+                continue;
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                if (directory == root) {
+                    refresh(root);
+                } else {
+                    record(root, directory);
+                }
+                continue;
+            }
+            if (event->len == 0) {
+                continue;
+            }
+
+            QString path = directory + '/' + QFile::decodeName(event->name);
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                if (params.at(parameters::Recursive) &&
+                        (params.at(parameters::Hidden) || event->name[0] != '.')) {
+                    watch(root, path);
+                }
+            }
+            record(root, path);
+        }
+    }
+#endif
+}
+
+void IndexWatcher::record(QString const& root, QString const& path) {
+    if (refreshed.count(root) > 0) {
+        schedule();
+        return;
+    }
+    std::set<QString>& paths = pending[root];
+    paths.insert(path);
+    if (paths.size() > STORM_LIMIT) {
+        refresh(root);
+        return;
+    }
+    schedule();
+}
+
+void IndexWatcher::refresh(QString const& root) {
+    refreshed.insert(root);
+    pending[root].clear();
+    schedule();
+}
+
+// every event postpones the batch by QUIET_PERIOD, but no more than MAXIMUM_DELAY in total
+void IndexWatcher::schedule() {
+    quiet->start(QUIET_PERIOD);
+    if (!deadline->isActive()) {
+        deadline->start(MAXIMUM_DELAY);
+    }
+}
+
+void IndexWatcher::flush() {
+    quiet->stop();
+    deadline->stop();
+    if (pending.empty()) {
+        return;
+    }
+    std::map<QString, std::set<QString>> batch;
+    batch.swap(pending);
+    refreshed.clear();
+    emit changed(batch);
+}
@@ -0,0 +1,69 @@
+#ifndef INDEXWATCHER_H
+#define INDEXWATCHER_H
+
+#include "parameters.h"
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QTimer>
+#include <QSocketNotifier>
+
+#include <map>
+#include <set>
+#include <utility>
+
+
+/*
+ * Watches indexed directories through inotify and reports changed paths per
+ * root directory. Events are coalesced: a batch is emitted once the tree has
+ * been quiet for QUIET_PERIOD ms, or after MAXIMUM_DELAY ms of continuous
+ * activity. A root with more than STORM_LIMIT changed paths in one batch
+ * (or after an event queue overflow) is reported with an empty set, meaning
+ * "refresh the whole directory", which TrigramManager handles by comparing
+ * stamps instead of re-reading every touched path.
+ * Does nothing on platforms without inotify.
+ */
+class IndexWatcher : public QObject {
+    Q_OBJECT
+
+public:
+    static const int QUIET_PERIOD = 500;
+    static const int MAXIMUM_DELAY = 5000;
+    static const size_t STORM_LIMIT = 10000;
+
+    IndexWatcher(std::set<QString> const& directories, std::map<parameters, bool> const& params);
+    ~IndexWatcher();
+
+signals:
+    void changed(std::map<QString, std::set<QString>> const& paths);
+    void throw_error(QString const& message);
+
+public slots:
+    void watch_directories();
+
+private slots:
+    void read_events();
+    void flush();
+
+private:
+    void watch(QString const& root, QString const& path);
+    void record(QString const& root, QString const& path);
+    void refresh(QString const& root);
+    void schedule();
+
+    std::set<QString> directories;
+    std::map<parameters, bool> params;
+
+    int descriptor = -1;
+    QSocketNotifier* notifier = nullptr;
+    QHash<int, std::pair<QString, QString>> watches;
+    bool limit_reported = false;
+
+    std::map<QString, std::set<QString>> pending;
+    std::set<QString> refreshed;
+    QTimer* quiet = nullptr;
+    QTimer* deadline = nullptr;
+};
+
+#endif // INDEXWATCHER_H
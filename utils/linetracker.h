@@ -0,0 +1,120 @@
+#ifndef LINETRACKER_H
+#define LINETRACKER_H
+
+#include <QString>
+#include <QChar>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <cstdint>
+
+
+// lines and columns count from 1, columns in UTF-16 code units
+struct LinePosition {
+    int line = 0;
+    int column = 0;
+    QString snippet;
+};
+
+// UTF-16 code units decoded from the UTF-8 bytes [begin, end)
+inline int utf16_length(uint8_t const* begin, uint8_t const* end) {
+    int result = 0;
+    for (; begin != end; ++begin) {
+        result += (*begin & 0xc0) != 0x80;
+        result += *begin >= 0xf0;
+    }
+    return result;
+}
+
+inline int utf16_length(ushort const* begin, ushort const* end) {
+    return end - begin;
+}
+
+inline QString decode(uint8_t const* begin, uint8_t const* end) {
+    return QString::fromUtf8(reinterpret_cast<char const*>(begin), end - begin);
+}
+
+inline QString decode(ushort const* begin, ushort const* end) {
+    return QString(reinterpret_cast<QChar const*>(begin), end - begin);
+}
+
+// the first newline in [begin, end), end if there is none
+inline uint8_t const* find_newline(uint8_t const* begin, uint8_t const* end) {
+    void const* found = std::memchr(begin, '\n', end - begin);
+    return found != nullptr ? static_cast<uint8_t const*>(found) : end;
+}
+
+inline ushort const* find_newline(ushort const* begin, ushort const* end) {
+    return std::find(begin, end, ushort('\n'));
+}
+
+// whether a snippet may start or end before c without cutting a character in two
+inline bool boundary(uint8_t c) {
+    return (c & 0xc0) != 0x80;
+}
+
+inline bool boundary(ushort c) {
+    return c < 0xdc00 || c >= 0xe000;
+}
+
+
+/*
+ * Locates matches in a buffer of UTF-8 bytes or UTF-16 code units during the
+ * scan. The scan already knows the UTF-16 position of every match, so only
+ * newlines between one match and the next have to be found (memchr for
+ * bytes), and the column is the distance to the position where the line
+ * starts. Matches found front to back cost a single pass over the text; a
+ * match before the previous one (several patterns) recounts only the gap.
+ */
+template <typename T>
+class LineTracker {
+public:
+    static constexpr int SNIPPET = 160;
+
+    // begin has to start a line, the given one at the given UTF-16 position
+    LineTracker(T const* begin, T const* end, int line = 1, int position = 0)
+        : begin(begin), end(end), last(begin), line_start(begin), line_start_position(position), line(line) {}
+
+    // position is the UTF-16 position of match
+    LinePosition locate(T const* match, int position) {
+        if (match >= last) {
+            for (T const* it = find_newline(last, match); it != match; it = find_newline(it + 1, match)) {
+                ++line;
+                line_start = it + 1;
+            }
+        } else {
+            line -= std::count(match, last, T('\n'));
+            line_start = std::find(std::make_reverse_iterator(match), std::make_reverse_iterator(begin), T('\n')).base();
+        }
+        if (line_start > last || match < last) {
+            line_start_position = position - utf16_length(line_start, match);
+        }
+        last = match;
+        return {line, position - line_start_position + 1, snippet(match)};
+    }
+
+private:
+    // the line around the match, at most SNIPPET units of it
+    QString snippet(T const* match) const {
+        T const* first = match - line_start > SNIPPET / 2 ? match - SNIPPET / 2 : line_start;
+        T const* limit = end - match > SNIPPET / 2 ? match + SNIPPET / 2 : end;
+        T const* stop = find_newline(match, limit);
+        while (first != line_start && !boundary(*first)) {
+            ++first;
+        }
+        while (stop != end && stop != match && !boundary(*stop)) {
+            --stop;
+        }
+        return decode(first, stop).trimmed();
+    }
+
+    T const* begin;
+    T const* end;
+    T const* last;
+    T const* line_start;
+    int line_start_position = 0;
+    int line = 1;
+};
+
+#endif // LINETRACKER_H
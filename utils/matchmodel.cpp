@@ -0,0 +1,159 @@
+#include "matchmodel.h"
+
+#include <algorithm>
+
+
+void MatchBatch::add(QString const& file, uint32_t pattern, std::vector<int> const& positions,
+                     std::vector<LinePosition> const& line_positions) {
+    files.push_back(file);
+    pattern_ids.push_back(pattern);
+    coordinates.insert(coordinates.end(), positions.begin(), positions.end());
+    lines.insert(lines.end(), line_positions.begin(), line_positions.end());
+    offsets.push_back(coordinates.size());
+}
+
+void MatchBatch::append(MatchBatch const& other) {
+    uint64_t shift = coordinates.size();
+    files.insert(files.end(), other.files.begin(), other.files.end());
+    pattern_ids.insert(pattern_ids.end(), other.pattern_ids.begin(), other.pattern_ids.end());
+    coordinates.insert(coordinates.end(), other.coordinates.begin(), other.coordinates.end());
+    lines.insert(lines.end(), other.lines.begin(), other.lines.end());
+    for (size_t i = 1; i < other.offsets.size(); ++i) {
+        offsets.push_back(other.offsets[i] + shift);
+    }
+}
+
+void MatchBatch::clear() {
+    files.clear();
+    pattern_ids.clear();
+    offsets = {0};
+    coordinates.clear();
+    lines.clear();
+}
+
+MatchModel::MatchModel(QObject* parent) : QAbstractItemModel(parent) {}
+
+void MatchModel::reset(std::vector<QString> const& patterns, bool show_patterns, bool first_match) {
+    beginResetModel();
+    matches = MatchBatch();
+    fetched.clear();
+    this->patterns = patterns;
+    this->show_patterns = show_patterns;
+    this->first_match = first_match;
+    endResetModel();
+}
+
+void MatchModel::append(MatchBatch const& batch) {
+    if (batch.size() == 0) {
+        return;
+    }
+    int first = matches.size();
+    beginInsertRows(QModelIndex(), first, first + batch.size() - 1);
+    matches.append(batch);
+    fetched.resize(matches.size(), 0);
+    endInsertRows();
+}
+
+size_t MatchModel::file_count() const {
+    return matches.size();
+}
+
+size_t MatchModel::match_count() const {
+    return matches.coordinates.size();
+}
+
+// internal id 0 is a file, file + 1 a coordinate of that file
+bool MatchModel::is_file(QModelIndex const& index) const {
+    return index.isValid() && index.internalId() == 0;
+}
+
+int MatchModel::coordinate_count(int file) const {
+    return matches.offsets[file + 1] - matches.offsets[file];
+}
+
+QModelIndex MatchModel::index(int row, int column, QModelIndex const& parent) const {
+    if (row < 0 || column != 0) {
+        return QModelIndex();
+    }
+    if (!parent.isValid()) {
+        return size_t(row) < matches.size() ? createIndex(row, column, quintptr(0)) : QModelIndex();
+    }
+    if (is_file(parent) && row < fetched[parent.row()]) {
+        return createIndex(row, column, quintptr(parent.row() + 1));
+    }
+    return QModelIndex();
+}
+
+QModelIndex MatchModel::parent(QModelIndex const& child) const {
+    if (!child.isValid() || is_file(child)) {
+        return QModelIndex();
+    }
+    return createIndex(child.internalId() - 1, 0, quintptr(0));
+}
+
+int MatchModel::rowCount(QModelIndex const& parent) const {
+    if (!parent.isValid()) {
+        return matches.size();
+    }
+    return is_file(parent) ? fetched[parent.row()] : 0;
+}
+
+int MatchModel::columnCount(QModelIndex const&) const {
+    return 1;
+}
+
+bool MatchModel::hasChildren(QModelIndex const& parent) const {
+    if (!parent.isValid()) {
+        return matches.size() != 0;
+    }
+    return is_file(parent) && !first_match && coordinate_count(parent.row()) > 0;
+}
+
+bool MatchModel::canFetchMore(QModelIndex const& parent) const {
+    return is_file(parent) && !first_match && fetched[parent.row()] < coordinate_count(parent.row());
+}
+
+void MatchModel::fetchMore(QModelIndex const& parent) {
+    if (!canFetchMore(parent)) {
+        return;
+    }
+    int file = parent.row();
+    int more = std::min(FETCH_SIZE, coordinate_count(file) - fetched[file]);
+    beginInsertRows(parent, fetched[file], fetched[file] + more - 1);
+    fetched[file] += more;
+    endInsertRows();
+}
+
+QVariant MatchModel::data(QModelIndex const& index, int role) const {
+    if (!index.isValid() || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    if (is_file(index)) {
+        int file = index.row();
+        QString title = matches.files[file];
+        if (show_patterns) {
+            title += " [" + patterns[matches.pattern_ids[file]] + "]";
+        }
+        return title + ": " + QString::number(coordinate_count(file));
+    }
+    int file = index.internalId() - 1;
+    size_t match = matches.offsets[file] + index.row();
+    if (matches.lines.empty() || matches.lines[match].line == 0) {
+        return QString::number(matches.coordinates[match]);
+    }
+    LinePosition const& line = matches.lines[match];
+    return QString::number(line.line) + ":" + QString::number(line.column) + ": " + line.snippet;
+}
+
+QVariant MatchModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (section != 0 || orientation != Qt::Horizontal) {
+        return QVariant();
+    }
+    if (role == Qt::DisplayRole) {
+        return QString("Found Matches");
+    }
+    if (role == Qt::TextAlignmentRole) {
+        return int(Qt::AlignCenter);
+    }
+    return QVariant();
+}
@@ -0,0 +1,75 @@
+#ifndef MATCHMODEL_H
+#define MATCHMODEL_H
+
+#include <QAbstractItemModel>
+#include <QString>
+#include <QVariant>
+
+#include "linetracker.h"
+
+#include <vector>
+#include <cstdint>
+
+
+/*
+ * Matches of many files in flat arrays, the unit in which results travel
+ * from the scanner to the GUI: file i matched patterns[pattern_ids[i]] at
+ * coordinates[offsets[i]..offsets[i + 1]). With ShowLine lines holds the
+ * line of every coordinate, otherwise it is empty.
+ */
+struct MatchBatch {
+    std::vector<QString> files;
+    std::vector<uint32_t> pattern_ids;
+    std::vector<uint64_t> offsets = {0};
+    std::vector<int> coordinates;
+    std::vector<LinePosition> lines;
+
+    void add(QString const& file, uint32_t pattern, std::vector<int> const& positions,
+             std::vector<LinePosition> const& line_positions = {});
+    void append(MatchBatch const& other);
+    void clear();
+    size_t size() const { return files.size(); }
+};
+
+
+/*
+ * Search results for a QTreeView: files are top-level rows and their
+ * coordinates are children. Nothing is stored per row but the arrays of a
+ * MatchBatch, the view asks only for the rows it shows, and children are
+ * handed out in chunks as a file is expanded and scrolled through.
+ */
+class MatchModel : public QAbstractItemModel {
+    Q_OBJECT
+
+public:
+    explicit MatchModel(QObject* parent = nullptr);
+
+    void reset(std::vector<QString> const& patterns, bool show_patterns, bool first_match);
+    void append(MatchBatch const& batch);
+    size_t file_count() const;
+    size_t match_count() const;
+
+    QModelIndex index(int row, int column, QModelIndex const& parent = QModelIndex()) const override;
+    QModelIndex parent(QModelIndex const& child) const override;
+    int rowCount(QModelIndex const& parent = QModelIndex()) const override;
+    int columnCount(QModelIndex const& parent = QModelIndex()) const override;
+    bool hasChildren(QModelIndex const& parent = QModelIndex()) const override;
+    bool canFetchMore(QModelIndex const& parent) const override;
+    void fetchMore(QModelIndex const& parent) override;
+    QVariant data(QModelIndex const& index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    static constexpr int FETCH_SIZE = 4096;
+
+    bool is_file(QModelIndex const& index) const;
+    int coordinate_count(int file) const;
+
+    MatchBatch matches;
+    std::vector<int> fetched;
+    std::vector<QString> patterns;
+    bool show_patterns = false;
+    bool first_match = false;
+};
+
+#endif // MATCHMODEL_H
@@ -1,6 +1,7 @@
 #ifndef PARAMETERES
 #define PARAMETERES
 
-enum parameters {Hidden, Recursive, FirstMatch, ShowLine, Preprocess};
+enum parameters {Hidden, Recursive, FirstMatch, ShowLine, Preprocess, Watch, Ordered, MultiPattern, Regex, IgnoreCase,
+                 ByteIndex};
 
 #endif // PARAMETERES
@@ -0,0 +1,313 @@
+#include "pathfilter.h"
+
+#include <QFile>
+
+#include <algorithm>
+#include <cstring>
+
+
+Glob::Glob(QByteArray const& pattern) {
+    auto literal_token = [&]() -> QByteArray& {
+        if (tokens.empty() || tokens.back().type != Token::Literal) {
+            tokens.push_back({Token::Literal, QByteArray(), {}});
+        }
+        return tokens.back().literal;
+    };
+
+    int size = pattern.size();
+    for (int i = 0; i < size; ++i) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < size) {
+            literal_token() += pattern[++i];
+        } else if (c == '*' && i + 1 < size && pattern[i + 1] == '*') {
+            ++i;
+            if (i + 1 < size && pattern[i + 1] == '/') {
+                ++i;
+                tokens.push_back({Token::AnyDirectories, QByteArray(), {}});
+            } else {
+                tokens.push_back({Token::AnyPath, QByteArray(), {}});
+            }
+        } else if (c == '*') {
+            tokens.push_back({Token::Star, QByteArray(), {}});
+        } else if (c == '?') {
+            tokens.push_back({Token::One, QByteArray(), {}});
+        } else if (c == '[') {
+            // a set without its closing bracket is the bracket itself
+            int j = i + 1;
+            bool negated = j < size && (pattern[j] == '!' || pattern[j] == '^');
+            if (negated) {
+                ++j;
+            }
+            Token token{Token::Set, QByteArray(), {}};
+            for (bool first = true; j < size && (first || pattern[j] != ']'); ++j, first = false) {
+                if (pattern[j] == '\\' && j + 1 < size) {
+                    ++j;
+                }
+                uint8_t from = pattern[j];
+                uint8_t to = from;
+                if (j + 2 < size && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                    to = pattern[j + 2];
+                    j += 2;
+                }
+                for (int k = from; k <= to; ++k) {
+                    token.set[k] = true;
+                }
+            }
+            if (j >= size) {
+                literal_token() += c;
+                continue;
+            }
+            if (negated) {
+                token.set.flip();
+            }
+            token.set['/'] = false;
+            tokens.push_back(std::move(token));
+            i = j;
+        } else {
+            literal_token() += c;
+        }
+    }
+
+    if (tokens.empty()) {
+        kind = Exact;
+    } else if (tokens.size() == 1 && tokens[0].type == Token::Literal) {
+        kind = Exact;
+        literal = tokens[0].literal;
+    } else if (tokens.size() == 2 && tokens[0].type == Token::Star && tokens[1].type == Token::Literal &&
+               !tokens[1].literal.contains('/')) {
+        kind = Suffix;
+        literal = tokens[1].literal;
+    }
+}
+
+bool Glob::matches(char const* begin, char const* end) const {
+    size_t size = end - begin;
+    switch (kind) {
+    case Exact:
+        return size == size_t(literal.size()) && std::memcmp(begin, literal.constData(), size) == 0;
+    case Suffix:
+        return size >= size_t(literal.size()) && std::memchr(begin, '/', size) == nullptr &&
+                std::memcmp(end - literal.size(), literal.constData(), literal.size()) == 0;
+    default:
+        return match(0, begin, end);
+    }
+}
+
+bool Glob::match(size_t token, char const* begin, char const* end) const {
+    for (; token < tokens.size(); ++token) {
+        Token const& current = tokens[token];
+        switch (current.type) {
+        case Token::Literal:
+            if (end - begin < current.literal.size() ||
+                    std::memcmp(begin, current.literal.constData(), current.literal.size()) != 0) {
+                return false;
+            }
+            begin += current.literal.size();
+            break;
+        case Token::One:
+            // one character, however many bytes of UTF-8 it takes
+            if (begin == end || *begin == '/') {
+                return false;
+            }
+            for (++begin; begin != end && (uint8_t(*begin) & 0xC0) == 0x80; ++begin) {}
+            break;
+        case Token::Set:
+            if (begin == end || !current.set[uint8_t(*begin)]) {
+                return false;
+            }
+            ++begin;
+            break;
+        case Token::Star:
+            if (token + 1 == tokens.size()) {
+                return std::memchr(begin, '/', end - begin) == nullptr;
+            }
+            for (char const* i = begin; ; ++i) {
+                if (match(token + 1, i, end)) {
+                    return true;
+                }
+                if (i == end || *i == '/') {
+                    return false;
+                }
+            }
+        case Token::AnyPath:
+            if (token + 1 == tokens.size()) {
+                return true;
+            }
+            for (char const* i = begin; ; ++i) {
+                if (match(token + 1, i, end)) {
+                    return true;
+                }
+                if (i == end) {
+                    return false;
+                }
+            }
+        case Token::AnyDirectories:
+            // no directory, or anything up to a '/'
+            if (match(token + 1, begin, end)) {
+                return true;
+            }
+            for (char const* i = begin; i != end; ++i) {
+                if (*i == '/' && match(token + 1, i + 1, end)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    return begin == end;
+}
+
+
+PathFilter::PathFilter(Options const& options)
+    : settings(options) {
+    Rule rule{Glob(QByteArray()), false, false, false};
+    for (QString const& i: options.include) {
+        if (parse(i.toUtf8(), rule)) {
+            includes.push_back(rule);
+        }
+    }
+    for (QString const& i: options.exclude) {
+        if (parse(i.toUtf8(), rule)) {
+            excludes.push_back(rule);
+        }
+    }
+}
+
+PathFilter::Options const& PathFilter::options() const {
+    return settings;
+}
+
+QString PathFilter::description() const {
+    return QStringList{settings.include.join(QChar(1)), settings.exclude.join(QChar(1)),
+                QString::number(settings.maximum_size), settings.ignore_files ? "i" : ""}.join(QChar(0));
+}
+
+// a line of an ignore file, or a pattern given in the options; false for blanks and comments
+bool PathFilter::parse(QByteArray line, Rule& rule) {
+    while (!line.isEmpty() && (line.endsWith('\r') || line.endsWith(' ') || line.endsWith('\t')) &&
+           !line.endsWith("\\ ")) {
+        line.chop(1);
+    }
+    if (line.isEmpty() || line.startsWith('#')) {
+        return false;
+    }
+    rule.negated = line.startsWith('!');
+    if (rule.negated) {
+        line.remove(0, 1);
+    }
+    rule.directory_only = line.endsWith('/');
+    while (line.endsWith('/')) {
+        line.chop(1);
+    }
+    rule.anchored = line.contains('/');
+    if (line.startsWith('/')) {
+        line.remove(0, 1);
+    }
+    if (line.isEmpty()) {
+        return false;
+    }
+    rule.glob = Glob(line);
+    return true;
+}
+
+int PathFilter::decide(std::vector<Rule> const& rules, char const* relative, char const* name, char const* end,
+                       bool directory) {
+    for (auto i = rules.rbegin(); i != rules.rend(); ++i) {
+        if ((directory || !i->directory_only) && i->glob.matches(i->anchored ? relative : name, end)) {
+            return i->negated ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+std::shared_ptr<PathFilter::Scope const> PathFilter::enter(std::shared_ptr<Scope const> const& scope,
+                                                           QByteArray const& directory,
+                                                           int relative_length) const {
+    if (!settings.ignore_files) {
+        return scope;
+    }
+    std::vector<Rule> rules;
+    Rule rule{Glob(QByteArray()), false, false, false};
+    QByteArray prefix = directory.endsWith('/') ? directory : directory + '/';
+    for (char const* name: {".gitignore", ".ignore"}) {
+        QFile file(QFile::decodeName(prefix + name));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        for (QByteArray const& line: file.readAll().split('\n')) {
+            if (parse(line, rule)) {
+                rules.push_back(rule);
+            }
+        }
+    }
+    if (rules.empty()) {
+        return scope;
+    }
+    return std::make_shared<Scope const>(Scope{scope, relative_length, std::move(rules)});
+}
+
+bool PathFilter::accepts(Scope const* scope, char const* relative, char const* end, bool directory,
+                         int64_t size) const {
+    if (!directory && settings.maximum_size > 0 && size > settings.maximum_size) {
+        return false;
+    }
+    char const* name = end;
+    while (name != relative && name[-1] != '/') {
+        --name;
+    }
+    if (settings.ignore_files && directory && end - name == 4 && std::memcmp(name, ".git", 4) == 0) {
+        return false;
+    }
+    for (; scope != nullptr; scope = scope->parent.get()) {
+        char const* base = scope->base == 0 ? relative : relative + scope->base + 1;
+        int decision = decide(scope->rules, base, name, end, directory);
+        if (decision != 0) {
+            if (decision > 0) {
+                return false;
+            }
+            break;
+        }
+    }
+    if (decide(excludes, relative, name, end, directory) > 0) {
+        return false;
+    }
+    return directory || includes.empty() ||
+            std::any_of(includes.begin(), includes.end(), [&](Rule const& i) {
+                return i.glob.matches(i.anchored ? relative : name, end);
+            });
+}
+
+/*
+ * The directories between root and path are checked the way the walk
+ * would, reading their ignore files on the way, so a single path reported
+ * as changed is let through exactly when listing root would have found it.
+ */
+bool PathFilter::reaches(QByteArray const& root, QByteArray const& path, bool directory, int64_t size,
+                         std::shared_ptr<Scope const>* scope) const {
+    int start = relative_start(root);
+    if (path.size() <= start) {
+        if (scope != nullptr) {
+            *scope = nullptr;
+        }
+        return true;
+    }
+    char const* relative = path.constData() + start;
+    std::shared_ptr<Scope const> current = enter(nullptr, root, 0);
+    for (int slash = path.indexOf('/', start); slash >= 0; slash = path.indexOf('/', slash + 1)) {
+        if (!accepts(current.get(), relative, path.constData() + slash, true, 0)) {
+            return false;
+        }
+        current = enter(current, path.left(slash), slash - start);
+    }
+    if (!accepts(current.get(), relative, path.constData() + path.size(), directory, size)) {
+        return false;
+    }
+    if (scope != nullptr) {
+        *scope = std::move(current);
+    }
+    return true;
+}
+
+int PathFilter::relative_start(QByteArray const& root) {
+    return root.endsWith('/') ? root.size() : root.size() + 1;
+}
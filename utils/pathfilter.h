@@ -0,0 +1,110 @@
+#ifndef PATHFILTER_H
+#define PATHFILTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+#include <bitset>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+
+/*
+ * A pattern in the syntax of .gitignore, parsed once into tokens: '*' and '?'
+ * don't match '/', "**" does, "**" followed by '/' also matches no directory
+ * at all, and [...] is a set of bytes. A plain name, or '*' and a plain
+ * suffix, which most patterns are, is compared without the tokens.
+ */
+class Glob {
+public:
+    explicit Glob(QByteArray const& pattern);
+
+    bool matches(char const* begin, char const* end) const;
+
+private:
+    struct Token {
+        enum Type {Literal, One, Set, Star, AnyPath, AnyDirectories};
+
+        Type type;
+        QByteArray literal;
+        std::bitset<256> set;
+    };
+
+    bool match(size_t token, char const* begin, char const* end) const;
+
+    enum {Exact, Suffix, General} kind = General;
+    QByteArray literal;
+    std::vector<Token> tokens;
+};
+
+
+/*
+ * Decides during a walk which entries are listed: files larger than a limit
+ * and anything matching an exclude pattern are left out, directories with
+ * everything below them, and with include patterns only files matching one
+ * are kept. With ignore files, the .gitignore and .ignore of every directory
+ * read add rules for what is below it, deeper files taking precedence as in
+ * git, and .git directories are skipped.
+ *
+ * Patterns are matched against the name of an entry, or against its path
+ * relative to the root (or to the directory of the ignore file) if they
+ * contain a '/'. Paths are bytes as the file system has them, so nothing is
+ * decoded to decide.
+ */
+class PathFilter {
+public:
+    struct Options {
+        QStringList include;
+        QStringList exclude;
+        // in bytes, 0 for no limit
+        int64_t maximum_size = 0;
+        bool ignore_files = false;
+    };
+
+    struct Rule {
+        Glob glob;
+        bool negated;
+        bool directory_only;
+        bool anchored;
+    };
+
+    // rules of the ignore files on the way down from the root, shared by the directories below
+    struct Scope {
+        std::shared_ptr<Scope const> parent;
+        // length of the relative path of the directory the rules come from
+        int base;
+        std::vector<Rule> rules;
+    };
+
+    explicit PathFilter(Options const& options);
+
+    Options const& options() const;
+    // identifies what the filter lets through, for caching results
+    QString description() const;
+
+    // the scope inside a directory whose relative path has the given length
+    std::shared_ptr<Scope const> enter(std::shared_ptr<Scope const> const& scope, QByteArray const& directory,
+                                       int relative_length) const;
+    // [relative, end) is the path relative to the root; size only matters for files
+    bool accepts(Scope const* scope, char const* relative, char const* end, bool directory, int64_t size) const;
+    // whether a walk of root lists path; *scope gets the rules in effect for it
+    bool reaches(QByteArray const& root, QByteArray const& path, bool directory, int64_t size,
+                 std::shared_ptr<Scope const>* scope = nullptr) const;
+
+    // where paths relative to root start in paths under it
+    static int relative_start(QByteArray const& root);
+
+private:
+    static bool parse(QByteArray line, Rule& rule);
+    // 1 if the last rule matching says ignore, -1 if it says keep, 0 if none matches
+    static int decide(std::vector<Rule> const& rules, char const* relative, char const* name, char const* end,
+                      bool directory);
+
+    Options settings;
+    std::vector<Rule> includes;
+    std::vector<Rule> excludes;
+};
+
+#endif // PATHFILTER_H
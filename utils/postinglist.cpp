@@ -0,0 +1,317 @@
+#include "postinglist.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+    const uint32_t CONTAINER_BITS = 1 << 16;
+    const size_t BITMAP_BYTES = CONTAINER_BITS / 8;
+    const size_t BITMAP_WORDS = CONTAINER_BITS / 64;
+
+    void write_varint(uint32_t value, std::vector<uint8_t>& out) {
+        while (value >= 0x80) {
+            out.push_back((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(value);
+    }
+
+    size_t varint_size(uint32_t value) {
+        size_t result = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            ++result;
+        }
+        return result;
+    }
+
+    uint32_t read_varint(uint8_t const*& data) {
+        uint32_t result = 0;
+        for (int shift = 0; ; shift += 7) {
+            uint8_t byte = *data++;
+            result |= (uint32_t) (byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return result;
+            }
+        }
+    }
+
+    // false if the varint doesn't end before end or doesn't fit 32 bits
+    bool read_varint(uint8_t const*& data, uint8_t const* end, uint32_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 32 && data != end; shift += 7) {
+            uint8_t byte = *data++;
+            if (shift == 28 && byte > 0x0f) {
+                return false;
+            }
+            value |= (uint32_t) (byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // bitmaps are stored little-endian
+    uint64_t bitmap_word(uint8_t const* bitmap, size_t index) {
+        uint64_t result;
+        std::memcpy(&result, bitmap + index * 8, 8);
+        return result;
+    }
+}
+
+void posting_list::encode(uint32_t const* begin, uint32_t const* end, std::vector<uint8_t>& out) {
+    write_varint(end - begin, out);
+    while (begin != end) {
+        uint32_t high = *begin >> 16;
+        uint32_t const* container_end = std::lower_bound(begin, end, (high + 1) << 16);
+        if (high == 0xffff) {
+            container_end = end;
+        }
+
+        size_t array_size = 0;
+        uint32_t previous = 0;
+        for (auto i = begin; i != container_end; ++i) {
+            array_size += varint_size((*i & 0xffff) - previous);
+            previous = *i & 0xffff;
+        }
+
+        bool bitmap = array_size > BITMAP_BYTES;
+        out.push_back(bitmap ? Bitmap : Array);
+        write_varint(high, out);
+        write_varint(container_end - begin, out);
+        write_varint(bitmap ? BITMAP_BYTES : array_size, out);
+        if (bitmap) {
+            size_t payload = out.size();
+            out.resize(out.size() + BITMAP_BYTES, 0);
+            for (auto i = begin; i != container_end; ++i) {
+                uint32_t low = *i & 0xffff;
+                out[payload + low / 8] |= 1 << (low % 8);
+            }
+        } else {
+            previous = 0;
+            for (auto i = begin; i != container_end; ++i) {
+                write_varint((*i & 0xffff) - previous, out);
+                previous = *i & 0xffff;
+            }
+        }
+        begin = container_end;
+    }
+}
+
+std::vector<uint32_t> posting_list::decode(uint8_t const* begin, uint8_t const* end) {
+    PostingCursor cursor(begin, end);
+    std::vector<uint32_t> result;
+    result.reserve(cursor.size());
+    for (; cursor.valid(); cursor.next()) {
+        result.push_back(cursor.value());
+    }
+    return result;
+}
+
+// leapfrog join driven by the shortest list
+std::vector<uint32_t> posting_list::intersect(std::vector<std::pair<uint8_t const*, uint8_t const*>> lists) {
+    std::vector<PostingCursor> cursors;
+    for (auto const& i: lists) {
+        cursors.emplace_back(i.first, i.second);
+    }
+    std::sort(cursors.begin(), cursors.end(), [](PostingCursor const& a, PostingCursor const& b) {
+        return a.size() < b.size();
+    });
+
+    std::vector<uint32_t> result;
+    if (cursors.empty()) {
+        return result;
+    }
+    PostingCursor& lead = cursors[0];
+    while (lead.valid()) {
+        uint32_t candidate = lead.value();
+        bool accepted = true;
+        for (size_t i = 1; i < cursors.size(); ++i) {
+            cursors[i].seek(candidate);
+            if (!cursors[i].valid()) {
+                return result;
+            }
+            if (cursors[i].value() != candidate) {
+                lead.seek(cursors[i].value());
+                accepted = false;
+                break;
+            }
+        }
+        if (accepted) {
+            result.push_back(candidate);
+            lead.next();
+        }
+    }
+    return result;
+}
+
+/*
+ * Containers have to come in increasing order of their high bits, hold as
+ * many ids as they claim and end where their payload size says; a bitmap
+ * is always 2^16 bits, an array has increasing ids below 2^16.
+ */
+bool posting_list::well_formed(uint8_t const* begin, uint8_t const* end, uint64_t limit) {
+    uint32_t size;
+    if (!read_varint(begin, end, size)) {
+        return false;
+    }
+    uint64_t counted = 0;
+    int64_t previous_high = -1;
+    while (begin != end) {
+        uint8_t type = *begin++;
+        uint32_t high;
+        uint32_t count;
+        uint32_t payload_size;
+        if ((type != Array && type != Bitmap) || !read_varint(begin, end, high) ||
+                !read_varint(begin, end, count) || !read_varint(begin, end, payload_size)) {
+            return false;
+        }
+        if (high > 0xffff || int64_t(high) <= previous_high || count == 0 || count > CONTAINER_BITS ||
+                payload_size > size_t(end - begin)) {
+            return false;
+        }
+        uint8_t const* payload = begin;
+        uint8_t const* payload_end = begin + payload_size;
+        uint32_t last = 0;
+        if (type == Bitmap) {
+            if (payload_size != BITMAP_BYTES) {
+                return false;
+            }
+            uint64_t bits = 0;
+            for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+                uint64_t word = bitmap_word(payload, i);
+                if (word != 0) {
+                    bits += __builtin_popcountll(word);
+                    last = i * 64 + 63 - __builtin_clzll(word);
+                }
+            }
+            if (bits != count) {
+                return false;
+            }
+        } else {
+            uint64_t low = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t delta;
+                if (!read_varint(payload, payload_end, delta) || (i > 0 && delta == 0)) {
+                    return false;
+                }
+                low += delta;
+                if (low >= CONTAINER_BITS) {
+                    return false;
+                }
+            }
+            if (payload != payload_end) {
+                return false;
+            }
+            last = low;
+        }
+        if ((uint64_t(high) << 16 | last) >= limit) {
+            return false;
+        }
+        counted += count;
+        previous_high = high;
+        begin = payload_end;
+    }
+    return counted == size;
+}
+
+
+PostingCursor::PostingCursor(uint8_t const* begin, uint8_t const* end)
+    : position(begin),
+      end(end) {
+
+    if (position < end) {
+        total = read_varint(position);
+    }
+    has_value = load_container();
+}
+
+bool PostingCursor::load_container() {
+    if (position >= end) {
+        return false;
+    }
+    type = *position++;
+    high = read_varint(position);
+    remaining = read_varint(position);
+    size_t size = read_varint(position);
+    payload = position;
+    payload_end = position + size;
+    position = payload_end;
+    low = 0;
+    if (type == posting_list::Array) {
+        next_in_container();
+    } else {
+        seek_in_container(0);
+    }
+    current = (high << 16) | low;
+    return true;
+}
+
+bool PostingCursor::next_in_container() {
+    if (type == posting_list::Array) {
+        if (remaining == 0) {
+            return false;
+        }
+        --remaining;
+        low += read_varint(payload);
+        return true;
+    }
+    return seek_in_container(low + 1);
+}
+
+// bitmap containers only: move to the first set bit at or after `target`
+bool PostingCursor::seek_in_container(uint32_t target) {
+    if (target >= CONTAINER_BITS) {
+        return false;
+    }
+    size_t word = target / 64;
+    uint64_t bits = bitmap_word(payload, word) & (~0ULL << (target % 64));
+    while (bits == 0) {
+        if (++word == BITMAP_WORDS) {
+            return false;
+        }
+        bits = bitmap_word(payload, word);
+    }
+    low = word * 64 + __builtin_ctzll(bits);
+    return true;
+}
+
+void PostingCursor::next() {
+    if (next_in_container()) {
+        current = (high << 16) | low;
+    } else {
+        has_value = load_container();
+    }
+}
+
+void PostingCursor::seek(uint32_t target) {
+    if (!has_value || current >= target) {
+        return;
+    }
+    uint32_t target_high = target >> 16;
+    while (high < target_high) {
+        if (!load_container()) {
+            has_value = false;
+            return;
+        }
+    }
+    if (high > target_high) {
+        return;
+    }
+
+    uint32_t target_low = target & 0xffff;
+    bool found;
+    if (type == posting_list::Array) {
+        found = true;
+        while (low < target_low && (found = next_in_container())) {}
+    } else {
+        found = seek_in_container(target_low);
+    }
+    if (found) {
+        current = (high << 16) | low;
+    } else {
+        has_value = load_container();
+    }
+}
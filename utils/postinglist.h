@@ -0,0 +1,59 @@
+#ifndef POSTINGLIST_H
+#define POSTINGLIST_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * Compressed posting list of sorted file ids, roaring style: ids are grouped
+ * into containers by their high 16 bits, each container is either a
+ * delta + varint encoded array (sparse) or a 2^16-bit bitmap (dense).
+ *
+ * list      := varint(size) container*
+ * container := type high:varint count:varint payload_size:varint payload
+ */
+namespace posting_list {
+    enum container_type : uint8_t {Array, Bitmap};
+
+    void encode(uint32_t const* begin, uint32_t const* end, std::vector<uint8_t>& out);
+    std::vector<uint32_t> decode(uint8_t const* begin, uint8_t const* end);
+    std::vector<uint32_t> intersect(std::vector<std::pair<uint8_t const*, uint8_t const*>> lists);
+    // whether [begin, end) is a list as encode writes it, of ids below limit; cursors trust what they read
+    bool well_formed(uint8_t const* begin, uint8_t const* end, uint64_t limit);
+}
+
+
+class PostingCursor {
+public:
+    PostingCursor(uint8_t const* begin, uint8_t const* end);
+
+    size_t size() const { return total; }
+    bool valid() const { return has_value; }
+    uint32_t value() const { return current; }
+
+    void next();
+    void seek(uint32_t target);
+
+private:
+    bool load_container();
+    bool next_in_container();
+    bool seek_in_container(uint32_t low);
+
+    uint8_t const* position;
+    uint8_t const* end;
+    size_t total = 0;
+
+    uint8_t type = posting_list::Array;
+    uint32_t high = 0;
+    uint32_t remaining = 0;
+    uint8_t const* payload = nullptr;
+    uint8_t const* payload_end = nullptr;
+
+    uint32_t low = 0;
+    uint32_t current = 0;
+    bool has_value = false;
+};
+
+#endif // POSTINGLIST_H
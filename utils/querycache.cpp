@@ -0,0 +1,44 @@
+#include "querycache.h"
+
+
+std::shared_ptr<QueryCache::Entry const> QueryCache::find(QString const& scope, QString const& query) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if ((*it)->scope == scope && (*it)->query == query) {
+            entries.splice(entries.begin(), entries, it);
+            return entries.front();
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<QueryCache::Entry const> QueryCache::narrowest(QString const& scope, QString const& pattern) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto best = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        Entry const& entry = **it;
+        if (entry.scope == scope && !entry.pattern.isEmpty() && pattern.contains(entry.pattern) &&
+                (best == entries.end() || entry.files.size() < (*best)->files.size())) {
+            best = it;
+        }
+    }
+    if (best == entries.end()) {
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, best);
+    return entries.front();
+}
+
+void QueryCache::insert(std::shared_ptr<Entry const> const& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.remove_if([&](auto const& i) { return i->scope == entry->scope && i->query == entry->query; });
+    entries.push_front(entry);
+    if (entries.size() > CAPACITY) {
+        entries.pop_back();
+    }
+}
+
+void QueryCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+}
@@ -0,0 +1,55 @@
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include "matchmodel.h"
+
+#include <QString>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+
+/*
+ * Recent searches for search as you type. A search is keyed by its scope,
+ * everything that decides which files are read and how, and by its query.
+ * The same search again is answered by the batches it emitted; a plain
+ * pattern containing a cached one can only occur in the files that one was
+ * found in, so only they have to be searched. The least recently used search
+ * goes first, and searches with more matches than are worth keeping aren't
+ * cached at all.
+ */
+class QueryCache {
+public:
+    static constexpr size_t CAPACITY = 32;
+    static constexpr size_t MAXIMUM_MATCHES = 1 << 18;
+
+    struct Entry {
+        QString scope;
+        QString query;
+        // a single plain pattern, case-folded with IgnoreCase; empty if the search can't be narrowed
+        QString pattern;
+        // directory and path of every file that matched or couldn't be searched
+        std::vector<std::pair<QString, QString>> files;
+        std::vector<std::shared_ptr<MatchBatch>> batches;
+        std::vector<QString> errors;
+        std::vector<QString> skipped;
+        size_t matches = 0;
+    };
+
+    std::shared_ptr<Entry const> find(QString const& scope, QString const& query);
+    // the entry with the fewest files whose pattern occurs in pattern
+    std::shared_ptr<Entry const> narrowest(QString const& scope, QString const& pattern);
+    void insert(std::shared_ptr<Entry const> const& entry);
+    void clear();
+
+private:
+    std::mutex mutex;
+    // most recently used first
+    std::list<std::shared_ptr<Entry const>> entries;
+};
+
+#endif // QUERYCACHE_H
@@ -0,0 +1,664 @@
+#include "regexquery.h"
+#include "postinglist.h"
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <cctype>
+#include <set>
+
+
+using regex_query::Query;
+
+namespace {
+    const size_t MAX_EXACT = 16;
+    const size_t MAX_SET = 32;
+
+    Query and_query(Query a, Query b) {
+        if (a.operation == Query::All) {
+            return b;
+        }
+        if (b.operation == Query::All) {
+            return a;
+        }
+        Query result;
+        result.operation = Query::And;
+        for (Query* i: {&a, &b}) {
+            if (i->operation == Query::And) {
+                result.trigrams.insert(result.trigrams.end(), i->trigrams.begin(), i->trigrams.end());
+                std::move(i->children.begin(), i->children.end(), std::back_inserter(result.children));
+            } else {
+                result.children.push_back(std::move(*i));
+            }
+        }
+        std::sort(result.trigrams.begin(), result.trigrams.end());
+        result.trigrams.erase(std::unique(result.trigrams.begin(), result.trigrams.end()), result.trigrams.end());
+        return result;
+    }
+
+    Query or_query(Query a, Query b) {
+        if (a.operation == Query::All || b.operation == Query::All) {
+            return Query();
+        }
+        Query result;
+        result.operation = Query::Or;
+        for (Query* i: {&a, &b}) {
+            if (i->operation == Query::Or) {
+                result.trigrams.insert(result.trigrams.end(), i->trigrams.begin(), i->trigrams.end());
+                std::move(i->children.begin(), i->children.end(), std::back_inserter(result.children));
+            } else if (i->trigrams.size() == 1 && i->children.empty()) {
+                result.trigrams.push_back(i->trigrams.front());
+            } else {
+                result.children.push_back(std::move(*i));
+            }
+        }
+        std::sort(result.trigrams.begin(), result.trigrams.end());
+        result.trigrams.erase(std::unique(result.trigrams.begin(), result.trigrams.end()), result.trigrams.end());
+        return result;
+    }
+
+    // how strings become trigrams: the kind the index has, and whether matches may differ in case
+    struct Keys {
+        trigram_kind kind;
+        bool ignore_case;
+    };
+
+    // a file containing one of the strings contains all trigrams of that string
+    Query or_trigrams(std::set<QString> const& strings, Keys const& keys) {
+        Query result;
+        bool first = true;
+        for (auto const& i: strings) {
+            if (i.size() < 3) {
+                return Query();
+            }
+            Query string;
+            string.operation = Query::And;
+            string.trigrams = string_trigrams(i, keys.kind, keys.ignore_case);
+            if (string.trigrams.empty()) {
+                return Query();
+            }
+            result = first ? string : or_query(result, string);
+            first = false;
+        }
+        return result;
+    }
+
+    std::set<QString> cross(std::set<QString> const& a, std::set<QString> const& b) {
+        std::set<QString> result;
+        for (auto const& i: a) {
+            for (auto const& j: b) {
+                result.insert(i + j);
+            }
+        }
+        return result;
+    }
+
+    /*
+     * What is known about the strings matched by a subexpression: either the
+     * exact set of them, or sets every match starts and ends with. match has
+     * to hold for any file containing a match in both cases.
+     */
+    struct Info {
+        bool can_empty = false;
+        bool exact_known = false;
+        std::set<QString> exact;
+        std::set<QString> prefix;
+        std::set<QString> suffix;
+        Query match;
+    };
+
+    Info any_char() {
+        Info result;
+        result.prefix = {QString()};
+        result.suffix = {QString()};
+        return result;
+    }
+
+    Info any_string() {
+        Info result = any_char();
+        result.can_empty = true;
+        return result;
+    }
+
+    Info empty_string() {
+        Info result;
+        result.can_empty = true;
+        result.exact_known = true;
+        result.exact = {QString()};
+        return result;
+    }
+
+    Info characters(std::set<QString> const& set) {
+        Info result;
+        result.exact_known = true;
+        result.exact = set;
+        return result;
+    }
+
+    std::set<QString> const& starts(Info const& x) {
+        return x.exact_known ? x.exact : x.prefix;
+    }
+
+    std::set<QString> const& ends(Info const& x) {
+        return x.exact_known ? x.exact : x.suffix;
+    }
+
+    Query full_match(Info const& x, Keys const& keys) {
+        return x.exact_known ? and_query(x.match, or_trigrams(x.exact, keys)) : x.match;
+    }
+
+    // moves what the string sets say into match once they get too large or too long
+    void simplify(Info& x, bool force, Keys const& keys) {
+        if (x.exact_known && (force || x.exact.size() > MAX_EXACT)) {
+            x.match = full_match(x, keys);
+            x.prefix = x.exact;
+            x.suffix = x.exact;
+            x.exact.clear();
+            x.exact_known = false;
+        } else if (x.exact_known) {
+            return;
+        } else {
+            x.match = and_query(x.match, or_trigrams(x.prefix, keys));
+            x.match = and_query(x.match, or_trigrams(x.suffix, keys));
+        }
+        std::set<QString> prefix;
+        for (auto const& i: x.prefix) {
+            prefix.insert(i.left(2));
+        }
+        std::set<QString> suffix;
+        for (auto const& i: x.suffix) {
+            suffix.insert(i.right(2));
+        }
+        x.prefix = prefix.size() > MAX_SET ? std::set<QString>{QString()} : prefix;
+        x.suffix = suffix.size() > MAX_SET ? std::set<QString>{QString()} : suffix;
+    }
+
+    Info concat(Info const& x, Info const& y, Keys const& keys) {
+        Info result;
+        result.can_empty = x.can_empty && y.can_empty;
+        if (x.exact_known && y.exact_known && x.exact.size() * y.exact.size() <= MAX_EXACT) {
+            result.exact_known = true;
+            result.exact = cross(x.exact, y.exact);
+            result.match = and_query(x.match, y.match);
+            simplify(result, false, keys);
+            return result;
+        }
+
+        result.match = and_query(full_match(x, keys), full_match(y, keys));
+        if (ends(x).size() * starts(y).size() <= MAX_SET) {
+            result.match = and_query(result.match, or_trigrams(cross(ends(x), starts(y)), keys));
+        }
+        if (x.exact_known && x.exact.size() * starts(y).size() <= MAX_SET) {
+            result.prefix = cross(x.exact, starts(y));
+        } else {
+            result.prefix = starts(x);
+            if (x.can_empty) {
+                result.prefix.insert(starts(y).begin(), starts(y).end());
+            }
+        }
+        if (y.exact_known && ends(x).size() * y.exact.size() <= MAX_SET) {
+            result.suffix = cross(ends(x), y.exact);
+        } else {
+            result.suffix = ends(y);
+            if (y.can_empty) {
+                result.suffix.insert(ends(x).begin(), ends(x).end());
+            }
+        }
+        simplify(result, false, keys);
+        return result;
+    }
+
+    Info alternate(Info const& x, Info const& y, Keys const& keys) {
+        Info result;
+        result.can_empty = x.can_empty || y.can_empty;
+        if (x.exact_known && y.exact_known && x.exact.size() + y.exact.size() <= MAX_EXACT) {
+            result.exact_known = true;
+            result.exact = x.exact;
+            result.exact.insert(y.exact.begin(), y.exact.end());
+            result.match = or_query(x.match, y.match);
+        } else {
+            result.match = or_query(full_match(x, keys), full_match(y, keys));
+            result.prefix = starts(x);
+            result.prefix.insert(starts(y).begin(), starts(y).end());
+            result.suffix = ends(x);
+            result.suffix.insert(ends(y).begin(), ends(y).end());
+        }
+        simplify(result, false, keys);
+        return result;
+    }
+
+    // maximum < 0 means unbounded
+    Info repeat(Info const& x, int minimum, int maximum, Keys const& keys) {
+        if (minimum == 0 && maximum == 0) {
+            return empty_string();
+        }
+        if (minimum == 0) {
+            return maximum == 1 ? alternate(x, empty_string(), keys) : any_string();
+        }
+        if (minimum == 1 && maximum == 1) {
+            return x;
+        }
+        // one or more copies: starts like x, ends like x and contains it
+        Info result;
+        result.can_empty = x.can_empty;
+        result.match = full_match(x, keys);
+        result.prefix = starts(x);
+        result.suffix = ends(x);
+        simplify(result, false, keys);
+        return result;
+    }
+
+    /*
+     * Recursive descent over the PCRE syntax QRegularExpression accepts.
+     * Constructs that can't be analyzed give "any string"; those that change
+     * the meaning of the rest of the pattern (inline options) set unsupported.
+     */
+    class Parser {
+    public:
+        Parser(QString const& pattern, Keys const& keys) : pattern(pattern), keys(keys) {}
+
+        Info parse() {
+            Info result = alternation();
+            if (!done()) {
+                unsupported = true;
+            }
+            return result;
+        }
+
+        bool unsupported = false;
+
+    private:
+        bool done() const {
+            return position >= pattern.size();
+        }
+
+        QChar peek() const {
+            return pattern[position];
+        }
+
+        bool skip(QChar c) {
+            if (!done() && peek() == c) {
+                ++position;
+                return true;
+            }
+            return false;
+        }
+
+        void skip_past(QChar c) {
+            while (!done() && pattern[position++] != c) {}
+        }
+
+        Info alternation() {
+            Info result = sequence();
+            while (skip('|')) {
+                result = alternate(result, sequence(), keys);
+            }
+            return result;
+        }
+
+        Info sequence() {
+            Info result = empty_string();
+            while (!done() && peek() != '|' && peek() != ')') {
+                result = concat(result, repetition(), keys);
+            }
+            return result;
+        }
+
+        Info repetition() {
+            Info result = atom();
+            while (!done()) {
+                int minimum;
+                int maximum;
+                if (skip('*')) {
+                    minimum = 0;
+                    maximum = -1;
+                } else if (skip('+')) {
+                    minimum = 1;
+                    maximum = -1;
+                } else if (skip('?')) {
+                    minimum = 0;
+                    maximum = 1;
+                } else if (!bounds(minimum, maximum)) {
+                    break;
+                }
+                if (!skip('?')) {
+                    skip('+');
+                }
+                result = repeat(result, minimum, maximum, keys);
+            }
+            return result;
+        }
+
+        // {n}, {n,} or {n,m}; anything else is a literal brace
+        bool bounds(int& minimum, int& maximum) {
+            if (peek() != '{') {
+                return false;
+            }
+            int close = pattern.indexOf('}', position);
+            if (close < 0) {
+                return false;
+            }
+            QStringList parts = pattern.mid(position + 1, close - position - 1).split(',');
+            bool ok = parts.size() <= 2;
+            minimum = ok ? parts[0].toInt(&ok) : 0;
+            maximum = minimum;
+            if (ok && parts.size() == 2) {
+                maximum = parts[1].isEmpty() ? -1 : parts[1].toInt(&ok);
+            }
+            if (!ok) {
+                return false;
+            }
+            position = close + 1;
+            return true;
+        }
+
+        Info atom() {
+            QChar c = pattern[position++];
+            if (c == '(') {
+                return group();
+            } else if (c == '[') {
+                return character_class();
+            } else if (c == '.') {
+                return any_char();
+            } else if (c == '^' || c == '$') {
+                return empty_string();
+            } else if (c == '\\') {
+                return escape();
+            }
+            return characters({QString(c)});
+        }
+
+        Info group() {
+            bool zero_width = false;
+            if (skip('?')) {
+                if (skip(':') || skip('>') || skip('|')) {
+                } else if (skip('=') || skip('!')) {
+                    zero_width = true;
+                } else if (skip('<')) {
+                    if (skip('=') || skip('!')) {
+                        zero_width = true;
+                    } else {
+                        skip_past('>');
+                    }
+                } else if (skip('P') && skip('<')) {
+                    skip_past('>');
+                } else if (!done() && peek() == '\'') {
+                    ++position;
+                    skip_past('\'');
+                } else {
+                    unsupported = true;
+                    skip_past(')');
+                    return any_string();
+                }
+            }
+            Info result = alternation();
+            if (!skip(')')) {
+                unsupported = true;
+            }
+            // lookaround consumes nothing
+            return zero_width ? empty_string() : result;
+        }
+
+        // the character after a backslash, for escapes that stand for one character
+        bool escaped_character(QChar c, ushort& result) {
+            switch (c.unicode()) {
+            case 'n': result = '\n'; return true;
+            case 't': result = '\t'; return true;
+            case 'r': result = '\r'; return true;
+            case 'f': result = '\f'; return true;
+            case 'e': result = 0x1b; return true;
+            case 'a': result = 0x07; return true;
+            case 'x': {
+                QString digits;
+                if (skip('{')) {
+                    int close = pattern.indexOf('}', position);
+                    if (close < 0) {
+                        return false;
+                    }
+                    digits = pattern.mid(position, close - position);
+                    position = close + 1;
+                } else {
+                    while (digits.size() < 2 && !done() && isxdigit(peek().toLatin1())) {
+                        digits += pattern[position++];
+                    }
+                }
+                bool ok;
+                uint value = digits.isEmpty() ? 0 : digits.toUInt(&ok, 16);
+                result = value;
+                return (digits.isEmpty() || ok) && value <= 0xffff;
+            }
+            default:
+                if (c.isLetterOrNumber()) {
+                    return false;
+                }
+                result = c.unicode();
+                return true;
+            }
+        }
+
+        Info escape() {
+            if (done()) {
+                unsupported = true;
+                return any_string();
+            }
+            QChar c = pattern[position++];
+            switch (c.unicode()) {
+            case 'b': case 'B': case 'A': case 'z': case 'Z': case 'G': case 'K':
+                return empty_string();
+            case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+            case 'h': case 'H': case 'v': case 'V': case 'N':
+                return any_char();
+            case 'p': case 'P':
+                if (skip('{')) {
+                    skip_past('}');
+                } else {
+                    ++position;
+                }
+                return any_char();
+            case 'c':
+                ++position;
+                return any_char();
+            case 'Q': {
+                int end = pattern.indexOf("\\E", position);
+                QString literal = pattern.mid(position, end < 0 ? -1 : end - position);
+                position = end < 0 ? pattern.size() : end + 2;
+                return characters({literal});
+            }
+            default:
+                break;
+            }
+            ushort value;
+            if (escaped_character(c, value)) {
+                return characters({QString(QChar(value))});
+            }
+            // back references, \R, \X and whatever else match strings we know nothing about
+            if (c == 'g' || c == 'k') {
+                if (!done() && (peek() == '{' || peek() == '<' || peek() == '\'')) {
+                    QChar close = peek() == '{' ? '}' : peek() == '<' ? '>' : '\'';
+                    skip_past(close);
+                }
+            }
+            return any_string();
+        }
+
+        Info character_class() {
+            std::set<QString> set;
+            bool any = skip('^');
+            bool first = true;
+            bool closed = false;
+            while (!done()) {
+                QChar c = pattern[position++];
+                if (c == ']' && !first) {
+                    closed = true;
+                    break;
+                }
+                first = false;
+                ushort low;
+                if (c == '[' && !done() && peek() == ':') {
+                    skip_past(']');
+                    any = true;
+                    continue;
+                }
+                if (c == '\\') {
+                    if (done()) {
+                        break;
+                    }
+                    QChar e = pattern[position++];
+                    if (!escaped_character(e, low)) {
+                        if (e == 'p' || e == 'P') {
+                            if (skip('{')) {
+                                skip_past('}');
+                            } else {
+                                ++position;
+                            }
+                        }
+                        any = true;
+                        continue;
+                    }
+                } else {
+                    low = c.unicode();
+                }
+                ushort high = low;
+                if (position + 1 < pattern.size() && peek() == '-' && pattern[position + 1] != ']') {
+                    ++position;
+                    QChar h = pattern[position++];
+                    if (h == '\\') {
+                        if (done() || !escaped_character(pattern[position++], high)) {
+                            any = true;
+                            continue;
+                        }
+                    } else {
+                        high = h.unicode();
+                    }
+                }
+                if (high < low || size_t(high - low) >= MAX_EXACT) {
+                    any = true;
+                    continue;
+                }
+                for (uint i = low; i <= high; ++i) {
+                    set.insert(QString(QChar(i)));
+                }
+            }
+            if (!closed) {
+                unsupported = true;
+            }
+            if (any || set.empty() || set.size() > MAX_EXACT) {
+                return any_char();
+            }
+            return characters(set);
+        }
+
+        QString pattern;
+        Keys keys;
+        int position = 0;
+    };
+
+    std::vector<uint32_t> evaluate(Query const& query, DirectoryIndex const& index) {
+        std::vector<uint32_t> result;
+        if (query.operation == Query::All) {
+            result.resize(index.file_count());
+            std::iota(result.begin(), result.end(), 0);
+            return result;
+        }
+
+        auto posting = [&index](int64_t trigram) -> std::pair<uint8_t const*, uint8_t const*> {
+            auto key = std::lower_bound(index.keys.begin(), index.keys.end(), trigram);
+            if (key == index.keys.end() || *key != trigram) {
+                return {nullptr, nullptr};
+            }
+            size_t k = key - index.keys.begin();
+            return {index.postings.data + index.posting_offsets[k], index.postings.data + index.posting_offsets[k + 1]};
+        };
+
+        if (query.operation == Query::And) {
+            bool started = false;
+            if (!query.trigrams.empty()) {
+                std::vector<std::pair<uint8_t const*, uint8_t const*>> lists;
+                for (auto i: query.trigrams) {
+                    lists.push_back(posting(i));
+                    if (lists.back().first == nullptr) {
+                        return result;
+                    }
+                }
+                result = posting_list::intersect(lists);
+                started = true;
+            }
+            for (auto const& i: query.children) {
+                if (started && result.empty()) {
+                    break;
+                }
+                std::vector<uint32_t> child = evaluate(i, index);
+                if (started) {
+                    std::vector<uint32_t> both;
+                    std::set_intersection(result.begin(), result.end(), child.begin(), child.end(),
+                                          std::back_inserter(both));
+                    result.swap(both);
+                } else {
+                    result.swap(child);
+                    started = true;
+                }
+            }
+            return result;
+        }
+
+        std::vector<uint32_t> merged;
+        auto add = [&result, &merged](std::vector<uint32_t> const& list) {
+            merged.clear();
+            std::set_union(result.begin(), result.end(), list.begin(), list.end(), std::back_inserter(merged));
+            result.swap(merged);
+        };
+        for (auto i: query.trigrams) {
+            auto list = posting(i);
+            if (list.first != nullptr) {
+                add(posting_list::decode(list.first, list.second));
+            }
+        }
+        for (auto const& i: query.children) {
+            add(evaluate(i, index));
+        }
+        return result;
+    }
+
+    // the same query against the Bloom filters of a blocked file
+    bool satisfied(Query const& query, DirectoryIndex const& index, uint32_t file) {
+        if (query.operation == Query::All) {
+            return true;
+        }
+        auto contains = [&index, file](int64_t trigram) { return index.may_contain(file, trigram); };
+        auto child = [&index, file](Query const& i) { return satisfied(i, index, file); };
+        if (query.operation == Query::And) {
+            return std::all_of(query.trigrams.begin(), query.trigrams.end(), contains) &&
+                   std::all_of(query.children.begin(), query.children.end(), child);
+        }
+        return std::any_of(query.trigrams.begin(), query.trigrams.end(), contains) ||
+               std::any_of(query.children.begin(), query.children.end(), child);
+    }
+}
+
+Query regex_query::analyze(QString const& pattern, trigram_kind kind, bool ignore_case) {
+    Keys keys{kind, ignore_case};
+    Parser parser(pattern, keys);
+    Info info = parser.parse();
+    if (parser.unsupported) {
+        return Query();
+    }
+    simplify(info, true, keys);
+    return info.match;
+}
+
+// unindexed files may contain anything, so they are always candidates;
+// blocked files are searched whole when any of their blocks may match, copies with their originals
+std::vector<uint32_t> regex_query::candidates(Query const& query, DirectoryIndex const& index) {
+    std::vector<uint32_t> result = evaluate(query, index);
+    std::vector<uint32_t> always(index.unindexed.begin(), index.unindexed.end());
+    for (auto i: index.blocked) {
+        if (satisfied(query, index, i)) {
+            always.push_back(i);
+        }
+    }
+    std::inplace_merge(always.begin(), always.begin() + index.unindexed.size, always.end());
+    std::vector<uint32_t> merged;
+    std::set_union(result.begin(), result.end(), always.begin(), always.end(),
+                   std::back_inserter(merged));
+    return index.with_copies(merged);
+}
@@ -0,0 +1,35 @@
+#ifndef REGEXQUERY_H
+#define REGEXQUERY_H
+
+#include "trigramindex.h"
+
+#include <QString>
+
+#include <vector>
+#include <cstdint>
+
+
+/*
+ * Turns a regular expression into a boolean query over trigrams that every
+ * file containing a match has to satisfy, in the manner of Russ Cox's
+ * codesearch: the expression is analyzed bottom-up into the sets of strings
+ * a match may be exactly, start with or end with, and trigrams of these sets
+ * are combined with AND and OR. Anything the analysis doesn't understand
+ * (back references, lookaround, inline options) only weakens the query, so
+ * in the worst case it is All and every file is searched.
+ */
+namespace regex_query {
+    struct Query {
+        enum Operation {All, And, Or};
+
+        Operation operation = All;
+        std::vector<int64_t> trigrams;
+        std::vector<Query> children;
+    };
+
+    // with ignore_case matches may differ in case from the pattern, which only byte trigrams care about
+    Query analyze(QString const& pattern, trigram_kind kind = CharTrigrams, bool ignore_case = false);
+    std::vector<uint32_t> candidates(Query const& query, DirectoryIndex const& index);
+}
+
+#endif // REGEXQUERY_H
@@ -0,0 +1,211 @@
+#include "searchengine.h"
+#include "directoryscanner.h"
+#include "trigrammanager.h"
+#include "indexfile.h"
+
+#include <QEventLoop>
+#include <QThread>
+
+#include <algorithm>
+#include <memory>
+
+
+SearchEngine::SearchEngine(std::map<parameters, bool> const& params)
+    : params(params) {
+    qRegisterMetaType<std::shared_ptr<MatchBatch>>("std::shared_ptr<MatchBatch>");
+    qRegisterMetaType<TrigramIndex*>("TrigramIndex*");
+}
+
+SearchEngine::~SearchEngine() {
+    delete trigrams;
+}
+
+// 0 means one thread per core
+void SearchEngine::set_thread_count(int count) {
+    threads = count;
+}
+
+void SearchEngine::set_binary_policy(binary_policy policy) {
+    binaries = policy;
+}
+
+void SearchEngine::set_stats_enabled(bool enabled) {
+    stats_enabled = enabled;
+}
+
+// applies to builds and searches alike
+void SearchEngine::set_filter(PathFilter::Options const& options) {
+    filter = std::make_shared<PathFilter const>(options);
+}
+
+std::shared_ptr<SearchStats const> SearchEngine::stats() const {
+    return last_stats;
+}
+
+bool SearchEngine::load_index(QString const& path, QString* error) {
+    TrigramIndex* loaded = index_file::load(params, path, error);
+    if (loaded == nullptr) {
+        return false;
+    }
+    delete trigrams;
+    trigrams = loaded;
+    return true;
+}
+
+bool SearchEngine::save_index(QString const& path, QString* error) const {
+    if (trigrams == nullptr) {
+        if (error != nullptr) {
+            *error = "nothing is indexed";
+        }
+        return false;
+    }
+    return index_file::save(*trigrams, path, error);
+}
+
+TrigramIndex const* SearchEngine::index() const {
+    return trigrams;
+}
+
+void SearchEngine::build_index(std::set<QString> const& directories, Callbacks const& callbacks) {
+    if (trigrams == nullptr) {
+        trigrams = new TrigramIndex();
+    }
+    QThread thread;
+    QEventLoop loop;
+    TrigramManager* tm = new TrigramManager(directories, params, trigrams);
+    tm->set_thread_count(threads);
+    last_stats = stats_enabled ? std::make_shared<SearchStats>() : nullptr;
+    tm->set_stats(last_stats);
+    tm->set_filter(filter);
+    tm->moveToThread(&thread);
+
+    TrigramIndex* result = nullptr;
+    QObject::connect(&thread, &QThread::started, tm, &TrigramManager::manage_trigrams);
+    QObject::connect(tm, &TrigramManager::result, &loop, [&result](TrigramIndex* index) {
+        result = index;
+    });
+    QObject::connect(tm, &TrigramManager::throw_error, &loop, [&callbacks](QString const& file_name) {
+        if (callbacks.error) {
+            callbacks.error(file_name);
+        }
+    });
+    QObject::connect(tm, &TrigramManager::throw_binary, &loop, [&callbacks](QString const& file_name) {
+        if (callbacks.binary) {
+            callbacks.binary(file_name);
+        }
+    });
+    QObject::connect(tm, &TrigramManager::throw_progress, &loop,
+                     [&callbacks](QString const& directory, double progress) {
+        if (callbacks.progress) {
+            callbacks.progress(directory, progress);
+        }
+    });
+    QObject::connect(tm, &TrigramManager::finished, tm, &TrigramManager::deleteLater);
+    QObject::connect(tm, &TrigramManager::finished, &thread, &QThread::quit);
+    QObject::connect(&thread, &QThread::finished, &loop, &QEventLoop::quit);
+    thread.start();
+    loop.exec();
+    thread.wait();
+
+    if (result == nullptr) {
+        return;
+    }
+    // directories indexed as the other kind of trigrams can't be kept alongside
+    if (result->kind() != trigrams->kind()) {
+        trigrams->directories.clear();
+    }
+    for (auto& i: result->directories) {
+        trigrams->directories[i.first] = std::move(i.second);
+    }
+    trigrams->params = result->params;
+    delete result;
+}
+
+void SearchEngine::search(std::vector<QString> const& patterns, std::list<QString> const& directories,
+                          Callbacks const& callbacks) {
+    // the scanner drops empty patterns, with nothing left there is nothing to find
+    if (std::all_of(patterns.begin(), patterns.end(), [](QString const& i) { return i.isEmpty(); })) {
+        return;
+    }
+    DirectoryScanner* scanner = make_scanner(directories);
+    scanner->add_scan_properties(patterns);
+    run(scanner, callbacks);
+}
+
+// the pattern must be valid
+void SearchEngine::search_regex(QString const& pattern, std::list<QString> const& directories,
+                                Callbacks const& callbacks) {
+    DirectoryScanner* scanner = make_scanner(directories);
+    scanner->add_regex(pattern);
+    run(scanner, callbacks);
+}
+
+std::vector<QString> SearchEngine::split_patterns(QString const& input) {
+    std::vector<QString> result(1);
+    for (int i = 0; i < input.size(); ++i) {
+        if (input[i] == '\\' && i + 1 < input.size() && (input[i + 1] == '|' || input[i + 1] == '\\')) {
+            result.back() += input[++i];
+        } else if (input[i] == '|') {
+            if (!result.back().isEmpty()) {
+                result.emplace_back();
+            }
+        } else {
+            result.back() += input[i];
+        }
+    }
+    if (result.back().isEmpty()) {
+        result.pop_back();
+    }
+    return result;
+}
+
+// without an index every directory is traversed whatever Preprocess says
+DirectoryScanner* SearchEngine::make_scanner(std::list<QString> const& directories) {
+    DirectoryScanner* scanner = new DirectoryScanner(params, trigrams);
+    scanner->set_thread_count(threads);
+    scanner->set_binary_policy(binaries);
+    last_stats = stats_enabled ? std::make_shared<SearchStats>() : nullptr;
+    scanner->set_stats(last_stats);
+    scanner->set_filter(filter);
+    scanner->add_directories(directories);
+    return scanner;
+}
+
+void SearchEngine::run(DirectoryScanner* scanner, Callbacks const& callbacks) {
+    if (callbacks.started) {
+        callbacks.started(scanner->get_patterns());
+    }
+    QThread thread;
+    QEventLoop loop;
+    scanner->moveToThread(&thread);
+
+    QObject::connect(&thread, &QThread::started, scanner, &DirectoryScanner::scan_directories);
+    QObject::connect(scanner, &DirectoryScanner::new_matches, &loop,
+                     [&callbacks](std::shared_ptr<MatchBatch> const& batch) {
+        if (callbacks.matches) {
+            callbacks.matches(*batch);
+        }
+    });
+    QObject::connect(scanner, &DirectoryScanner::new_error, &loop, [&callbacks](QString const& file_name) {
+        if (callbacks.error) {
+            callbacks.error(file_name);
+        }
+    });
+    QObject::connect(scanner, &DirectoryScanner::skipped_binary, &loop, [&callbacks](QString const& file_name) {
+        if (callbacks.binary) {
+            callbacks.binary(file_name);
+        }
+    });
+    QObject::connect(scanner, &DirectoryScanner::progress, &loop,
+                     [&callbacks](QString const& directory, double progress) {
+        if (callbacks.progress) {
+            callbacks.progress(directory, progress);
+        }
+    });
+    QObject::connect(scanner, &DirectoryScanner::finished, scanner, &DirectoryScanner::deleteLater);
+    QObject::connect(scanner, &DirectoryScanner::finished, &thread, &QThread::quit);
+    QObject::connect(&thread, &QThread::finished, &loop, &QEventLoop::quit);
+    thread.start();
+    loop.exec();
+    thread.wait();
+}
@@ -0,0 +1,81 @@
+#ifndef SEARCHENGINE_H
+#define SEARCHENGINE_H
+
+#include "parameters.h"
+#include "trigramindex.h"
+#include "binaryfile.h"
+#include "matchmodel.h"
+#include "searchstats.h"
+#include "pathfilter.h"
+
+#include <QString>
+
+#include <functional>
+#include <map>
+#include <set>
+#include <list>
+#include <memory>
+#include <vector>
+
+class DirectoryScanner;
+
+
+/*
+ * Front of the engine for programs without a GUI. Builds and searches run to
+ * completion: the workers live on their own threads exactly as they do under
+ * MainWindow, while the calling thread waits in a local event loop and gets
+ * their signals through the callbacks. A QCoreApplication has to exist.
+ */
+class SearchEngine {
+public:
+    // a search calls started first, batches refer to patterns by their index in its list
+    struct Callbacks {
+        std::function<void(std::vector<QString> const& patterns)> started;
+        std::function<void(MatchBatch const& batch)> matches;
+        std::function<void(QString const& file_name)> error;
+        std::function<void(QString const& file_name)> binary;
+        std::function<void(QString const& directory, double progress)> progress;
+    };
+
+    explicit SearchEngine(std::map<parameters, bool> const& params);
+    ~SearchEngine();
+
+    SearchEngine(SearchEngine const&) = delete;
+    SearchEngine& operator=(SearchEngine const&) = delete;
+
+    void set_thread_count(int count);
+    void set_binary_policy(binary_policy policy);
+    void set_stats_enabled(bool enabled);
+    void set_filter(PathFilter::Options const& options);
+
+    // of the last build or search, nullptr when stats weren't enabled
+    std::shared_ptr<SearchStats const> stats() const;
+
+    bool load_index(QString const& path, QString* error = nullptr);
+    bool save_index(QString const& path, QString* error = nullptr) const;
+    TrigramIndex const* index() const;
+
+    // directories already in the index are updated incrementally
+    void build_index(std::set<QString> const& directories, Callbacks const& callbacks = {});
+
+    void search(std::vector<QString> const& patterns, std::list<QString> const& directories,
+                Callbacks const& callbacks);
+    void search_regex(QString const& pattern, std::list<QString> const& directories, Callbacks const& callbacks);
+
+    // patterns are separated by |, a backslash escapes a literal | or backslash; empty ones are left out
+    static std::vector<QString> split_patterns(QString const& input);
+
+private:
+    DirectoryScanner* make_scanner(std::list<QString> const& directories);
+    void run(DirectoryScanner* scanner, Callbacks const& callbacks);
+
+    std::map<parameters, bool> params;
+    TrigramIndex* trigrams = nullptr;
+    int threads = 0;
+    binary_policy binaries = SkipBinary;
+    bool stats_enabled = false;
+    std::shared_ptr<SearchStats> last_stats;
+    std::shared_ptr<PathFilter const> filter;
+};
+
+#endif // SEARCHENGINE_H
@@ -0,0 +1,105 @@
+#include "searchstats.h"
+
+#include <QStringList>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+
+int64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t thread_cpu_ns() {
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0;
+    }
+    return int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+namespace {
+    const double MILLISECOND = 1e6;
+    const double MEBIBYTE = 1 << 20;
+
+    double load(std::atomic<int64_t> const& counter) {
+        return double(counter.load(std::memory_order_relaxed));
+    }
+
+    QString milliseconds(std::atomic<int64_t> const& counter) {
+        return QString::number(load(counter) / MILLISECOND, 'f', 1) + " ms";
+    }
+}
+
+char const* SearchStats::phase_name(Phase phase) {
+    switch (phase) {
+    case Traversal: return "traversal";
+    case IndexFilter: return "index_filter";
+    case OpenRead: return "open_read";
+    case Decoding: return "decoding";
+    case Matching: return "matching";
+    case Indexing: return "indexing";
+    case Merging: return "merging";
+    default: return "";
+    }
+}
+
+QJsonObject SearchStats::to_json() const {
+    QJsonObject phases;
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        phases[phase_name(Phase(i))] = load(phase_ns[i]) / MILLISECOND;
+    }
+    double utilization = worker_wall_ns > 0 ? load(worker_busy_ns) / load(worker_wall_ns) : 0;
+    return QJsonObject{{"wall_ms", load(wall_ns) / MILLISECOND},
+                       {"cpu_ms", load(cpu_ns) / MILLISECOND},
+                       {"phase_ms", phases},
+                       {"workers", load(workers)},
+                       {"utilization", utilization},
+                       {"files_listed", load(files_listed)},
+                       {"candidates", load(candidates)},
+                       {"rejected", load(rejected)},
+                       {"false_positives", load(false_positives)},
+                       {"files_opened", load(files_opened)},
+                       {"unreadable", load(unreadable)},
+                       {"binary", load(binary)},
+                       {"bytes_opened", load(bytes_opened)},
+                       {"files_matched", load(files_matched)},
+                       {"matches", load(matches)},
+                       {"duplicates", load(duplicates)}};
+}
+
+QString SearchStats::to_text() const {
+    QStringList lines;
+    QString summary = QString("Wall %1, CPU %2").arg(milliseconds(wall_ns)).arg(milliseconds(cpu_ns));
+    if (workers > 0) {
+        summary += QString(", %1 workers busy %2% of the time").arg(QString::number(load(workers)))
+            .arg(QString::number(100 * load(worker_busy_ns) / std::max(load(worker_wall_ns), 1.0), 'f', 0));
+    }
+    lines << summary;
+
+    QStringList phases;
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        if (phase_ns[i] > 0) {
+            phases << QString("%1 %2").arg(phase_name(Phase(i))).arg(milliseconds(phase_ns[i]));
+        }
+    }
+    lines << "Thread time: " + phases.join(", ");
+
+    if (candidates > 0 || rejected > 0) {
+        lines << QString("Index: %1 candidates, %2 files rejected, %3 false positives")
+                 .arg(QString::number(load(candidates))).arg(QString::number(load(rejected)))
+                 .arg(QString::number(load(false_positives)));
+    }
+    lines << QString("Files: %1 listed, %2 opened (%3 MiB), %4 unreadable, %5 binary, %6 matched, %7 matches")
+             .arg(QString::number(load(files_listed))).arg(QString::number(load(files_opened)))
+             .arg(QString::number(load(bytes_opened) / MEBIBYTE, 'f', 1)).arg(QString::number(load(unreadable)))
+             .arg(QString::number(load(binary))).arg(QString::number(load(files_matched)))
+             .arg(QString::number(load(matches)));
+    if (duplicates > 0) {
+        lines << QString("Duplicates: %1 files shared another file's content")
+                 .arg(QString::number(load(duplicates)));
+    }
+    return lines.join('\n');
+}
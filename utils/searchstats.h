@@ -0,0 +1,126 @@
+#ifndef SEARCHSTATS_H
+#define SEARCHSTATS_H
+
+#include <QJsonObject>
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+
+
+int64_t monotonic_ns();
+int64_t thread_cpu_ns();
+
+
+/*
+ * Counters of one index build or search, shared by the thread driving it and
+ * its workers. Everything is a relaxed atomic added to once per file or per
+ * decoded buffer, and nothing reads a clock unless stats were asked for, so
+ * collection costs nothing when it's off.
+ *
+ * Phase times are thread time summed over workers: four workers matching for
+ * a second make four seconds of Matching. cpu_ns is the CPU time of every
+ * thread taking part; utilization is the share of the workers' lifetime they
+ * spent on files rather than waiting for the queue or the results.
+ *
+ * OpenRead is the time spent opening files, sniffing them for binary content
+ * and in explicit reads. A mapped file is read by page faults while it is
+ * searched, which counts as Matching.
+ */
+struct SearchStats {
+    enum Phase {Traversal, IndexFilter, OpenRead, Decoding, Matching, Indexing, Merging, PHASE_COUNT};
+
+    std::atomic<int64_t> phase_ns[PHASE_COUNT] = {};
+    std::atomic<int64_t> wall_ns{0};
+    std::atomic<int64_t> cpu_ns{0};
+    std::atomic<int64_t> workers{0};
+    std::atomic<int64_t> worker_wall_ns{0};
+    std::atomic<int64_t> worker_busy_ns{0};
+
+    // listed by traversal, or let through or rejected by the trigram filter
+    std::atomic<int64_t> files_listed{0};
+    std::atomic<int64_t> candidates{0};
+    std::atomic<int64_t> rejected{0};
+    // candidates that turned out not to contain any pattern
+    std::atomic<int64_t> false_positives{0};
+
+    std::atomic<int64_t> files_opened{0};
+    std::atomic<int64_t> unreadable{0};
+    std::atomic<int64_t> binary{0};
+    // sizes of the files opened, of the candidate ranges for a blocked file, whether or not
+    // all of it was read: binaries are only sniffed and FirstMatch stops early
+    std::atomic<int64_t> bytes_opened{0};
+    std::atomic<int64_t> files_matched{0};
+    std::atomic<int64_t> matches{0};
+    // files not read because their content was known to be another file's
+    std::atomic<int64_t> duplicates{0};
+
+    void add(Phase phase, int64_t ns) {
+        phase_ns[phase].fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    static void add(std::atomic<int64_t>& counter, int64_t value = 1) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    QJsonObject to_json() const;
+    QString to_text() const;
+
+    static char const* phase_name(Phase phase);
+};
+
+
+// adds the wall time of its scope to a phase; does nothing without stats
+class PhaseTimer {
+public:
+    PhaseTimer(SearchStats* stats, SearchStats::Phase phase)
+        : stats(stats), phase(phase), start(stats != nullptr ? monotonic_ns() : 0) {}
+
+    ~PhaseTimer() {
+        if (stats != nullptr) {
+            stats->add(phase, monotonic_ns() - start);
+        }
+    }
+
+private:
+    SearchStats* stats;
+    SearchStats::Phase phase;
+    int64_t start;
+};
+
+
+/*
+ * Accounts for a thread taking part: its CPU time in the scope goes to
+ * cpu_ns. The scope of a Driver is the whole operation (wall_ns), a Worker's
+ * is its lifetime (worker_wall_ns); a Step is any other piece of work, such
+ * as a listing thread, and only adds CPU time.
+ */
+class ThreadClock {
+public:
+    enum Role {Driver, Worker, Step};
+
+    ThreadClock(SearchStats* stats, Role role)
+        : stats(stats), role(role),
+          wall(stats != nullptr ? monotonic_ns() : 0), cpu(stats != nullptr ? thread_cpu_ns() : 0) {}
+
+    ~ThreadClock() {
+        if (stats == nullptr) {
+            return;
+        }
+        SearchStats::add(stats->cpu_ns, thread_cpu_ns() - cpu);
+        if (role == Driver) {
+            SearchStats::add(stats->wall_ns, monotonic_ns() - wall);
+        } else if (role == Worker) {
+            SearchStats::add(stats->worker_wall_ns, monotonic_ns() - wall);
+            SearchStats::add(stats->workers);
+        }
+    }
+
+private:
+    SearchStats* stats;
+    Role role;
+    int64_t wall;
+    int64_t cpu;
+};
+
+#endif // SEARCHSTATS_H
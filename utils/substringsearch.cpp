@@ -0,0 +1,107 @@
+#include "substringsearch.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SUBSTRING_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+
+namespace {
+#ifdef SUBSTRING_SEARCH_X86
+    /*
+     * Block positions i where haystack[i] == needle[0] and
+     * haystack[i + n - 1] == needle[n - 1] are verified with memcmp.
+     * movemask yields one bit per byte, so for uint16_t only every second bit
+     * is kept. The tail shorter than a block is searched element by element.
+     */
+    template <typename T>
+    T const* find_sse2(T const* begin, T const* end, T const* needle, size_t n) {
+        const size_t WIDTH = 16 / sizeof(T);
+        const size_t middle = n > 2 ? (n - 2) * sizeof(T) : 0;
+        __m128i first = sizeof(T) == 1 ? _mm_set1_epi8(needle[0]) : _mm_set1_epi16(needle[0]);
+        __m128i last = sizeof(T) == 1 ? _mm_set1_epi8(needle[n - 1]) : _mm_set1_epi16(needle[n - 1]);
+
+        T const* i = begin;
+        for (; (size_t) (end - i) >= n - 1 + WIDTH; i += WIDTH) {
+            __m128i block_first = _mm_loadu_si128(reinterpret_cast<__m128i const*>(i));
+            __m128i block_last = _mm_loadu_si128(reinterpret_cast<__m128i const*>(i + n - 1));
+            __m128i equal = sizeof(T) == 1 ?
+                _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)) :
+                _mm_and_si128(_mm_cmpeq_epi16(block_first, first), _mm_cmpeq_epi16(block_last, last));
+            uint32_t mask = _mm_movemask_epi8(equal);
+            if (sizeof(T) == 2) {
+                mask &= 0x5555;
+            }
+            for (; mask != 0; mask &= mask - 1) {
+                T const* candidate = i + __builtin_ctz(mask) / sizeof(T);
+                if (std::memcmp(candidate + 1, needle + 1, middle) == 0) {
+                    return candidate;
+                }
+            }
+        }
+        return std::search(i, end, needle, needle + n);
+    }
+
+    template <typename T>
+    __attribute__((target("avx2")))
+    T const* find_avx2(T const* begin, T const* end, T const* needle, size_t n) {
+        const size_t WIDTH = 32 / sizeof(T);
+        const size_t middle = n > 2 ? (n - 2) * sizeof(T) : 0;
+        __m256i first = sizeof(T) == 1 ? _mm256_set1_epi8(needle[0]) : _mm256_set1_epi16(needle[0]);
+        __m256i last = sizeof(T) == 1 ? _mm256_set1_epi8(needle[n - 1]) : _mm256_set1_epi16(needle[n - 1]);
+
+        T const* i = begin;
+        for (; (size_t) (end - i) >= n - 1 + WIDTH; i += WIDTH) {
+            __m256i block_first = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(i));
+            __m256i block_last = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(i + n - 1));
+            __m256i equal = sizeof(T) == 1 ?
+                _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)) :
+                _mm256_and_si256(_mm256_cmpeq_epi16(block_first, first), _mm256_cmpeq_epi16(block_last, last));
+            uint32_t mask = _mm256_movemask_epi8(equal);
+            if (sizeof(T) == 2) {
+                mask &= 0x55555555;
+            }
+            for (; mask != 0; mask &= mask - 1) {
+                T const* candidate = i + __builtin_ctz(mask) / sizeof(T);
+                if (std::memcmp(candidate + 1, needle + 1, middle) == 0) {
+                    return candidate;
+                }
+            }
+        }
+        return std::search(i, end, needle, needle + n);
+    }
+
+    bool has_avx2() {
+        static const bool result = __builtin_cpu_supports("avx2");
+        return result;
+    }
+#endif
+}
+
+template <typename T>
+SubstringSearcher<T>::SubstringSearcher(T const* begin, T const* end)
+    : needle(begin, end) {
+
+#ifdef SUBSTRING_SEARCH_X86
+    if (!needle.empty() && needle.size() <= LONG_NEEDLE) {
+        kernel = has_avx2() ? &find_avx2<T> : &find_sse2<T>;
+        return;
+    }
+#endif
+    fallback = std::make_unique<std::boyer_moore_horspool_searcher<T const*>>(
+            needle.data(), needle.data() + needle.size());
+}
+
+template <typename T>
+T const* SubstringSearcher<T>::find(T const* begin, T const* end) const {
+    if (kernel != nullptr) {
+        return kernel(begin, end, needle.data(), needle.size());
+    }
+    return std::search(begin, end, *fallback);
+}
+
+template class SubstringSearcher<uint8_t>;
+template class SubstringSearcher<uint16_t>;
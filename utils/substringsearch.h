@@ -0,0 +1,41 @@
+#ifndef SUBSTRINGSEARCH_H
+#define SUBSTRINGSEARCH_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * Finds a fixed needle in a haystack of bytes (uint8_t) or UTF-16 code units
+ * (uint16_t). Short needles use a vectorized kernel that compares the first
+ * and the last needle element against a whole block of the haystack at once
+ * and only verifies positions where both match; AVX2 is used when the CPU has
+ * it, SSE2 otherwise. Needles longer than LONG_NEEDLE, where skipping ahead
+ * pays off, and builds for other architectures use Boyer-Moore-Horspool.
+ */
+template <typename T>
+class SubstringSearcher {
+public:
+    static const size_t LONG_NEEDLE = 64;
+
+    SubstringSearcher(T const* begin, T const* end);
+
+    // first occurrence in [begin, end), or end
+    T const* find(T const* begin, T const* end) const;
+    size_t size() const { return needle.size(); }
+
+private:
+    typedef T const* (*kernel_type)(T const*, T const*, T const*, size_t);
+
+    std::vector<T> needle;
+    kernel_type kernel = nullptr;
+    std::unique_ptr<std::boyer_moore_horspool_searcher<T const*>> fallback;
+};
+
+extern template class SubstringSearcher<uint8_t>;
+extern template class SubstringSearcher<uint16_t>;
+
+#endif // SUBSTRINGSEARCH_H
@@ -0,0 +1,585 @@
+#include "trigramindex.h"
+#include "postinglist.h"
+#include "bloomfilter.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+
+
+std::vector<int64_t> string_trigrams(QString const& string, trigram_kind kind, bool ignore_case) {
+    std::vector<int64_t> result;
+    if (kind == ByteTrigrams) {
+        QByteArray bytes = string.toUtf8();
+        auto data = reinterpret_cast<uint8_t const*>(bytes.constData());
+        int64_t trigram = 0;
+        // bytes in a row that a trigram may be made of
+        int usable = 0;
+        for (int i = 0; i < bytes.size(); ++i) {
+            trigram = next_byte_trigram(trigram, data[i]);
+            uint8_t c = fold_ascii(data[i]);
+            usable = ignore_case && (c >= 0x80 || c == 'k' || c == 's') ? 0 : usable + 1;
+            if (usable >= 3) {
+                result.push_back(trigram);
+            }
+        }
+    } else if (string.size() >= 3) {
+        int64_t trigram = next_trigram(next_trigram(0, string[0]), string[1]);
+        for (int i = 2; i < string.size(); ++i) {
+            trigram = next_trigram(trigram, string[i]);
+            result.push_back(trigram);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+DirectoryIndex::DirectoryIndex() {
+    bind();
+}
+
+void DirectoryIndex::bind() {
+    names = name_storage;
+    name_offsets = name_offset_storage;
+    stamps = stamp_storage;
+    unindexed = unindexed_storage;
+    binaries = binary_storage;
+    keys = key_storage;
+    posting_offsets = posting_offset_storage;
+    postings = posting_storage;
+    blocked = blocked_storage;
+    block_offsets = block_offset_storage;
+    block_ends = block_end_storage;
+    bloom_offsets = bloom_offset_storage;
+    blooms = bloom_storage;
+    copies = copy_storage;
+    originals = original_storage;
+}
+
+void DirectoryIndex::add_name(QString const& file_name, FileStamp const& stamp) {
+    name_storage.insert(name_storage.end(), file_name.utf16(), file_name.utf16() + file_name.size());
+    name_offset_storage.push_back(name_storage.size());
+    stamp_storage.push_back(stamp);
+}
+
+// file_trigrams must be sorted and deduplicated
+uint32_t DirectoryIndex::add_file(QString const& file_name, FileStamp const& stamp,
+                                  std::vector<int64_t> const& file_trigrams) {
+    add_name(file_name, stamp);
+    trigrams.insert(trigrams.end(), file_trigrams.begin(), file_trigrams.end());
+    offsets.push_back(trigrams.size());
+    bind();
+    return file_count() - 1;
+}
+
+uint32_t DirectoryIndex::add_unindexed(QString const& file_name, FileStamp const& stamp) {
+    add_name(file_name, stamp);
+    offsets.push_back(trigrams.size());
+    unindexed_storage.push_back(name_offset_storage.size() - 2);
+    bind();
+    return file_count() - 1;
+}
+
+uint32_t DirectoryIndex::add_binary(QString const& file_name, FileStamp const& stamp) {
+    add_name(file_name, stamp);
+    offsets.push_back(trigrams.size());
+    binary_storage.push_back(name_offset_storage.size() - 2);
+    bind();
+    return file_count() - 1;
+}
+
+// filters[...] holds the filter of every block in turn, filter_sizes[b] words each
+uint32_t DirectoryIndex::add_blocked(QString const& file_name, FileStamp const& stamp,
+                                     std::vector<BlockEnd> const& ends,
+                                     std::vector<uint64_t> const& filter_sizes,
+                                     std::vector<uint64_t> const& filters) {
+    add_name(file_name, stamp);
+    offsets.push_back(trigrams.size());
+    blocked_storage.push_back(name_offset_storage.size() - 2);
+    block_end_storage.insert(block_end_storage.end(), ends.begin(), ends.end());
+    block_offset_storage.push_back(block_end_storage.size());
+    for (auto i: filter_sizes) {
+        bloom_offset_storage.push_back(bloom_offset_storage.back() + i);
+    }
+    bloom_storage.insert(bloom_storage.end(), filters.begin(), filters.end());
+    bind();
+    return file_count() - 1;
+}
+
+// original is resolved to an id by invert(), the copy is unindexed if it isn't there by then
+uint32_t DirectoryIndex::add_copy(QString const& file_name, FileStamp const& stamp, QString const& original) {
+    add_name(file_name, stamp);
+    offsets.push_back(trigrams.size());
+    pending_copies.emplace_back(name_offset_storage.size() - 2, original);
+    bind();
+    return file_count() - 1;
+}
+
+void DirectoryIndex::copy_blocks(DirectoryIndex const& other, size_t j, uint32_t file) {
+    blocked_storage.push_back(file);
+    for (uint64_t b = other.block_offsets[j]; b < other.block_offsets[j + 1]; ++b) {
+        block_end_storage.push_back(other.block_ends[b]);
+        bloom_storage.insert(bloom_storage.end(), other.blooms.begin() + other.bloom_offsets[b],
+                             other.blooms.begin() + other.bloom_offsets[b + 1]);
+        bloom_offset_storage.push_back(bloom_storage.size());
+    }
+    block_offset_storage.push_back(block_end_storage.size());
+}
+
+void DirectoryIndex::append(DirectoryIndex const& other) {
+    uint32_t file_shift = name_offset_storage.size() - 1;
+    uint64_t name_shift = name_storage.size();
+    uint64_t trigram_shift = trigrams.size();
+    name_storage.insert(name_storage.end(), other.name_storage.begin(), other.name_storage.end());
+    for (size_t i = 1; i < other.name_offset_storage.size(); ++i) {
+        name_offset_storage.push_back(other.name_offset_storage[i] + name_shift);
+    }
+    stamp_storage.insert(stamp_storage.end(), other.stamp_storage.begin(), other.stamp_storage.end());
+    trigrams.insert(trigrams.end(), other.trigrams.begin(), other.trigrams.end());
+    for (size_t i = 1; i < other.offsets.size(); ++i) {
+        offsets.push_back(other.offsets[i] + trigram_shift);
+    }
+    for (auto i: other.unindexed_storage) {
+        unindexed_storage.push_back(i + file_shift);
+    }
+    for (auto i: other.binary_storage) {
+        binary_storage.push_back(i + file_shift);
+    }
+    for (size_t j = 0; j < other.blocked.size; ++j) {
+        copy_blocks(other, j, other.blocked[j] + file_shift);
+    }
+    for (auto const& i: other.pending_copies) {
+        pending_copies.emplace_back(i.first + file_shift, i.second);
+    }
+    bind();
+}
+
+void DirectoryIndex::resolve_copies() {
+    if (pending_copies.empty()) {
+        return;
+    }
+    QHash<QString, uint32_t> ids;
+    for (uint32_t i = 0; i < file_count(); ++i) {
+        ids.insert(file_name(i), i);
+    }
+    std::map<uint32_t, uint32_t> resolved;
+    for (auto const& i: pending_copies) {
+        auto original = ids.constFind(i.second);
+        resolved[i.first] = original != ids.constEnd() ? *original : i.first;
+    }
+    // a hard link may name a file that turned out to be a copy itself, the chain ends at a real file
+    bool unindexed_added = false;
+    for (auto const& i: resolved) {
+        uint32_t original = i.second;
+        for (size_t steps = 0; original != i.first && steps < resolved.size(); ++steps) {
+            auto next = resolved.find(original);
+            if (next == resolved.end()) {
+                break;
+            }
+            original = next->second;
+        }
+        if (original != i.first && resolved.count(original) == 0) {
+            copy_storage.push_back(i.first);
+            original_storage.push_back(original);
+        } else {
+            unindexed_storage.push_back(i.first);
+            unindexed_added = true;
+        }
+    }
+    if (unindexed_added) {
+        std::sort(unindexed_storage.begin(), unindexed_storage.end());
+    }
+    pending_copies.clear();
+    bind();
+}
+
+void DirectoryIndex::invert() {
+    resolve_copies();
+    key_storage = trigrams;
+    std::sort(key_storage.begin(), key_storage.end());
+    key_storage.erase(std::unique(key_storage.begin(), key_storage.end()), key_storage.end());
+    key_storage.shrink_to_fit();
+
+    std::vector<uint64_t> list_offsets(key_storage.size() + 1, 0);
+    std::vector<uint32_t> position(trigrams.size());
+    for (size_t i = 0; i < trigrams.size(); ++i) {
+        position[i] = std::lower_bound(key_storage.begin(), key_storage.end(), trigrams[i]) - key_storage.begin();
+        ++list_offsets[position[i] + 1];
+    }
+    for (size_t i = 1; i < list_offsets.size(); ++i) {
+        list_offsets[i] += list_offsets[i - 1];
+    }
+
+    // files are visited in id order, so every posting list comes out sorted
+    std::vector<uint64_t> filled(list_offsets.begin(), list_offsets.end() - 1);
+    std::vector<uint32_t> lists(trigrams.size());
+    for (uint32_t file = 0; file + 1 < offsets.size(); ++file) {
+        for (uint64_t i = offsets[file]; i < offsets[file + 1]; ++i) {
+            lists[filled[position[i]]++] = file;
+        }
+    }
+
+    posting_storage.clear();
+    posting_offset_storage = {0};
+    posting_offset_storage.reserve(key_storage.size() + 1);
+    for (size_t k = 0; k < key_storage.size(); ++k) {
+        posting_list::encode(lists.data() + list_offsets[k], lists.data() + list_offsets[k + 1], posting_storage);
+        posting_offset_storage.push_back(posting_storage.size());
+    }
+    posting_storage.shrink_to_fit();
+
+    offsets = {0};
+    offsets.shrink_to_fit();
+    trigrams.clear();
+    trigrams.shrink_to_fit();
+    bind();
+}
+
+/*
+ * Files of `previous` marked in `keep` keep their trigrams and relative order
+ * and are followed by the freshly read files of `fresh`. Since both id
+ * mappings are monotonic, posting lists only need to be filtered and
+ * concatenated, never re-sorted.
+ */
+DirectoryIndex DirectoryIndex::updated(DirectoryIndex const& previous, std::vector<bool> const& keep,
+                                       DirectoryIndex& fresh) {
+    const uint32_t DROPPED = UINT32_MAX;
+    fresh.invert();
+    DirectoryIndex result;
+    std::vector<uint32_t> remap(previous.file_count(), DROPPED);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < previous.file_count(); ++i) {
+        if (keep[i]) {
+            remap[i] = kept++;
+            result.add_name(previous.file_name(i), previous.stamps[i]);
+        }
+    }
+    for (auto i: previous.unindexed) {
+        if (remap[i] != DROPPED) {
+            result.unindexed_storage.push_back(remap[i]);
+        }
+    }
+    for (uint32_t i = 0; i < fresh.file_count(); ++i) {
+        result.add_name(fresh.file_name(i), fresh.stamps[i]);
+    }
+    for (auto i: fresh.unindexed) {
+        result.unindexed_storage.push_back(i + kept);
+    }
+    for (auto i: previous.binaries) {
+        if (remap[i] != DROPPED) {
+            result.binary_storage.push_back(remap[i]);
+        }
+    }
+    for (auto i: fresh.binaries) {
+        result.binary_storage.push_back(i + kept);
+    }
+    for (size_t j = 0; j < previous.blocked.size; ++j) {
+        if (remap[previous.blocked[j]] != DROPPED) {
+            result.copy_blocks(previous, j, remap[previous.blocked[j]]);
+        }
+    }
+    for (size_t j = 0; j < fresh.blocked.size; ++j) {
+        result.copy_blocks(fresh, j, fresh.blocked[j] + kept);
+    }
+    // a kept copy whose original is gone is read again by the manager, this is only a safeguard
+    bool unindexed_added = false;
+    for (size_t j = 0; j < previous.copies.size; ++j) {
+        uint32_t copy = remap[previous.copies[j]];
+        if (copy == DROPPED) {
+            continue;
+        }
+        if (remap[previous.originals[j]] != DROPPED) {
+            result.copy_storage.push_back(copy);
+            result.original_storage.push_back(remap[previous.originals[j]]);
+        } else {
+            result.unindexed_storage.push_back(copy);
+            unindexed_added = true;
+        }
+    }
+    for (size_t j = 0; j < fresh.copies.size; ++j) {
+        result.copy_storage.push_back(fresh.copies[j] + kept);
+        result.original_storage.push_back(fresh.originals[j] + kept);
+    }
+    if (unindexed_added) {
+        std::sort(result.unindexed_storage.begin(), result.unindexed_storage.end());
+    }
+
+    auto previous_key = previous.keys.begin();
+    auto fresh_key = fresh.keys.begin();
+    std::vector<uint32_t> list;
+    while (previous_key != previous.keys.end() || fresh_key != fresh.keys.end()) {
+        int64_t key;
+        if (fresh_key == fresh.keys.end() ||
+                (previous_key != previous.keys.end() && *previous_key < *fresh_key)) {
+            key = *previous_key;
+        } else {
+            key = *fresh_key;
+        }
+
+        list.clear();
+        if (previous_key != previous.keys.end() && *previous_key == key) {
+            size_t k = previous_key++ - previous.keys.begin();
+            for (PostingCursor it(previous.postings.data + previous.posting_offsets[k],
+                                  previous.postings.data + previous.posting_offsets[k + 1]);
+                    it.valid(); it.next()) {
+                if (remap[it.value()] != DROPPED) {
+                    list.push_back(remap[it.value()]);
+                }
+            }
+        }
+        if (fresh_key != fresh.keys.end() && *fresh_key == key) {
+            size_t k = fresh_key++ - fresh.keys.begin();
+            for (PostingCursor it(fresh.postings.data + fresh.posting_offsets[k],
+                                  fresh.postings.data + fresh.posting_offsets[k + 1]);
+                    it.valid(); it.next()) {
+                list.push_back(it.value() + kept);
+            }
+        }
+
+        if (!list.empty()) {
+            result.key_storage.push_back(key);
+            posting_list::encode(list.data(), list.data() + list.size(), result.posting_storage);
+            result.posting_offset_storage.push_back(result.posting_storage.size());
+        }
+    }
+    result.bind();
+    return result;
+}
+
+size_t DirectoryIndex::file_count() const {
+    return name_offsets.empty() ? 0 : name_offsets.size - 1;
+}
+
+QString DirectoryIndex::file_name(uint32_t file) const {
+    return QString(reinterpret_cast<QChar const*>(names.data + name_offsets[file]),
+                   name_offsets[file + 1] - name_offsets[file]);
+}
+
+// needed must be sorted and deduplicated
+std::vector<uint32_t> DirectoryIndex::candidates(std::vector<int64_t> const& needed) const {
+    if (needed.empty()) {
+        std::vector<uint32_t> result(file_count());
+        std::iota(result.begin(), result.end(), 0);
+        return result;
+    }
+    std::vector<std::pair<uint8_t const*, uint8_t const*>> lists;
+    for (auto i: needed) {
+        auto key = std::lower_bound(keys.begin(), keys.end(), i);
+        if (key == keys.end() || *key != i) {
+            lists.clear();
+            break;
+        }
+        size_t k = key - keys.begin();
+        lists.emplace_back(postings.data + posting_offsets[k], postings.data + posting_offsets[k + 1]);
+    }
+    std::vector<uint32_t> result;
+    if (!lists.empty()) {
+        result = posting_list::intersect(lists);
+    }
+
+    // the length of the pattern is unknown here, so blocked files are only
+    // ruled out as a whole; ranges() narrows them down for the scan
+    std::vector<uint32_t> always(unindexed.begin(), unindexed.end());
+    for (auto i: blocked) {
+        if (!ranges(i, needed, UINT64_MAX).empty()) {
+            always.push_back(i);
+        }
+    }
+    std::inplace_merge(always.begin(), always.begin() + unindexed.size, always.end());
+
+    std::vector<uint32_t> merged;
+    std::set_union(result.begin(), result.end(), always.begin(), always.end(),
+                   std::back_inserter(merged));
+    return with_copies(merged);
+}
+
+// the sorted files and the copies of any of them
+std::vector<uint32_t> DirectoryIndex::with_copies(std::vector<uint32_t> const& files) const {
+    std::vector<uint32_t> found;
+    for (size_t j = 0; j < copies.size; ++j) {
+        if (std::binary_search(files.begin(), files.end(), originals[j])) {
+            found.push_back(copies[j]);
+        }
+    }
+    if (found.empty()) {
+        return files;
+    }
+    std::vector<uint32_t> merged;
+    std::set_union(files.begin(), files.end(), found.begin(), found.end(), std::back_inserter(merged));
+    return merged;
+}
+
+// the file whose content a copy has, any other file is its own
+uint32_t DirectoryIndex::original(uint32_t file) const {
+    auto copy = std::lower_bound(copies.begin(), copies.end(), file);
+    if (copy == copies.end() || *copy != file) {
+        return file;
+    }
+    return originals[copy - copies.begin()];
+}
+
+bool DirectoryIndex::is_blocked(uint32_t file) const {
+    return std::binary_search(blocked.begin(), blocked.end(), file);
+}
+
+// whether any block of the blocked file may contain the trigram
+bool DirectoryIndex::may_contain(uint32_t file, int64_t trigram) const {
+    size_t j = std::lower_bound(blocked.begin(), blocked.end(), file) - blocked.begin();
+    uint64_t hash = bloom_filter::hash(trigram);
+    for (uint64_t b = block_offsets[j]; b < block_offsets[j + 1]; ++b) {
+        if (bloom_filter::contains(blooms.data + bloom_offsets[b], bloom_offsets[b + 1] - bloom_offsets[b], hash)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Byte ranges of a blocked file that may hold a match of pattern_bytes bytes
+ * with the needed trigrams, merged and in file order; empty if it can't hold
+ * any. A pattern longer than a block may span any number of them, so it only
+ * decides about the whole file.
+ */
+std::vector<DirectoryIndex::BlockRange> DirectoryIndex::ranges(uint32_t file, std::vector<int64_t> const& needed,
+                                                               uint64_t pattern_bytes) const {
+    std::vector<BlockRange> result;
+    size_t j = std::lower_bound(blocked.begin(), blocked.end(), file) - blocked.begin();
+    uint64_t first = block_offsets[j];
+    uint64_t last = block_offsets[j + 1];
+    if (first == last) {
+        return result;
+    }
+    std::vector<uint64_t> hashes;
+    for (auto i: needed) {
+        hashes.push_back(bloom_filter::hash(i));
+    }
+    auto holds = [this](uint64_t block, uint64_t hash) {
+        return bloom_filter::contains(blooms.data + bloom_offsets[block],
+                                      bloom_offsets[block + 1] - bloom_offsets[block], hash);
+    };
+
+    if (pattern_bytes > BLOCK_SIZE) {
+        for (auto h: hashes) {
+            bool found = false;
+            for (uint64_t b = first; b < last && !found; ++b) {
+                found = holds(b, h);
+            }
+            if (!found) {
+                return result;
+            }
+        }
+        result.push_back({0, block_ends[last - 1].bytes, 0, 0});
+        return result;
+    }
+
+    for (uint64_t b = first; b < last; ++b) {
+        bool candidate = std::all_of(hashes.begin(), hashes.end(), [&](uint64_t h) {
+            return holds(b, h) || (b + 1 < last && holds(b + 1, h));
+        });
+        if (!candidate) {
+            continue;
+        }
+        BlockEnd start = b == first ? BlockEnd{0, 0, 0} : block_ends[b - 1];
+        uint64_t end = block_ends[std::min(b + 2, last) - 1].bytes;
+        if (!result.empty() && result.back().end >= start.bytes) {
+            result.back().end = std::max(result.back().end, end);
+        } else {
+            result.push_back({start.bytes, end, start.units, start.lines});
+        }
+    }
+    return result;
+}
+
+size_t DirectoryIndex::posting_count() const {
+    size_t result = 0;
+    for (size_t k = 0; k < keys.size; ++k) {
+        result += PostingCursor(postings.data + posting_offsets[k],
+                                postings.data + posting_offsets[k + 1]).size();
+    }
+    return result;
+}
+
+size_t DirectoryIndex::memory_usage() const {
+    size_t result = sizeof(DirectoryIndex);
+    result += names.size * sizeof(ushort);
+    result += name_offsets.size * sizeof(uint64_t);
+    result += stamps.size * sizeof(FileStamp);
+    result += unindexed.size * sizeof(uint32_t);
+    result += binaries.size * sizeof(uint32_t);
+    result += offsets.capacity() * sizeof(uint64_t);
+    result += trigrams.capacity() * sizeof(int64_t);
+    result += keys.size * sizeof(int64_t);
+    result += posting_offsets.size * sizeof(uint64_t);
+    result += postings.size;
+    result += blocked.size * sizeof(uint32_t);
+    result += block_offsets.size * sizeof(uint64_t);
+    result += block_ends.size * sizeof(BlockEnd);
+    result += bloom_offsets.size * sizeof(uint64_t);
+    result += blooms.size * sizeof(uint64_t);
+    result += copies.size * sizeof(uint32_t);
+    result += originals.size * sizeof(uint32_t);
+    return result;
+}
+
+// estimate of the former std::map<QString, std::set<int64_t>> layout:
+// a 48-byte red-black tree node per trigram and a map node with a set per file
+size_t DirectoryIndex::legacy_memory_usage() const {
+    const size_t SET_NODE = 48;
+    const size_t MAP_NODE = 96;
+    size_t result = (trigrams.size() + posting_count()) * SET_NODE;
+    result += file_count() * MAP_NODE + names.size * sizeof(QChar);
+    return result;
+}
+
+void TrigramIndex::merge(TrigramIndex const& other) {
+    for (auto const& i: other.directories) {
+        directories[i.first].append(i.second);
+    }
+}
+
+void TrigramIndex::invert() {
+    for (auto& i: directories) {
+        i.second.invert();
+    }
+}
+
+// an index without the ByteIndex parameter, such as a new empty one, is an index of characters
+trigram_kind TrigramIndex::kind() const {
+    auto byte_index = params.find(parameters::ByteIndex);
+    return byte_index != params.end() && byte_index->second ? ByteTrigrams : CharTrigrams;
+}
+
+size_t TrigramIndex::file_count() const {
+    size_t result = 0;
+    for (auto const& i: directories) {
+        result += i.second.file_count();
+    }
+    return result;
+}
+
+size_t TrigramIndex::trigram_count() const {
+    size_t result = 0;
+    for (auto const& i: directories) {
+        result += i.second.posting_count();
+    }
+    return result;
+}
+
+size_t TrigramIndex::memory_usage() const {
+    size_t result = sizeof(TrigramIndex);
+    for (auto const& i: directories) {
+        result += i.second.memory_usage();
+    }
+    return result;
+}
+
+size_t TrigramIndex::legacy_memory_usage() const {
+    size_t result = 0;
+    for (auto const& i: directories) {
+        result += i.second.legacy_memory_usage();
+    }
+    return result;
+}
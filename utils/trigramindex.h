@@ -0,0 +1,206 @@
+#ifndef TRIGRAMINDEX_H
+#define TRIGRAMINDEX_H
+
+#include "parameters.h"
+#include "filestamp.h"
+#include "casefold.h"
+
+#include <QString>
+#include <QFile>
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+
+/*
+ * A trigram is three consecutive case-folded UTF-16 code units packed into
+ * the low 48 bits of an int64_t: c[i - 2] | c[i - 1] << 16 | c[i] << 32.
+ * Folding makes the index serve case-insensitive searches too; an exact
+ * search only gets a few more candidates.
+ */
+inline int64_t next_trigram(int64_t trigram, QChar c) {
+    return (trigram >> 16) + (((int64_t) fold_case(c.unicode())) << 32);
+}
+
+/*
+ * With the ByteIndex parameter trigrams are three consecutive bytes of UTF-8
+ * text, ASCII letters folded, in the low 24 bits:
+ * b[i - 2] | b[i - 1] << 8 | b[i] << 16. Files are indexed without being
+ * decoded, which only holds for valid UTF-8; anything else is unindexed.
+ */
+inline int64_t next_byte_trigram(int64_t trigram, uint8_t c) {
+    return (trigram >> 8) | (int64_t(fold_ascii(c)) << 16);
+}
+
+enum trigram_kind {CharTrigrams, ByteTrigrams};
+
+// byte trigrams of a case-insensitive search leave out those ASCII folding could miss, see ascii_foldable
+std::vector<int64_t> string_trigrams(QString const& string, trigram_kind kind = CharTrigrams,
+                                     bool ignore_case = false);
+
+
+template <typename T>
+struct array_view {
+    T const* data = nullptr;
+    size_t size = 0;
+
+    array_view() = default;
+    array_view(T const* data, size_t size) : data(data), size(size) {}
+    array_view(std::vector<T> const& vector) : data(vector.data()), size(vector.size()) {}
+
+    T const& operator[](size_t index) const { return data[index]; }
+    T const* begin() const { return data; }
+    T const* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+};
+
+
+/*
+ * Per-directory index. Workers fill the forward part: files are referenced by
+ * id, trigrams of file `id` are the sorted, deduplicated run
+ * trigrams[offsets[id]..offsets[id + 1]). invert() turns it into posting
+ * lists: file ids containing keys[k] are compressed (see postinglist.h) into
+ * postings[posting_offsets[k]..posting_offsets[k + 1]).
+ * Files that could not be indexed are kept as unindexed and always treated
+ * as candidates. Binary files are listed in binaries instead: they are never
+ * candidates, a search that reads binaries takes them from there. stamps[id]
+ * is what the file looked like when it was indexed, so an update only has to
+ * re-read files whose stamp changed.
+ *
+ * Large files are indexed in blocks of BLOCK_SIZE bytes instead: blocked
+ * lists their ids in order, blocks of blocked[j] are
+ * block_ends[block_offsets[j]..block_offsets[j + 1]) and block b is
+ * summarized by the Bloom filter blooms[bloom_offsets[b]..bloom_offsets[b + 1])
+ * of the trigrams ending in it (see bloomfilter.h). A match shorter than a
+ * block that starts in block b ends in b or b + 1, so only ranges of blocks
+ * whose pair of filters holds every needed trigram have to be scanned.
+ *
+ * Files whose content is the same as another's are copies: they have no
+ * trigrams or blocks of their own, copies lists their ids in order and
+ * originals[j] is the file copies[j] has the content of. A copy is a
+ * candidate whenever its original is, and is answered by the original's
+ * search as long as both have the stamps they had here, or are hard links
+ * to one file. Until invert() copies only know the name of their original.
+ *
+ * Queries only go through the array_view members, which point either into
+ * the storage below or into a mapped index file (see indexfile.h).
+ */
+struct DirectoryIndex {
+    static constexpr uint64_t BLOCK_SIZE = 1 << 20;
+
+    // where a block ends: a byte offset into the file, and the UTF-16 units
+    // and newlines of the text before it
+    struct BlockEnd {
+        uint64_t bytes;
+        uint64_t units;
+        uint64_t lines;
+    };
+
+    // a byte range of a file with the units and newlines before its start
+    struct BlockRange {
+        uint64_t begin;
+        uint64_t end;
+        uint64_t units;
+        uint64_t lines;
+    };
+
+    array_view<ushort> names;
+    array_view<uint64_t> name_offsets;
+    array_view<FileStamp> stamps;
+    array_view<uint32_t> unindexed;
+    array_view<uint32_t> binaries;
+    array_view<int64_t> keys;
+    array_view<uint64_t> posting_offsets;
+    array_view<uint8_t> postings;
+    array_view<uint32_t> blocked;
+    array_view<uint64_t> block_offsets;
+    array_view<BlockEnd> block_ends;
+    array_view<uint64_t> bloom_offsets;
+    array_view<uint64_t> blooms;
+    array_view<uint32_t> copies;
+    array_view<uint32_t> originals;
+
+    DirectoryIndex();
+    DirectoryIndex(DirectoryIndex const&) = delete;
+    DirectoryIndex(DirectoryIndex&&) = default;
+    DirectoryIndex& operator=(DirectoryIndex&&) = default;
+
+    uint32_t add_file(QString const& file_name, FileStamp const& stamp,
+                      std::vector<int64_t> const& file_trigrams);
+    uint32_t add_unindexed(QString const& file_name, FileStamp const& stamp);
+    uint32_t add_binary(QString const& file_name, FileStamp const& stamp);
+    uint32_t add_blocked(QString const& file_name, FileStamp const& stamp, std::vector<BlockEnd> const& ends,
+                         std::vector<uint64_t> const& filter_sizes, std::vector<uint64_t> const& filters);
+    uint32_t add_copy(QString const& file_name, FileStamp const& stamp, QString const& original);
+    void append(DirectoryIndex const& other);
+    void invert();
+
+    static DirectoryIndex updated(DirectoryIndex const& previous, std::vector<bool> const& keep,
+                                  DirectoryIndex& fresh);
+
+    size_t file_count() const;
+    QString file_name(uint32_t file) const;
+    std::vector<uint32_t> candidates(std::vector<int64_t> const& needed) const;
+    std::vector<uint32_t> with_copies(std::vector<uint32_t> const& files) const;
+    uint32_t original(uint32_t file) const;
+    bool is_blocked(uint32_t file) const;
+    bool may_contain(uint32_t file, int64_t trigram) const;
+    std::vector<BlockRange> ranges(uint32_t file, std::vector<int64_t> const& needed,
+                                   uint64_t pattern_bytes) const;
+
+    size_t posting_count() const;
+    size_t memory_usage() const;
+    size_t legacy_memory_usage() const;
+
+private:
+    void add_name(QString const& file_name, FileStamp const& stamp);
+    void bind();
+    void copy_blocks(DirectoryIndex const& other, size_t j, uint32_t file);
+    void resolve_copies();
+
+    std::vector<ushort> name_storage;
+    std::vector<uint64_t> name_offset_storage = {0};
+    std::vector<FileStamp> stamp_storage;
+    std::vector<uint32_t> unindexed_storage;
+    std::vector<uint32_t> binary_storage;
+
+    std::vector<uint64_t> offsets = {0};
+    std::vector<int64_t> trigrams;
+
+    std::vector<int64_t> key_storage;
+    std::vector<uint64_t> posting_offset_storage = {0};
+    std::vector<uint8_t> posting_storage;
+
+    std::vector<uint32_t> blocked_storage;
+    std::vector<uint64_t> block_offset_storage = {0};
+    std::vector<BlockEnd> block_end_storage;
+    std::vector<uint64_t> bloom_offset_storage = {0};
+    std::vector<uint64_t> bloom_storage;
+
+    std::vector<std::pair<uint32_t, QString>> pending_copies;
+    std::vector<uint32_t> copy_storage;
+    std::vector<uint32_t> original_storage;
+};
+
+
+class TrigramIndex {
+public:
+    std::map<QString, DirectoryIndex> directories;
+    std::map<parameters, bool> params;
+
+    // keeps a mapped index file alive for as long as views point into it
+    std::shared_ptr<QFile> mapping;
+
+    void merge(TrigramIndex const& other);
+    void invert();
+    trigram_kind kind() const;
+
+    size_t file_count() const;
+    size_t trigram_count() const;
+    size_t memory_usage() const;
+    size_t legacy_memory_usage() const;
+};
+
+#endif // TRIGRAMINDEX_H
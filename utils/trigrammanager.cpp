@@ -1,54 +1,262 @@
 #include "trigrammanager.h"
 
 #include <QThread>
+#include <QFileInfo>
+
+#include <algorithm>
 
 TrigramManager::TrigramManager(QObject *parent) : QObject(parent) {}
 
-TrigramManager::~TrigramManager() {}
+// a canceled manager may go before its collector noticed
+TrigramManager::~TrigramManager() {
+    stopping = true;
+    if (queue != nullptr) {
+        queue->close();
+    }
+    if (collector.joinable()) {
+        collector.join();
+    }
+}
 
-TrigramManager::TrigramManager(std::set<QString> const& directories, std::map<parameters, bool> const& params)
+TrigramManager::TrigramManager(std::set<QString> const& directories, std::map<parameters, bool> const& params,
+                               TrigramIndex const* previous)
     : params(params),
-      directories(directories) {
+      directories(directories),
+      previous(previous) {
 
-    iterator_flags = params.at(parameters::Recursive) ?
-        QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags;
-    directory_flags = {QDir::NoDotAndDotDot, QDir::Files};
-    if (params.at(parameters::Hidden)) {
-        directory_flags |= QDir::Hidden;
-    }
-    trigrams = new std::map<QString, std::map<QString, std::set<int64_t>>>;
+    trigrams = new TrigramIndex();
+    trigrams->params = params;
+    qRegisterMetaType<TrigramIndex*>("TrigramIndex*");
 }
 
+/*
+ * Files whose stamp matches the previous index are kept as they are. The
+ * workers start right away and index files while the collector thread is
+ * still listing the rest; files with the content of one read before in
+ * this build are added as its copies.
+ */
 void TrigramManager::manage_trigrams() {
-    for (auto directory_name: directories) {
+    const size_t QUEUE_SIZE = 1 << 12;
+    started = stats != nullptr ? monotonic_ns() : 0;
+    for (auto const& directory_name: directories) {
         sizes[directory_name] = 0;
         scan_progress[directory_name] = 0;
-        for (QDirIterator it(directory_name, directory_flags, iterator_flags); it.hasNext(); ) {
-            it.next();
-            files.emplace_back(it.fileInfo().size(), std::make_pair(directory_name, it.filePath()));
-            sizes[directory_name]++;
-            if (QThread::currentThread()->isInterruptionRequested()) {
+        // files indexed as the other kind of trigrams are indexed again
+        if (previous != nullptr && previous->kind() == trigrams->kind() &&
+                previous->directories.count(directory_name) > 0) {
+            DirectoryIndex const& indexed = previous->directories.at(directory_name);
+            unchanged[directory_name].assign(indexed.file_count(), false);
+            QHash<QString, uint32_t>& directory_ids = ids[directory_name];
+            for (uint32_t i = 0; i < indexed.file_count(); ++i) {
+                directory_ids.insert(indexed.file_name(i), i);
+            }
+        }
+    }
+
+    queue = std::make_shared<BoundedQueue<std::pair<QString, QString>>>(QUEUE_SIZE);
+    duplicates = std::make_shared<DuplicateFinder>();
+    for (size_t i = 0; i < thread_count(threads); ++i) {
+        worker.push_back(make_worker(queue));
+    }
+    collecting = true;
+    collector = std::thread([this] { collect(); });
+}
+
+void TrigramManager::set_changes(std::map<QString, std::set<QString>> const& changed_paths) {
+    changes = changed_paths;
+}
+
+// 0 means one thread per core
+void TrigramManager::set_thread_count(int count) {
+    threads = count;
+}
+
+// nullptr turns collection off
+void TrigramManager::set_stats(std::shared_ptr<SearchStats> const& stats) {
+    this->stats = stats;
+}
+
+// nullptr indexes every file
+void TrigramManager::set_filter(std::shared_ptr<PathFilter const> const& filter) {
+    this->filter = filter;
+}
+
+// runs on the collector thread; closing the queue lets the workers finish
+void TrigramManager::collect() {
+    {
+        ThreadClock clock(stats.get(), ThreadClock::Step);
+        std::vector<QString> directory_names;
+        std::vector<QString> paths;
+        for (auto const& directory_name: directories) {
+            if (ids.count(directory_name) > 0 && changes.count(directory_name) > 0 &&
+                    !changes[directory_name].empty()) {
+                collect_changed(directory_name, changes[directory_name], directory_names, paths);
+            } else {
+                directory_names.push_back(directory_name);
+                paths.push_back(directory_name);
+            }
+            if (stopping) {
+                break;
+            }
+        }
+        if (!stopping) {
+            collect_directories(directory_names, paths);
+        }
+        if (!stopping) {
+            collect_orphans();
+        }
+    }
+    if (stats != nullptr) {
+        SearchStats::add(stats->files_listed, listed);
+    }
+    collecting = false;
+    queue->close();
+}
+
+// paths[i] is listed into directory_names[i]
+void TrigramManager::collect_directories(std::vector<QString> const& directory_names,
+                                         std::vector<QString> const& paths) {
+    DirectoryWalker walker(params, threads);
+    walker.set_stats(stats.get());
+    walker.set_filter(filter);
+    walker.walk(paths, [&](size_t root, QString const& path, int64_t, FileId const&) {
+        return !stopping && collect_file(directory_names[root], path);
+    }, DirectoryWalker::Done(), directory_names);
+}
+
+/*
+ * Only the given paths are looked at, everything else in the previous index
+ * is kept. A path that is now a directory or is gone may have been a
+ * directory, so indexed files below it are dropped before re-reading it.
+ * Directories among the paths are added to the ones left to list.
+ */
+void TrigramManager::collect_changed(QString const& directory_name, std::set<QString> const& paths,
+                                     std::vector<QString>& directory_names, std::vector<QString>& subdirectories) {
+    PhaseTimer traversal(stats.get(), SearchStats::Traversal);
+    DirectoryIndex const& indexed = previous->directories.at(directory_name);
+    QHash<QString, uint32_t> const& directory_ids = ids[directory_name];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<bool>& keep = unchanged[directory_name];
+        keep.assign(indexed.file_count(), true);
+
+        QSet<QString> gone;
+        for (auto const& i: paths) {
+            auto id = directory_ids.constFind(i);
+            if (id != directory_ids.constEnd()) {
+                keep[*id] = false;
+            }
+            QFileInfo info(i);
+            if (info.isDir() || !info.exists()) {
+                gone.insert(i);
+            }
+        }
+        if (!gone.isEmpty()) {
+            for (uint32_t i = 0; i < indexed.file_count(); ++i) {
+                QString name = indexed.file_name(i);
+                for (int slash = name.lastIndexOf('/'); slash > directory_name.size();
+                     slash = name.lastIndexOf('/', slash - 1)) {
+                    if (gone.contains(name.left(slash))) {
+                        keep[i] = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto const& i: paths) {
+        QFileInfo info(i);
+        if (!visible(directory_name, i, info)) {
+            continue;
+        }
+        if (info.isDir() && params.at(parameters::Recursive)) {
+            directory_names.push_back(directory_name);
+            subdirectories.push_back(i);
+        } else if (info.isFile() && (params.at(parameters::Recursive) || info.path() == directory_name)) {
+            if (!collect_file(directory_name, i)) {
                 return;
             }
         }
-        if (sizes[directory_name] == 0) {
-            emit throw_progress(directory_name, 100);
+    }
+}
+
+// called from the listing threads; false once indexing was canceled
+bool TrigramManager::collect_file(QString const& directory_name, QString const& file_name) {
+    auto directory_ids = ids.find(directory_name);
+    if (directory_ids != ids.end()) {
+        auto id = directory_ids->second.constFind(file_name);
+        if (id != directory_ids->second.constEnd()) {
+            bool same = previous->directories.at(directory_name).stamps[*id] == file_stamp(file_name);
+            std::lock_guard<std::mutex> lock(mutex);
+            unchanged[directory_name][*id] = same;
+            if (same) {
+                return true;
+            }
         }
     }
+    return schedule(directory_name, file_name);
+}
+
+bool TrigramManager::schedule(QString const& directory_name, QString const& file_name) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        QSet<QString>& directory_scheduled = scheduled[directory_name];
+        if (directory_scheduled.contains(file_name)) {
+            return true;
+        }
+        directory_scheduled.insert(file_name);
+        sizes[directory_name]++;
+        ++listed;
+    }
+    return queue->push({directory_name, file_name});
+}
 
-    size_t thread_quantity = std::min((size_t) 6, files.size());
+/*
+ * A kept copy has no trigrams of its own, so when its original is read
+ * again or is gone the copy has to be read as well.
+ */
+void TrigramManager::collect_orphans() {
+    for (auto& i: unchanged) {
+        DirectoryIndex const& indexed = previous->directories.at(i.first);
+        std::vector<QString> orphans;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<bool>& keep = i.second;
+            for (size_t j = 0; j < indexed.copies.size; ++j) {
+                if (keep[indexed.copies[j]] && !keep[indexed.originals[j]]) {
+                    keep[indexed.copies[j]] = false;
+                    orphans.push_back(indexed.file_name(indexed.copies[j]));
+                }
+            }
+        }
+        for (auto const& name: orphans) {
+            if (QFileInfo(name).isFile() && !schedule(i.first, name)) {
+                return;
+            }
+        }
+    }
+}
 
-    for (size_t i = 0; i < thread_quantity; ++i) {
-        worker.push_back(make_worker(i, thread_quantity));
+// whether the traversal of directory_name with the current parameters and filter would reach path
+bool TrigramManager::visible(QString const& directory_name, QString const& path, QFileInfo const& info) const {
+    if (!path.startsWith(directory_name + '/')) {
+        return false;
+    }
+    if (!params.at(parameters::Hidden) && path.mid(directory_name.size()).contains("/.")) {
+        return false;
     }
+    return filter == nullptr || filter->reaches(QFile::encodeName(directory_name), QFile::encodeName(path),
+                                                info.isDir(), info.size());
 }
 
-TrigramWorker* TrigramManager::make_worker(size_t index, size_t quantity) {
+TrigramWorker* TrigramManager::make_worker(std::shared_ptr<BoundedQueue<std::pair<QString, QString>>> const& queue) {
     TrigramWorker* new_worker = new TrigramWorker();
     QThread* thread = new QThread();
-    for (size_t i = (files.size() / 6) * index; i < (files.size() / 6) * (index + 1); ++i) { // ?
-        new_worker->files.push_back(files[i].second);
-    }
+    new_worker->files = queue;
+    new_worker->kind = trigrams->kind();
+    new_worker->stats = stats;
+    new_worker->duplicates = duplicates;
     new_worker->moveToThread(thread);
 
     connect(this, &TrigramManager::result, new_worker, &TrigramWorker::deleteLater);
@@ -59,12 +267,17 @@ TrigramWorker* TrigramManager::make_worker(size_t index, size_t quantity) {
     connect(new_worker, &TrigramWorker::throw_progress, this, &TrigramManager::progress);
     connect(new_worker, &TrigramWorker::files_processed, this, &TrigramManager::ready);
     connect(new_worker, &TrigramWorker::throw_error, this, &TrigramManager::catch_error);
+    connect(new_worker, &TrigramWorker::throw_binary, this, &TrigramManager::throw_binary);
     thread->start();
 
     return new_worker;
 }
 
 void TrigramManager::canceled() {
+    stopping = true;
+    if (queue != nullptr) {
+        queue->close();
+    }
     emit cancel();
     emit finished();
 }
@@ -73,16 +286,49 @@ void TrigramManager::catch_error(QString const& file_name) {
     emit throw_error(file_name);
 }
 
-void TrigramManager::ready(std::map<QString, std::map<QString, std::set<int64_t>>>* res) {
-    for (auto i: directories) {
-       (*trigrams)[i].insert((*res)[i].begin(), (*res)[i].end());
+void TrigramManager::ready(TrigramIndex* res) {
+    {
+        ThreadClock clock(stats.get(), ThreadClock::Step);
+        PhaseTimer merging(stats.get(), SearchStats::Merging);
+        trigrams->merge(*res);
     }
     if (++workers_ready == worker.size()) {
-        emit result(trigrams);
-        emit finished();
+        finish();
     }
 }
 
+void TrigramManager::finish() {
+    if (collector.joinable()) {
+        collector.join();
+    }
+    for (auto const& i: directories) {
+        emit throw_progress(i, 100);
+    }
+    {
+        ThreadClock clock(stats.get(), ThreadClock::Step);
+        PhaseTimer merging(stats.get(), SearchStats::Merging);
+        for (auto const& i: directories) {
+            if (unchanged.count(i) > 0) {
+                trigrams->directories[i] = DirectoryIndex::updated(previous->directories.at(i), unchanged[i],
+                                                                   trigrams->directories[i]);
+            } else {
+                trigrams->directories[i].invert();
+            }
+        }
+    }
+    if (stats != nullptr) {
+        SearchStats::add(stats->wall_ns, monotonic_ns() - started);
+    }
+    emit result(trigrams);
+    emit finished();
+}
+
+// an estimate while files are still being listed, so it stays below 100% until then
 void TrigramManager::progress(QString const& directory) {
-    emit throw_progress(directory, (double) ++scan_progress[directory] * 100 / sizes[directory]);
+    double value;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        value = (double) ++scan_progress[directory] * 100 / sizes[directory];
+    }
+    emit throw_progress(directory, collecting ? std::min(value, 99.0) : value);
 }
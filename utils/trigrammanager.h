@@ -3,14 +3,21 @@
 
 #include "trigramworker.h"
 #include "parameters.h"
+#include "searchstats.h"
+#include "directorywalker.h"
 
 #include <QObject>
-#include <QDir>
-#include <QDirIterator>
+#include <QHash>
+#include <QSet>
+#include <QFileInfo>
 
 #include <vector>
 #include <map>
 #include <set>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 
 class TrigramManager : public QObject {
@@ -18,13 +25,20 @@ class TrigramManager : public QObject {
 
 public:
     explicit TrigramManager(QObject *parent = nullptr);
-    TrigramManager(std::set<QString> const& directories, std::map<parameters, bool> const& params);
+    TrigramManager(std::set<QString> const& directories, std::map<parameters, bool> const& params,
+                   TrigramIndex const* previous = nullptr);
     ~TrigramManager();
 
+    void set_changes(std::map<QString, std::set<QString>> const& changed_paths);
+    void set_thread_count(int count);
+    void set_stats(std::shared_ptr<SearchStats> const& stats);
+    void set_filter(std::shared_ptr<PathFilter const> const& filter);
+
 signals:
-    void result(std::map<QString, std::map<QString, std::set<int64_t>>>* result);
+    void result(TrigramIndex* result);
     void throw_progress(QString const& directory, double progress);
     void throw_error(QString const& file_name);
+    void throw_binary(QString const& file_name);
     void finished();
     void cancel();
 
@@ -33,24 +47,51 @@ public slots:
     void canceled();
 
 private slots:
-    void ready(std::map<QString, std::map<QString, std::set<int64_t>>>* res);
+    void ready(TrigramIndex* res);
     void catch_error(QString const& file_name);
 
 private:
     void progress(QString const& directory);
-    TrigramWorker* make_worker(size_t index, size_t quantity);
+    void collect();
+    void collect_directories(std::vector<QString> const& directory_names, std::vector<QString> const& paths);
+    void collect_changed(QString const& directory_name, std::set<QString> const& paths,
+                         std::vector<QString>& directory_names, std::vector<QString>& subdirectories);
+    bool collect_file(QString const& directory_name, QString const& file_name);
+    bool schedule(QString const& directory_name, QString const& file_name);
+    void collect_orphans();
+    bool visible(QString const& directory_name, QString const& path, QFileInfo const& info) const;
+    void finish();
+    TrigramWorker* make_worker(std::shared_ptr<BoundedQueue<std::pair<QString, QString>>> const& queue);
 
-    QFlags<QDirIterator::IteratorFlag> iterator_flags;
-    QFlags<QDir::Filter> directory_flags;
-    std::map<QString, int> sizes;
     std::map<QString, int> scan_progress;
 
     std::map<parameters, bool> params;
-    std::vector<std::pair<int64_t, std::pair<QString, QString>>> files;
     std::set<QString> directories;
-    std::map<QString, std::map<QString, std::set<int64_t>>>* trigrams = nullptr;
+    TrigramIndex* trigrams = nullptr;
+    TrigramIndex const* previous = nullptr;
+    std::map<QString, std::set<QString>> changes;
+    // ids of the files in the previous index, read by the listing threads
+    std::map<QString, QHash<QString, uint32_t>> ids;
+
+    // files are listed on the collector thread and indexed by the workers as
+    // they come; mutex guards what the listing threads share with this one
+    std::shared_ptr<BoundedQueue<std::pair<QString, QString>>> queue;
+    std::thread collector;
+    std::atomic<bool> collecting{false};
+    std::atomic<bool> stopping{false};
+    std::mutex mutex;
+    std::map<QString, int> sizes;
+    std::map<QString, std::vector<bool>> unchanged;
+    std::map<QString, QSet<QString>> scheduled;
+    int64_t listed = 0;
+
+    int threads = 0;
     std::vector<TrigramWorker*> worker;
     size_t workers_ready = 0;
+    std::shared_ptr<SearchStats> stats;
+    std::shared_ptr<PathFilter const> filter;
+    std::shared_ptr<DuplicateFinder> duplicates;
+    int64_t started = 0;
 };
 
 #endif // TRIGRAMMANAGER_H
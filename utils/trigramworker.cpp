@@ -1,67 +1,356 @@
 #include "trigramworker.h"
+#include "bloomfilter.h"
+#include "linetracker.h"
 
 #include <QTextStream>
+#include <QTextCodec>
 #include <QThread>
 #include <QDir>
 #include <QFile>
 
+#include <algorithm>
+#include <vector>
+
+namespace {
+    const int UTF8_MIB = 106;
+    const int BUFFER_SIZE = 1 << 18;
+    const size_t MAXIMUM = 1 << 18;
+    const qint64 LARGE_FILE = 16 * DirectoryIndex::BLOCK_SIZE;
+
+    /*
+     * The end of the whole characters at the start of [begin, end), nullptr
+     * if the bytes aren't valid UTF-8. Overlong forms and surrogates are
+     * invalid too, decoding would replace them. A character cut off by end
+     * is left for the next buffer.
+     */
+    uint8_t const* valid_utf8(uint8_t const* begin, uint8_t const* end) {
+        while (begin != end) {
+            uint8_t c = *begin;
+            if (c < 0x80) {
+                ++begin;
+                continue;
+            }
+            int length = c >= 0xc2 && c <= 0xdf ? 2 : c >= 0xe0 && c <= 0xef ? 3 : c >= 0xf0 && c <= 0xf4 ? 4 : 0;
+            if (length == 0) {
+                return nullptr;
+            }
+            // the second byte is narrower after some first bytes
+            uint8_t low = c == 0xe0 ? 0xa0 : c == 0xf0 ? 0x90 : 0x80;
+            uint8_t high = c == 0xed ? 0x9f : c == 0xf4 ? 0x8f : 0xbf;
+            for (int i = 1; i < length; ++i) {
+                if (begin + i == end) {
+                    return begin;
+                }
+                if (begin[i] < (i == 1 ? low : 0x80) || begin[i] > (i == 1 ? high : 0xbf)) {
+                    return nullptr;
+                }
+            }
+            begin += length;
+        }
+        return end;
+    }
+}
+
 TrigramWorker::TrigramWorker(QObject *parent) : QObject(parent) {}
 
 TrigramWorker::~TrigramWorker() {}
 
 void TrigramWorker::process_files() {
-    for (auto i: files) {
-        process_file(i);
-        if (QThread::currentThread()->isInterruptionRequested()) {
-            break;
+    {
+        ThreadClock clock(stats.get(), ThreadClock::Worker);
+        int64_t busy = 0;
+        while (auto i = files->take()) {
+            int64_t start = stats != nullptr ? monotonic_ns() : 0;
+            process_file(*i);
+            if (stats != nullptr) {
+                busy += monotonic_ns() - start;
+            }
+            if (QThread::currentThread()->isInterruptionRequested()) {
+                break;
+            }
+            emit throw_progress(i->first);
+        }
+        if (stats != nullptr) {
+            SearchStats::add(stats->worker_busy_ns, busy);
+            stats->add(SearchStats::OpenRead, io_ns);
+            stats->add(SearchStats::Decoding, decode_ns);
+            stats->add(SearchStats::Indexing, busy - io_ns - decode_ns);
         }
-        emit throw_progress(i.first);
     }
     emit files_processed(&trigrams);
 }
 
+QByteArray TrigramWorker::read(QFile& file, qint64 size) {
+    if (stats == nullptr) {
+        return file.read(size);
+    }
+    int64_t start = monotonic_ns();
+    QByteArray result = file.read(size);
+    io_ns += monotonic_ns() - start;
+    return result;
+}
+
+QString TrigramWorker::read(QTextStream& stream, int size) {
+    if (stats == nullptr) {
+        return stream.read(size);
+    }
+    int64_t start = monotonic_ns();
+    QString result = stream.read(size);
+    decode_ns += monotonic_ns() - start;
+    return result;
+}
+
 void TrigramWorker::process_file(std::pair<QString, QString> const& file_directory) {
     auto [directory_name, file_name] = file_directory;
+    int64_t start = stats != nullptr ? monotonic_ns() : 0;
+    FileStamp stamp = file_stamp(file_name);
+    if (duplicates != nullptr) {
+        QString original = duplicates->original(directory_name, file_name, stamp.size);
+        if (!original.isEmpty()) {
+            trigrams.directories[directory_name].add_copy(file_name, stamp, original);
+            if (stats != nullptr) {
+                io_ns += monotonic_ns() - start;
+                SearchStats::add(stats->duplicates);
+            }
+            return;
+        }
+    }
     QFile file(file_name);
     if (!file.open(QFile::ReadOnly)) {
+        if (stats != nullptr) {
+            SearchStats::add(stats->unreadable);
+        }
         emit throw_error(file_name.right(file_name.size() - directory_name.size() +
                                          QDir(directory_name).dirName().size()));
         return;
     }
-    const int BUFFER_SIZE = 1 << 18;
-    const size_t MAXIMUM = 1 << 18;
+    bool binary = binary_file::is_binary(file);
+    if (stats != nullptr) {
+        io_ns += monotonic_ns() - start;
+        SearchStats::add(stats->files_opened);
+        SearchStats::add(stats->bytes_opened, file.size());
+        SearchStats::add(stats->binary, binary);
+    }
+    // binary files would only fill the index with noise, they are only read when searching binaries
+    if (binary) {
+        trigrams.directories[directory_name].add_binary(file_name, stamp);
+        emit throw_binary(file_name.right(file_name.size() - directory_name.size() +
+                                          QDir(directory_name).dirName().size()));
+        return;
+    }
+
+    if (kind == ByteTrigrams) {
+        process_bytes(file, directory_name, file_name, stamp);
+        return;
+    }
+
+    // large files would not fit one trigram set anyway, their blocks are summarized instead
+    if (file.size() >= LARGE_FILE && process_blocks(file, directory_name, file_name, stamp)) {
+        return;
+    }
 
     QTextStream stream(&file);
-    QString buffer = stream.read(BUFFER_SIZE);
+    QString buffer = read(stream, BUFFER_SIZE);
     auto data = buffer.data();
     if (buffer.size() < 3) {
+        trigrams.directories[directory_name].add_file(file_name, stamp, {});
         return;
     }
 
-    std::set<int64_t>* cur_set = &trigrams[directory_name][file_name];
-    cur_set->clear();
-    int64_t trigram = (((int64_t) data[0].unicode()) << 16) + (((int64_t) data[1].unicode()) << 32);
+    std::vector<int64_t> file_trigrams;
+    int64_t trigram = next_trigram(next_trigram(0, data[0]), data[1]);
+    int i = 2;
 
-    while (buffer.size() >= 3) {
-        for (int i = 2; i < buffer.size() && cur_set->size() < MAXIMUM; ++i) {
-            trigram = (trigram >> 16) + (((int64_t) data[i].unicode()) << 32);
-            cur_set->insert(trigram);
-
-            if (QThread::currentThread()->isInterruptionRequested()) {
-                break;
-            }
+    while (!buffer.isEmpty()) {
+        size_t unique = file_trigrams.size();
+        for (; i < buffer.size(); ++i) {
+            trigram = next_trigram(trigram, data[i]);
+            file_trigrams.push_back(trigram);
         }
         if (QThread::currentThread()->isInterruptionRequested()) {
-            break;
+            return;
         }
-        if (cur_set->size() == MAXIMUM) {
-            trigrams[directory_name].erase(file_name);
-            break;
+        std::sort(file_trigrams.begin() + unique, file_trigrams.end());
+        std::inplace_merge(file_trigrams.begin(), file_trigrams.begin() + unique, file_trigrams.end());
+        file_trigrams.erase(std::unique(file_trigrams.begin(), file_trigrams.end()), file_trigrams.end());
+        if (file_trigrams.size() >= MAXIMUM) {
+            if (!process_blocks(file, directory_name, file_name, stamp)) {
+                trigrams.directories[directory_name].add_unindexed(file_name, stamp);
+            }
+            return;
         }
-        buffer = stream.read(BUFFER_SIZE);
+        buffer = read(stream, BUFFER_SIZE);
         data = buffer.data();
+        i = 0;
     }
+    trigrams.directories[directory_name].add_file(file_name, stamp, file_trigrams);
     file.close();
 
     return;
 }
+
+/*
+ * With ByteIndex files are read as they are, and the trigrams of a buffer
+ * are picked out by a bitmap of all 2^24 of them rather than sorted away.
+ * A file is searched by decoding it with the locale codec, so its bytes only
+ * stand for its text when the codec is UTF-8 and the file valid UTF-8;
+ * anything else is unindexed instead of pruned by trigrams it doesn't have.
+ */
+void TrigramWorker::process_bytes(QFile& file, QString const& directory_name, QString const& file_name,
+                                  FileStamp const& stamp) {
+    QTextCodec* codec = QTextCodec::codecForLocale();
+    if (codec == nullptr || codec->mibEnum() != UTF8_MIB) {
+        trigrams.directories[directory_name].add_unindexed(file_name, stamp);
+        return;
+    }
+    if (file.size() >= LARGE_FILE && process_blocks(file, directory_name, file_name, stamp)) {
+        return;
+    }
+
+    std::vector<int64_t> file_trigrams;
+    int64_t trigram = 0;
+    uint64_t bytes = 0;
+    QByteArray buffer;
+    while (true) {
+        QByteArray next = read(file, BUFFER_SIZE);
+        if (next.isEmpty()) {
+            break;
+        }
+        buffer += next;
+        auto begin = reinterpret_cast<uint8_t const*>(buffer.constData());
+        uint8_t const* end = begin + buffer.size();
+        uint8_t const* valid = valid_utf8(begin, end);
+        if (valid == nullptr) {
+            forget(file_trigrams);
+            trigrams.directories[directory_name].add_unindexed(file_name, stamp);
+            return;
+        }
+        byte_trigrams(begin, valid, trigram, bytes, file_trigrams);
+        buffer.remove(0, valid - begin);
+        if (QThread::currentThread()->isInterruptionRequested()) {
+            forget(file_trigrams);
+            return;
+        }
+        if (file_trigrams.size() >= MAXIMUM) {
+            forget(file_trigrams);
+            if (!process_blocks(file, directory_name, file_name, stamp)) {
+                trigrams.directories[directory_name].add_unindexed(file_name, stamp);
+            }
+            return;
+        }
+    }
+    forget(file_trigrams);
+    // a character cut off by the end of the file
+    if (!buffer.isEmpty()) {
+        trigrams.directories[directory_name].add_unindexed(file_name, stamp);
+        return;
+    }
+    std::sort(file_trigrams.begin(), file_trigrams.end());
+    trigrams.directories[directory_name].add_file(file_name, stamp, file_trigrams);
+}
+
+// appends the byte trigrams ending in [begin, end) that aren't listed yet; bytes counts the bytes so far
+void TrigramWorker::byte_trigrams(uint8_t const* begin, uint8_t const* end, int64_t& trigram, uint64_t& bytes,
+                                  std::vector<int64_t>& list) {
+    if (seen.empty()) {
+        seen.assign((1 << 24) / 64, 0);
+    }
+    for (; begin != end; ++begin) {
+        trigram = next_byte_trigram(trigram, *begin);
+        if (++bytes >= 3) {
+            uint64_t& word = seen[trigram >> 6];
+            uint64_t bit = uint64_t(1) << (trigram & 63);
+            if ((word & bit) == 0) {
+                word |= bit;
+                list.push_back(trigram);
+            }
+        }
+    }
+}
+
+// clears the bits of a list, so the bitmap is empty for the next one
+void TrigramWorker::forget(std::vector<int64_t> const& list) {
+    for (auto i: list) {
+        seen[i >> 6] &= ~(uint64_t(1) << (i & 63));
+    }
+}
+
+/*
+ * Indexes a file in blocks (see DirectoryIndex). The mapped text is cut every
+ * BLOCK_SIZE bytes, moved forward to a character boundary, and every block is
+ * decoded on its own; the rolling trigram carries over, so a trigram belongs
+ * to the block it ends in. Units are counted the way the scanner counts them
+ * in mapped files; byte trigrams are taken from the block as it is. False if
+ * the scanner could not search the file as UTF-8 bytes either.
+ */
+bool TrigramWorker::process_blocks(QFile& file, QString const& directory_name, QString const& file_name,
+                                   FileStamp const& stamp) {
+    QTextCodec* codec = QTextCodec::codecForLocale();
+    qint64 size = file.size();
+    if (codec == nullptr || codec->mibEnum() != UTF8_MIB || size == 0) {
+        return false;
+    }
+    uchar* data = file.map(0, size);
+    if (data == nullptr) {
+        return false;
+    }
+    uint8_t const* end = data + size;
+    uint8_t const* begin = binary_file::utf8_start(data, end);
+    if (begin == nullptr) {
+        file.unmap(data);
+        return false;
+    }
+
+    std::vector<DirectoryIndex::BlockEnd> ends;
+    std::vector<uint64_t> filter_sizes;
+    std::vector<uint64_t> filters;
+    std::vector<int64_t> block_trigrams;
+    int64_t trigram = 0;
+    uint64_t characters = 0;
+    uint64_t bytes = 0;
+    uint64_t units = 0;
+    uint64_t lines = 0;
+    for (uint8_t const* block = begin; block != end; ) {
+        uint8_t const* block_end = uint64_t(end - block) > DirectoryIndex::BLOCK_SIZE ?
+                                   block + DirectoryIndex::BLOCK_SIZE : end;
+        while (block_end != end && (*block_end & 0xc0) == 0x80) {
+            ++block_end;
+        }
+        block_trigrams.clear();
+        if (kind == ByteTrigrams) {
+            if (valid_utf8(block, block_end) != block_end) {
+                file.unmap(data);
+                return false;
+            }
+            byte_trigrams(block, block_end, trigram, bytes, block_trigrams);
+            forget(block_trigrams);
+        } else {
+            int64_t start = stats != nullptr ? monotonic_ns() : 0;
+            QString text = QString::fromUtf8(reinterpret_cast<char const*>(block), block_end - block);
+            if (stats != nullptr) {
+                decode_ns += monotonic_ns() - start;
+            }
+            for (QChar c: text) {
+                trigram = next_trigram(trigram, c);
+                if (++characters >= 3) {
+                    block_trigrams.push_back(trigram);
+                }
+            }
+        }
+        std::sort(block_trigrams.begin(), block_trigrams.end());
+        block_trigrams.erase(std::unique(block_trigrams.begin(), block_trigrams.end()), block_trigrams.end());
+        filter_sizes.push_back(bloom_filter::build(block_trigrams, filters));
+
+        units += utf16_length(block, block_end);
+        lines += std::count(block, block_end, '\n');
+        ends.push_back({uint64_t(block_end - data), units, lines});
+        block = block_end;
+        if (QThread::currentThread()->isInterruptionRequested()) {
+            file.unmap(data);
+            return true;
+        }
+    }
+    file.unmap(data);
+    trigrams.directories[directory_name].add_blocked(file_name, stamp, ends, filter_sizes, filters);
+    return true;
+}
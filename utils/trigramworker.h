@@ -1,11 +1,21 @@
 #ifndef TRIGRAMWORKER_H
 #define TRIGRAMWORKER_H
 
+#include "trigramindex.h"
+#include "workqueue.h"
+#include "binaryfile.h"
+#include "searchstats.h"
+#include "duplicatefinder.h"
+
 #include <QObject>
 #include <QString>
+#include <QTextStream>
+#include <QFile>
 
-#include <map>
-#include <set>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <cstdint>
 
 class TrigramWorker : public QObject
 {
@@ -15,19 +25,40 @@ public:
     ~TrigramWorker();
 
 signals:
-    void files_processed(std::map<QString, std::map<QString, std::set<int64_t>>>* result);
+    void files_processed(TrigramIndex* result);
     void throw_progress(QString const& directory);
     void throw_error(QString const& file_name);
+    void throw_binary(QString const& file_name);
 
 public slots:
     void process_files();
 
 public:
-    std::list<std::pair<QString, QString>> files;
-    std::map<QString, std::map<QString, std::set<int64_t>>> trigrams;
+    std::shared_ptr<BoundedQueue<std::pair<QString, QString>>> files;
+    TrigramIndex trigrams;
+    trigram_kind kind = CharTrigrams;
+    std::shared_ptr<SearchStats> stats;
+    // files found to be copies of another are added as copies without being read
+    std::shared_ptr<DuplicateFinder> duplicates;
 
 private:
     void process_file(std::pair<QString, QString> const& file_directory);
+    void process_bytes(QFile& file, QString const& directory_name, QString const& file_name,
+                       FileStamp const& stamp);
+    bool process_blocks(QFile& file, QString const& directory_name, QString const& file_name,
+                        FileStamp const& stamp);
+    void byte_trigrams(uint8_t const* begin, uint8_t const* end, int64_t& trigram, uint64_t& bytes,
+                       std::vector<int64_t>& list);
+    void forget(std::vector<int64_t> const& list);
+    QString read(QTextStream& stream, int size);
+    QByteArray read(QFile& file, qint64 size);
+
+    // with stats, time of this worker's files spent opening them and decoding them
+    int64_t io_ns = 0;
+    int64_t decode_ns = 0;
+
+    // with ByteIndex, the byte trigrams already in the list being built
+    std::vector<uint64_t> seen;
 };
 
 #endif // TRIGRAMWORKER_H
@@ -0,0 +1,73 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <QThread>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <cstddef>
+
+
+/*
+ * Tasks handed from threads still producing them to threads working on them.
+ * push() waits while `capacity` tasks are queued, so producers can't run
+ * ahead of the workers by more than that, and take() waits until there is a
+ * task or the queue is closed and drained. Closing also makes push() fail,
+ * which is how workers that stop early stop their producers.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // false once the queue is closed
+    bool push(T task) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return closed || tasks.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        tasks.push_back(std::move(task));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // empty once the queue is closed and every task has been taken
+    std::optional<T> take() {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !tasks.empty(); });
+        if (tasks.empty()) {
+            return std::nullopt;
+        }
+        T task = std::move(tasks.front());
+        tasks.pop_front();
+        not_full.notify_one();
+        return task;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    std::deque<T> tasks;
+    size_t capacity;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+// 0 stands for one thread per core
+inline size_t thread_count(int requested) {
+    return requested > 0 ? requested : std::max(1, QThread::idealThreadCount());
+}
+
+#endif // WORKQUEUE_H